@@ -0,0 +1,606 @@
+/**
+    @file aio.c
+    @author Shlok Dave (ssdave)
+    Implementation for the aio component.  With io_uring, requests are put
+    in the submission ring and handed to the kernel with one system call,
+    and finished ones are picked up from the completion ring without any.
+    A sync or close is marked to drain, so the kernel starts it only after
+    everything before it is done.  Without io_uring, requests wait in a
+    queue for a pool of threads, and a thread skips any request whose file
+    another thread is still working on, which keeps each file's requests
+    in order.
+  */
+
+#define _GNU_SOURCE
+
+#include "aio.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/** Number of threads used when io_uring isn't available. */
+#define AIO_THREADS 2
+
+/** What a request does. */
+typedef enum
+{
+  WRITE_REQ,
+  SYNC_REQ,
+  CLOSE_REQ
+} RequestKind;
+
+/** Type for a request. */
+typedef struct RequestStruct Request;
+
+/** One write, sync or close. */
+struct RequestStruct
+{
+  /** What the request does. */
+  RequestKind kind;
+
+  /** File it's for. */
+  int fd;
+
+  /** Bytes to write, owned by the request. */
+  char *buf;
+
+  /** Number of bytes in buf. */
+  size_t len;
+
+  /** Number of them already written. */
+  size_t done;
+
+  /** Offset in the file for the first byte of buf. */
+  off_t off;
+
+  /** What the request returned when a thread ran it, as finishRequest takes it. */
+  int result;
+
+  /** Next request in the queue or the finished list. */
+  Request *next;
+};
+
+/** Representation of the asynchronous I/O. */
+struct AsyncIOStruct
+{
+  /** True if requests go through io_uring. */
+  bool ring;
+
+  /** Most requests in progress at once. */
+  int depth;
+
+  /** Number of requests made that haven't been cleaned up after. */
+  int pending;
+
+  /** Number of requests that failed since they were last counted. */
+  int failed;
+
+  /** Descriptor of the ring. */
+  int ringFd;
+
+  /** Number of entries in the submission ring. */
+  unsigned int entries;
+
+  /** Fields of the submission ring, shared with the kernel. */
+  unsigned int *sqHead, *sqTail, *sqMask, *sqArray;
+
+  /** Fields of the completion ring, shared with the kernel. */
+  unsigned int *cqHead, *cqTail, *cqMask;
+
+  /** Submission queue entries. */
+  struct io_uring_sqe *sqes;
+
+  /** Completion queue entries. */
+  struct io_uring_cqe *cqes;
+
+  /** Mapped memory of the rings and the entries, and their lengths. */
+  void *sqMap, *cqMap;
+  size_t sqLen, cqLen, sqesLen;
+
+  /** Number of entries put in the submission ring since the kernel was last told. */
+  unsigned int unsent;
+
+  /** Threads of the pool. */
+  pthread_t threads[AIO_THREADS];
+
+  /** Request each thread is working on, or NULL. */
+  Request *running[AIO_THREADS];
+
+  /** Number of threads that have started, which numbers them. */
+  int started;
+
+  /** Lock for everything the threads share. */
+  pthread_mutex_t lock;
+
+  /** Signaled when a request is queued or a file is free again. */
+  pthread_cond_t work;
+
+  /** Signaled when a request finishes. */
+  pthread_cond_t finish;
+
+  /** Requests waiting for a thread, oldest first. */
+  Request *head, *tail;
+
+  /** Requests that finished and haven't been cleaned up after. */
+  Request *finished;
+
+  /** True once the threads should exit. */
+  bool stopping;
+};
+
+/**
+  Helper function that sets up io_uring and maps its rings.
+  @param io the asynchronous I/O.
+  @return false if io_uring isn't available.
+*/
+static bool openRing(AsyncIO *io)
+{
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  io->ringFd = syscall(__NR_io_uring_setup, io->depth, &p);
+  if (io->ringFd < 0)
+    return false;
+
+  io->entries = p.sq_entries;
+  io->sqLen = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  io->cqLen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    io->sqLen = io->cqLen = io->sqLen > io->cqLen ? io->sqLen : io->cqLen;
+  io->sqesLen = p.sq_entries * sizeof(struct io_uring_sqe);
+
+  io->sqMap = mmap(NULL, io->sqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   io->ringFd, IORING_OFF_SQ_RING);
+  io->cqMap = p.features & IORING_FEAT_SINGLE_MMAP
+                ? io->sqMap
+                : mmap(NULL, io->cqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       io->ringFd, IORING_OFF_CQ_RING);
+  io->sqes = mmap(NULL, io->sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  io->ringFd, IORING_OFF_SQES);
+  if (io->sqMap == MAP_FAILED || io->cqMap == MAP_FAILED || io->sqes == MAP_FAILED)
+  {
+    if (io->sqMap != MAP_FAILED)
+      munmap(io->sqMap, io->sqLen);
+    if (io->cqMap != MAP_FAILED && io->cqMap != io->sqMap)
+      munmap(io->cqMap, io->cqLen);
+    if (io->sqes != MAP_FAILED)
+      munmap(io->sqes, io->sqesLen);
+    close(io->ringFd);
+    return false;
+  }
+
+  char *sq = io->sqMap, *cq = io->cqMap;
+  io->sqHead = (unsigned int *)(sq + p.sq_off.head);
+  io->sqTail = (unsigned int *)(sq + p.sq_off.tail);
+  io->sqMask = (unsigned int *)(sq + p.sq_off.ring_mask);
+  io->sqArray = (unsigned int *)(sq + p.sq_off.array);
+  io->cqHead = (unsigned int *)(cq + p.cq_off.head);
+  io->cqTail = (unsigned int *)(cq + p.cq_off.tail);
+  io->cqMask = (unsigned int *)(cq + p.cq_off.ring_mask);
+  io->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  // Never have more in progress than the submission ring holds.
+  io->depth = io->entries;
+  return true;
+}
+
+/**
+  Helper function that tells the kernel about the new submission entries, and
+  optionally waits for at least one request to finish.
+  @param io the asynchronous I/O.
+  @param wait true to wait for a completion.
+*/
+static void enterRing(AsyncIO *io, bool wait)
+{
+  int n;
+  do
+  {
+    n = syscall(__NR_io_uring_enter, io->ringFd, io->unsent, wait ? 1 : 0,
+                wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  } while (n < 0 && errno == EINTR);
+  if (n > 0)
+    io->unsent -= n;
+}
+
+/**
+  Helper function that puts a request in the submission ring. There has to be room.
+  @param io the asynchronous I/O.
+  @param req the request.
+*/
+static void pushRing(AsyncIO *io, Request *req)
+{
+  unsigned int tail = *io->sqTail;
+  unsigned int idx = tail & *io->sqMask;
+  struct io_uring_sqe *sqe = &io->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->fd = req->fd;
+  sqe->user_data = (uint64_t)(uintptr_t)req;
+  if (req->kind == WRITE_REQ)
+  {
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->addr = (uint64_t)(uintptr_t)(req->buf + req->done);
+    sqe->len = req->len - req->done;
+    sqe->off = req->off + req->done;
+  }
+  else
+  {
+    sqe->opcode = req->kind == SYNC_REQ ? IORING_OP_FSYNC : IORING_OP_CLOSE;
+    sqe->flags = IOSQE_IO_DRAIN;
+  }
+
+  io->sqArray[idx] = idx;
+  __atomic_store_n(io->sqTail, tail + 1, __ATOMIC_RELEASE);
+  io->unsent++;
+}
+
+/**
+  Helper function that cleans up after a finished request, or sends the rest of a write
+  that was cut short.
+  @param io the asynchronous I/O.
+  @param req the request.
+  @param res what the request returned: bytes written, zero, or a negative errno.
+*/
+static void finishRequest(AsyncIO *io, Request *req, int res)
+{
+  if (req->kind == WRITE_REQ && res > 0 && req->done + res < req->len)
+  {
+    req->done += res;
+    pushRing(io, req);
+    return;
+  }
+
+  // A kernel too old to close through the ring says so, and we close it ourselves.
+  if (req->kind == CLOSE_REQ && res == -EINVAL && io->ring)
+    res = close(req->fd) < 0 ? -errno : 0;
+  if (res < 0 || (req->kind == WRITE_REQ && res == 0 && req->done < req->len))
+    io->failed++;
+
+  free(req->buf);
+  free(req);
+  io->pending--;
+}
+
+/**
+  Helper function that picks up every completion waiting in the completion ring.
+  @param io the asynchronous I/O.
+*/
+static void reapRing(AsyncIO *io)
+{
+  unsigned int head = *io->cqHead;
+  unsigned int tail = __atomic_load_n(io->cqTail, __ATOMIC_ACQUIRE);
+  while (head != tail)
+  {
+    struct io_uring_cqe *cqe = &io->cqes[head & *io->cqMask];
+    Request *req = (Request *)(uintptr_t)cqe->user_data;
+    head++;
+    __atomic_store_n(io->cqHead, head, __ATOMIC_RELEASE);
+    finishRequest(io, req, cqe->res);
+    tail = __atomic_load_n(io->cqTail, __ATOMIC_ACQUIRE);
+  }
+
+  // Writes that were cut short went back in the ring.
+  if (io->unsent)
+    enterRing(io, false);
+}
+
+/**
+  Helper function that does one request the ordinary way, on a thread of the pool.
+  @param req the request.
+  @return the bytes written or zero, or a negative errno.
+*/
+static int runRequest(Request *req)
+{
+  if (req->kind == SYNC_REQ)
+    return fsync(req->fd) < 0 ? -errno : 0;
+  if (req->kind == CLOSE_REQ)
+    return close(req->fd) < 0 ? -errno : 0;
+
+  while (req->done < req->len)
+  {
+    ssize_t n = pwrite(req->fd, req->buf + req->done, req->len - req->done,
+                       req->off + req->done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return n < 0 ? -errno : 0;
+    req->done += n;
+  }
+  return req->len;
+}
+
+/**
+  Helper function that takes the oldest queued request whose file no thread is working
+  on. The lock has to be held.
+  @param io the asynchronous I/O.
+  @return the request, or NULL if none can be started.
+*/
+static Request *takeRequest(AsyncIO *io)
+{
+  Request **link = &io->head;
+  Request *prev = NULL;
+  for (; *link; prev = *link, link = &(*link)->next)
+  {
+    bool busy = false;
+    for (int i = 0; i < AIO_THREADS; i++)
+      busy |= io->running[i] && io->running[i]->fd == (*link)->fd;
+    if (busy)
+      continue;
+
+    Request *req = *link;
+    *link = req->next;
+    if (io->tail == req)
+      io->tail = prev;
+    return req;
+  }
+  return NULL;
+}
+
+/**
+  Starting point for each thread of the pool. It runs queued requests until it's told
+  to stop and the queue is empty.
+  @param data the asynchronous I/O.
+  @return NULL.
+*/
+static void *worker(void *data)
+{
+  AsyncIO *io = data;
+  pthread_mutex_lock(&io->lock);
+  int self = io->started++;
+
+  while (true)
+  {
+    Request *req = takeRequest(io);
+    if (!req)
+    {
+      if (io->stopping && !io->head)
+        break;
+      pthread_cond_wait(&io->work, &io->lock);
+      continue;
+    }
+
+    io->running[self] = req;
+    pthread_mutex_unlock(&io->lock);
+    req->result = runRequest(req);
+    pthread_mutex_lock(&io->lock);
+    io->running[self] = NULL;
+
+    req->next = io->finished;
+    io->finished = req;
+    pthread_cond_broadcast(&io->finish);
+    pthread_cond_broadcast(&io->work);
+  }
+
+  pthread_mutex_unlock(&io->lock);
+  return NULL;
+}
+
+/**
+  Helper function that starts the thread pool.
+  @param io the asynchronous I/O.
+*/
+static void openThreads(AsyncIO *io)
+{
+  pthread_mutex_init(&io->lock, NULL);
+  pthread_cond_init(&io->work, NULL);
+  pthread_cond_init(&io->finish, NULL);
+  for (int i = 0; i < AIO_THREADS; i++)
+    pthread_create(&io->threads[i], NULL, worker, io);
+}
+
+/**
+  Helper function that cleans up after every request the threads have finished.
+  @param io the asynchronous I/O.
+*/
+static void reapThreads(AsyncIO *io)
+{
+  pthread_mutex_lock(&io->lock);
+  Request *req = io->finished;
+  io->finished = NULL;
+  pthread_mutex_unlock(&io->lock);
+
+  while (req)
+  {
+    Request *next = req->next;
+    finishRequest(io, req, req->result);
+    req = next;
+  }
+}
+
+/**
+  This function starts the background I/O, with io_uring if it's wanted and the kernel
+  lets us set it up, and with a pool of threads otherwise.
+  @param depth most requests that can be in progress at once.
+  @param ring true to try io_uring first.
+  @return pointer to the new asynchronous I/O.
+*/
+AsyncIO *makeAsync(int depth, bool ring)
+{
+  AsyncIO *io = calloc(1, sizeof(AsyncIO));
+  io->depth = depth;
+  io->ring = ring && openRing(io);
+  if (!io->ring)
+    openThreads(io);
+  return io;
+}
+
+/**
+  This function tells whether requests are going through io_uring.
+  @param io the asynchronous I/O.
+  @return true for io_uring, false for the thread pool.
+*/
+bool asyncUsesRing(AsyncIO const *io)
+{
+  return io->ring;
+}
+
+/**
+  Helper function that hands a new request to the ring or the threads. If too many are
+  already in progress, it waits for some of them first.
+  @param io the asynchronous I/O.
+  @param req the request.
+*/
+static void submit(AsyncIO *io, Request *req)
+{
+  if (io->pending >= io->depth)
+  {
+    io->failed += asyncReap(io);
+    while (io->pending >= io->depth)
+    {
+      if (io->ring)
+        enterRing(io, true);
+      else
+      {
+        pthread_mutex_lock(&io->lock);
+        while (!io->finished)
+          pthread_cond_wait(&io->finish, &io->lock);
+        pthread_mutex_unlock(&io->lock);
+      }
+      io->failed += asyncReap(io);
+    }
+  }
+
+  io->pending++;
+  if (io->ring)
+  {
+    pushRing(io, req);
+    enterRing(io, false);
+    return;
+  }
+
+  pthread_mutex_lock(&io->lock);
+  if (io->tail)
+    io->tail->next = req;
+  else
+    io->head = req;
+  io->tail = req;
+  pthread_cond_signal(&io->work);
+  pthread_mutex_unlock(&io->lock);
+}
+
+/**
+  Helper function that makes a request with no bytes to write.
+  @param kind what the request does.
+  @param fd file it's for.
+  @return the new request.
+*/
+static Request *makeRequest(RequestKind kind, int fd)
+{
+  Request *req = calloc(1, sizeof(Request));
+  req->kind = kind;
+  req->fd = fd;
+  return req;
+}
+
+/**
+  This function starts writing bytes to a file at a given offset.
+  @param io the asynchronous I/O.
+  @param fd file to write to.
+  @param buf bytes to write, which are freed once they're written.
+  @param len number of bytes in buf.
+  @param off offset in the file to write them at.
+*/
+void asyncWrite(AsyncIO *io, int fd, char *buf, size_t len, off_t off)
+{
+  Request *req = makeRequest(WRITE_REQ, fd);
+  req->buf = buf;
+  req->len = len;
+  req->off = off;
+  submit(io, req);
+}
+
+/**
+  This function starts flushing a file to disk after the writes made to it so far.
+  @param io the asynchronous I/O.
+  @param fd file to flush.
+*/
+void asyncSync(AsyncIO *io, int fd)
+{
+  submit(io, makeRequest(SYNC_REQ, fd));
+}
+
+/**
+  This function closes a file after the requests made for it so far.
+  @param io the asynchronous I/O.
+  @param fd file to close.
+*/
+void asyncClose(AsyncIO *io, int fd)
+{
+  submit(io, makeRequest(CLOSE_REQ, fd));
+}
+
+/**
+  This function cleans up after the requests that have finished, without waiting.
+  @param io the asynchronous I/O.
+  @return number of requests that failed since the last count.
+*/
+int asyncReap(AsyncIO *io)
+{
+  if (io->ring)
+    reapRing(io);
+  else
+    reapThreads(io);
+
+  int failed = io->failed;
+  io->failed = 0;
+  return failed;
+}
+
+/**
+  This function waits for every request made so far to finish.
+  @param io the asynchronous I/O.
+  @return number of requests that failed since the last count.
+*/
+int asyncWait(AsyncIO *io)
+{
+  int failed = asyncReap(io);
+  while (io->pending > 0)
+  {
+    if (io->ring)
+      enterRing(io, true);
+    else
+    {
+      pthread_mutex_lock(&io->lock);
+      while (!io->finished)
+        pthread_cond_wait(&io->finish, &io->lock);
+      pthread_mutex_unlock(&io->lock);
+    }
+    failed += asyncReap(io);
+  }
+  return failed;
+}
+
+/**
+  This function waits for every request, then stops the ring or the threads and frees
+  the asynchronous I/O.
+  @param io the asynchronous I/O to free.
+*/
+void freeAsync(AsyncIO *io)
+{
+  asyncWait(io);
+  if (io->ring)
+  {
+    munmap(io->sqes, io->sqesLen);
+    if (io->cqMap != io->sqMap)
+      munmap(io->cqMap, io->cqLen);
+    munmap(io->sqMap, io->sqLen);
+    close(io->ringFd);
+  }
+  else
+  {
+    pthread_mutex_lock(&io->lock);
+    io->stopping = true;
+    pthread_cond_broadcast(&io->work);
+    pthread_mutex_unlock(&io->lock);
+    for (int i = 0; i < AIO_THREADS; i++)
+      pthread_join(io->threads[i], NULL);
+    pthread_mutex_destroy(&io->lock);
+    pthread_cond_destroy(&io->work);
+    pthread_cond_destroy(&io->finish);
+  }
+  free(io);
+}
@@ -0,0 +1,79 @@
+/**
+    @file aio.h
+    @author Shlok Dave (ssdave)
+    Header for the aio component, which writes and syncs files in the
+    background so the command loop doesn't wait on the disk.  Requests go
+    through io_uring when the kernel allows it, and through a small pool
+    of threads when it doesn't.  Requests for the same file are done in
+    the order they were made.
+*/
+
+#ifndef AIO_H
+#define AIO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/** Incomplete type for the asynchronous I/O representation. */
+typedef struct AsyncIOStruct AsyncIO;
+
+/** Start the background I/O.
+    @param depth Most requests that can be in progress at once; making
+    another one waits for one of them to finish.
+    @param ring True to try io_uring first, false to always use threads.
+    @return pointer to the new asynchronous I/O.
+*/
+AsyncIO *makeAsync(int depth, bool ring);
+
+/** Tell whether requests are going through io_uring.
+    @param io The asynchronous I/O.
+    @return true for io_uring, false for the thread pool.
+*/
+bool asyncUsesRing(AsyncIO const *io);
+
+/** Write bytes to a file at a given offset.
+    @param io The asynchronous I/O.
+    @param fd File to write to.
+    @param buf Bytes to write, from malloc.  They're freed once they've
+    been written.
+    @param len Number of bytes in buf.
+    @param off Offset in the file to write them at.
+*/
+void asyncWrite(AsyncIO *io, int fd, char *buf, size_t len, off_t off);
+
+/** Flush a file to disk once every write made to it so far is done.
+    @param io The asynchronous I/O.
+    @param fd File to flush.
+*/
+void asyncSync(AsyncIO *io, int fd);
+
+/** Close a file once every request made for it so far is done.  The
+    file can't be used after this is called.
+    @param io The asynchronous I/O.
+    @param fd File to close.
+*/
+void asyncClose(AsyncIO *io, int fd);
+
+/** Clean up after the requests that have finished, without waiting for
+    any others.
+    @param io The asynchronous I/O.
+    @return number of requests that failed since the last call to
+    asyncReap or asyncWait.
+*/
+int asyncReap(AsyncIO *io);
+
+/** Wait for every request made so far to finish.
+    @param io The asynchronous I/O.
+    @return number of requests that failed since the last call to
+    asyncReap or asyncWait.
+*/
+int asyncWait(AsyncIO *io);
+
+/** Wait for every request to finish, then stop the background I/O and
+    free its memory.
+    @param io The asynchronous I/O to free.
+*/
+void freeAsync(AsyncIO *io);
+
+#endif
@@ -0,0 +1,149 @@
+/**
+    @file arena.c
+    @author Shlok Dave (ssdave)
+    Implementation for the arena component.  Each string is stored right
+    after a pointer to the chunk holding it, so releasing a string only
+    needs the string itself.
+  */
+
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Bytes of strings the first chunk of an arena holds.  Each chunk after
+    that is twice as big as the one before, up to CHUNK_MAX. */
+#define CHUNK_FIRST 4096
+
+/** Largest number of bytes of strings a chunk is made to hold. */
+#define CHUNK_MAX (1024 * 1024)
+
+/** A large block of memory that strings are packed into. */
+typedef struct ChunkStruct Chunk;
+
+struct ChunkStruct
+{
+  /** Number of strings in the chunk that haven't been released. */
+  int live;
+
+  /** True once the arena has moved on to another chunk, so nothing more goes in. */
+  bool retired;
+
+  /** Number of bytes of space in use. */
+  size_t used;
+
+  /** Number of bytes of space. */
+  size_t cap;
+
+  /** The space, with each string aligned for the pointer in front of it. */
+  void *space[];
+};
+
+/** Header stored in front of each string in a chunk. */
+typedef struct
+{
+  /** Chunk the string is in. */
+  Chunk *chunk;
+
+  /** Null-terminated characters of the string. */
+  char chars[];
+} Packed;
+
+/** Representation of a string arena. */
+struct StringArenaStruct
+{
+  /** Chunk strings are being copied into, or NULL before the first. */
+  Chunk *current;
+
+  /** Capacity the next chunk is made with. */
+  size_t next;
+};
+
+/**
+  Helper function that stops copying into a chunk, freeing it if every string in it
+  was already released.
+  @param c the chunk to retire.
+*/
+static void retireChunk(Chunk *c)
+{
+  c->retired = true;
+  if (c->live == 0)
+    free(c);
+}
+
+/**
+  This function makes an empty arena. Its first chunk is made when the first string is
+  copied into it.
+  @return pointer to the new arena.
+*/
+StringArena *makeArena(void)
+{
+  StringArena *a = calloc(1, sizeof(StringArena));
+  a->next = CHUNK_FIRST;
+  return a;
+}
+
+/**
+  This function copies a string into the arena, after the last one copied. When the
+  current chunk is full it's retired and a bigger one is started, up to CHUNK_MAX.
+  @param a pointer to the arena.
+  @param str characters of the string.
+  @param len length of the string.
+  @return the null-terminated copy.
+*/
+char *arenaCopy(StringArena *a, char const *str, int len)
+{
+  // Round up, so the next string's header is aligned.
+  size_t size = offsetof(Packed, chars) + len + 1;
+  size = (size + sizeof(Chunk *) - 1) / sizeof(Chunk *) * sizeof(Chunk *);
+
+  if (!a->current || a->current->used + size > a->current->cap)
+  {
+    if (a->current)
+      retireChunk(a->current);
+
+    size_t cap = a->next > size ? a->next : size;
+    a->current = malloc(sizeof(Chunk) + cap);
+    a->current->live = 0;
+    a->current->retired = false;
+    a->current->used = 0;
+    a->current->cap = cap;
+    if (a->next < CHUNK_MAX)
+      a->next *= 2;
+  }
+
+  Chunk *c = a->current;
+  Packed *p = (Packed *)((char *)c->space + c->used);
+  c->used += size;
+  c->live++;
+
+  p->chunk = c;
+  memcpy(p->chars, str, len);
+  p->chars[len] = '\0';
+  return p->chars;
+}
+
+/**
+  This function releases a string copied into an arena. Its chunk is freed once every
+  string in it has been released and the arena has moved on to another chunk.
+  @param str a string returned by arenaCopy.
+*/
+void arenaRelease(char const *str)
+{
+  Chunk *c = ((Packed const *)(str - offsetof(Packed, chars)))->chunk;
+  if (--c->live == 0 && c->retired)
+    free(c);
+}
+
+/**
+  This function frees the arena. Strings still in use keep their chunk alive until they
+  are released.
+  @param a pointer to the arena to free.
+*/
+void freeArena(StringArena *a)
+{
+  if (a->current)
+    retireChunk(a->current);
+  free(a);
+}
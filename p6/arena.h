@@ -0,0 +1,41 @@
+/**
+    @file arena.h
+    @author Shlok Dave (ssdave)
+    Header for the arena component, which packs strings next to each other
+    in large chunks instead of giving each one its own allocation.  Each
+    chunk counts the strings still in it and is freed when the last one is
+    released.
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+/** Incomplete type for the string arena representation. */
+typedef struct StringArenaStruct StringArena;
+
+/** Make an empty string arena.
+    @return pointer to a new arena.
+*/
+StringArena *makeArena(void);
+
+/** Copy a string into the arena, right after the last one copied.
+    @param a Arena to copy into.
+    @param str Characters of the string.
+    @param len Length of the string.
+    @return the null-terminated copy, which stays put until it's released.
+*/
+char *arenaCopy(StringArena *a, char const *str, int len);
+
+/** Release a string copied into an arena.  Its chunk is freed once every
+    string in it has been released and the arena is done filling it.
+    @param str String returned by arenaCopy.
+*/
+void arenaRelease(char const *str);
+
+/** Stop copying strings into an arena and free it.  Strings already in
+    the arena stay good until they're released.
+    @param a The arena to free.
+*/
+void freeArena(StringArena *a);
+
+#endif
@@ -0,0 +1,178 @@
+/**
+    @file bloom.c
+    @author Shlok Dave (ssdave)
+    Implementation for the bloom component.  The filter is split into
+    blocks the size of one cache line, and every key sets all of its bits
+    inside a single block, so a query touches only one line of memory.
+  */
+
+#include "bloom.h"
+#include <stdlib.h>
+#include <stdint.h>
+
+/** Number of 64-bit words in a block, 8 words make up a 64-byte cache line. */
+#define BLOCK_WORDS 8
+
+/** Size of a block in bytes, used for aligning the block array. */
+#define BLOCK_BYTES 64
+
+/** Number of filter bits we budget for each key the filter is sized for. */
+#define BITS_PER_KEY 16
+
+/** Number of bits in a block. */
+#define BLOCK_BITS (BLOCK_WORDS * 64)
+
+/** Ask the processor to start loading an address into the cache. */
+#ifdef __GNUC__
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p) ((void)(p))
+#endif
+
+/** One cache line worth of filter bits. */
+typedef struct
+{
+  /** Words of the block, each key sets exactly one bit in every word. */
+  uint64_t words[BLOCK_WORDS];
+} BloomBlock;
+
+/** Representation of a blocked Bloom filter. */
+struct BloomStruct
+{
+  /** Cache-line aligned array of blocks. */
+  BloomBlock *blocks;
+
+  /** Memory returned by the allocator, kept so it can be freed. */
+  void *mem;
+
+  /** Number of blocks in the filter. */
+  uint32_t nblocks;
+
+  /** Number of keys the filter was sized for. */
+  int capacity;
+};
+
+/** Odd multipliers used to pick a different bit in each word of a block. */
+static const uint32_t salts[BLOCK_WORDS] = {
+  0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+  0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+/**
+  Helper function that spreads the bits of a 32-bit key hash over 64 bits. Some
+  key hashes, like the one for integers, are just the key itself, so they have to
+  be mixed before they can pick a block and bits fairly.
+  @param hash the key hash to mix.
+  @return the mixed 64-bit hash.
+*/
+static uint64_t mixHash(unsigned int hash)
+{
+  uint64_t x = hash + 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+/**
+  Helper function that finds the block a mixed hash belongs to. The high half
+  of the hash is scaled into the block count with a multiply instead of a modulus.
+  @param b the filter the block is in.
+  @param mixed the mixed hash of the key.
+  @return pointer to the block for the key.
+*/
+static BloomBlock *blockFor(Bloom const *b, uint64_t mixed)
+{
+  uint32_t idx = (uint32_t)(((mixed >> 32) * (uint64_t)b->nblocks) >> 32);
+  return &b->blocks[idx];
+}
+
+/**
+  This function makes an empty filter sized for the given number of keys. The blocks are
+  allocated on a cache line boundary, so checking a key touches only one line.
+  @param capacity number of keys the filter is sized for.
+  @return pointer to the new filter.
+*/
+Bloom *makeBloom(int capacity)
+{
+  if (capacity < 1)
+    capacity = 1;
+
+  Bloom *b = malloc(sizeof(Bloom));
+  b->capacity = capacity;
+  b->nblocks = ((uint64_t)capacity * BITS_PER_KEY + BLOCK_BITS - 1) / BLOCK_BITS;
+
+  // Over-allocate so the block array can start on a cache line boundary.
+  b->mem = calloc(1, b->nblocks * sizeof(BloomBlock) + BLOCK_BYTES);
+  uintptr_t addr = ((uintptr_t)b->mem + BLOCK_BYTES - 1) & ~(uintptr_t)(BLOCK_BYTES - 1);
+  b->blocks = (BloomBlock *)addr;
+
+  return b;
+}
+
+/**
+  This function gives the number of keys the filter was sized for.
+  @param b pointer to the filter.
+  @return the capacity it was made with.
+*/
+int bloomCapacity(Bloom const *b)
+{
+  return b->capacity;
+}
+
+/**
+  This function adds a key to the filter by setting one bit in each word of its block.
+  @param b pointer to the filter.
+  @param hash hash of the key.
+*/
+void bloomAdd(Bloom *b, unsigned int hash)
+{
+  uint64_t mixed = mixHash(hash);
+  BloomBlock *block = blockFor(b, mixed);
+  uint32_t low = (uint32_t)mixed;
+
+  // Set one bit in every word of the block.
+  for (int i = 0; i < BLOCK_WORDS; i++)
+    block->words[i] |= 1ULL << ((low * salts[i]) >> 26);
+}
+
+/**
+  This function checks whether a key may have been added to the filter.
+  @param b pointer to the filter.
+  @param hash hash of the key.
+  @return false if the key was never added, true if it may have been.
+*/
+bool bloomMayContain(Bloom const *b, unsigned int hash)
+{
+  uint64_t mixed = mixHash(hash);
+  BloomBlock const *block = blockFor(b, mixed);
+  uint32_t low = (uint32_t)mixed;
+
+  // The key may be present only if every one of its bits is set.
+  for (int i = 0; i < BLOCK_WORDS; i++)
+  {
+    if (!(block->words[i] & (1ULL << ((low * salts[i]) >> 26))))
+      return false;
+  }
+  return true;
+}
+
+/**
+  This function asks for the block a key would be checked in to be loaded into the cache,
+  so a later bloomMayContain for it doesn't have to wait.
+  @param b pointer to the filter.
+  @param hash hash of the key.
+*/
+void bloomPrefetch(Bloom const *b, unsigned int hash)
+{
+  PREFETCH(blockFor(b, mixHash(hash)));
+}
+
+/**
+  This function frees the filter.
+  @param b pointer to the filter to free.
+*/
+void freeBloom(Bloom *b)
+{
+  free(b->mem);
+  free(b);
+}
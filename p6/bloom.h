@@ -0,0 +1,55 @@
+/**
+    @file bloom.h
+    @author Shlok Dave (ssdave)
+    Header for the bloom component, a blocked Bloom filter over key hashes
+    that lets the map answer most lookups for missing keys without walking
+    a hash chain.
+*/
+
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stdbool.h>
+
+/** Incomplete type for the Bloom filter representation. */
+typedef struct BloomStruct Bloom;
+
+/** Make an empty Bloom filter.
+    @param capacity Number of keys the filter is sized for.
+    @return pointer to a new filter.
+*/
+Bloom *makeBloom(int capacity);
+
+/** Get the number of keys the filter was sized for.
+    @param b Pointer to the filter.
+    @return capacity given when the filter was made.
+*/
+int bloomCapacity(Bloom const *b);
+
+/** Record a key hash in the filter.
+    @param b Filter to add the hash to.
+    @param hash Hash value of the key being added.
+*/
+void bloomAdd(Bloom *b, unsigned int hash);
+
+/** Check whether a key hash might be in the filter.  Only one cache line
+    of the filter is read.
+    @param b Filter to query.
+    @param hash Hash value of the key to look for.
+    @return false if the key is definitely not present, true if it may be.
+*/
+bool bloomMayContain(Bloom const *b, unsigned int hash);
+
+/** Start loading the cache line a key hash would be checked against, so a
+    later call to bloomMayContain for the same hash doesn't have to wait.
+    @param b Filter that will be queried.
+    @param hash Hash value of the key that will be looked for.
+*/
+void bloomPrefetch(Bloom const *b, unsigned int hash);
+
+/** Free all the memory used by a filter.
+    @param b The filter to free.
+*/
+void freeBloom(Bloom *b);
+
+#endif
@@ -8,11 +8,22 @@
   truly acts as the "brain" of the entire program.
 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "map.h"
 #include "input.h"
+#include "repl.h"
+#include "trace.h"
+#include "aio.h"
+#include "hotkey.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
 
 /** Size of the hash table. */
 #define MAP_SIZE 100
@@ -23,6 +34,9 @@
 /** Command line argument for the get command. */
 #define GET_COMM 3
 
+/** Most get commands read ahead and looked up together. */
+#define GET_BATCH 16
+
 /** Command line argument for the remove command. */
 #define REM_COMM 6
 
@@ -32,6 +46,272 @@
 /** Command line argument for the quit command. */
 #define QUIT_COMM 4
 
+/** Command line argument for the scan command. */
+#define SCAN_COMM 4
+
+/** Number of pairs the scan command visits if no count is given. */
+#define SCAN_COUNT 10
+
+/** Command line argument for the keys command. */
+#define KEYS_COMM 4
+
+/** Command line argument for the keysof command. */
+#define KEYSOF_COMM 6
+
+/** Command line argument for the save command. */
+#define SAVE_COMM 4
+
+/** Number of snapshot buckets written out after each command while a save is running. */
+#define SAVE_STEP 64
+
+/** Command line argument for the select command. */
+#define SELECT_COMM 6
+
+/** Room for the select command that starts a log. */
+#define SELECT_LINE 32
+
+/** Command line argument for the flush command. */
+#define FLUSH_COMM 5
+
+/** Command line argument for the log command. */
+#define LOG_COMM 3
+
+/** Command line argument for the multi command. */
+#define MULTI_COMM 5
+
+/** Command line argument for the exec command. */
+#define EXEC_COMM 4
+
+/** Command line argument for the discard command. */
+#define DISCARD_COMM 7
+
+/** Command line argument for the checkpoint command. */
+#define CHECKPOINT_COMM 10
+
+/** Shortest string value a keyspace stores compressed. */
+#define COMPRESS_AT 256
+
+/** Command line argument for the compact command. */
+#define COMPACT_COMM 7
+
+/** Number of pairs of a keyspace being compacted that are looked at after each command. */
+#define COMPACT_STEP 256
+
+/** Command line argument for the replicate command. */
+#define REPLICATE_COMM 9
+
+/** Command line option that starts the driver as a follower. */
+#define FOLLOW_FLAG "--follow"
+
+/** Command line option that records the commands into a trace. */
+#define TRACE_FLAG "--trace"
+
+/** Command line option that replays the commands from a trace. */
+#define REPLAY_FLAG "--replay"
+
+/** Replay speed that means as fast as possible. */
+#define REPLAY_MAX "max"
+
+/** Nanoseconds before a replayed command is due that the replay stops sleeping and just
+    watches the clock, since a sleep can run long. */
+#define REPLAY_SPIN 100000
+
+/** Most mismatched outputs a replay describes before just counting them. */
+#define REPLAY_REPORTS 5
+
+/** Milliseconds a follower waits before checking a feed that had no more records again. */
+#define FOLLOW_WAIT 100
+
+/** Number of keyspaces the select command can switch between. */
+#define KEYSPACES 16
+
+/** Number of pairs of flushed keyspaces freed after each command. */
+#define FLUSH_STEP 256
+
+/** Most file writes that can be in progress at once. */
+#define AIO_DEPTH 64
+
+/** Command line argument for the hotkeys command. */
+#define HOTKEYS_COMM 7
+
+/** Number of hot keys the hotkeys command reports. */
+#define HOT_KEYS 10
+
+/** About one get or set in this many has its key counted for the hotkeys command. */
+#define HOT_SAMPLE 8
+
+/** Command line argument for the sync command. */
+#define SYNC_COMM 4
+
+/** A save that writes a snapshot of the map to a file a little at a time, between commands. */
+typedef struct
+{
+  /** Snapshot being written, or NULL if no save is running. */
+  MapSnapshot *snap;
+
+  /** File the snapshot is written to. */
+  int fd;
+
+  /** Number of bytes of the snapshot written so far. */
+  off_t end;
+
+  /** Where the writes go. */
+  AsyncIO *io;
+} SaveJob;
+
+/** The file every command that changes a map is added to. */
+typedef struct
+{
+  /** The file, or -1 if there isn't a log. */
+  int fd;
+
+  /** Length of the file, counting the writes still in progress. */
+  off_t end;
+
+  /** Where the writes go. */
+  AsyncIO *io;
+} CommandLog;
+
+/** A set or remove command that was queued up in a transaction, already parsed. */
+typedef struct
+{
+  /** True for a set command, false for a remove command. */
+  bool isSet;
+
+  /** Key the command is for. */
+  Value key;
+
+  /** Value to set, only used by set commands. */
+  Value val;
+} QueuedComm;
+
+/** The commands between multi and exec, which are applied all together or not at all. */
+typedef struct
+{
+  /** True while commands are being queued up. */
+  bool open;
+
+  /** True if a command couldn't be queued, so exec has to throw them all away. */
+  bool failed;
+
+  /** Commands queued so far, in order. */
+  QueuedComm *comms;
+
+  /** Number of commands queued so far. */
+  int count;
+
+  /** Capacity of the comms array. */
+  int cap;
+
+  /** Stream collecting the text of the queued commands, for the log. */
+  FILE *text;
+
+  /** Buffer the text stream writes to. */
+  char *buf;
+
+  /** Length of the text in buf. */
+  size_t len;
+} Transaction;
+
+/** A keyspace's place among the keyspaces, which its map's observer is given. */
+typedef struct
+{
+  /** The keyspaces it's one of. */
+  struct KeyspacesStruct *ks;
+
+  /** Index of the keyspace. */
+  int space;
+} KeyspaceRef;
+
+/** The separate maps commands can be sent to, along with flushed maps that are still being freed. */
+typedef struct KeyspacesStruct
+{
+  /** Map for each keyspace, or NULL for the ones that haven't been selected yet. */
+  Map *maps[KEYSPACES];
+
+  /** Hash table size each keyspace's map is made with. */
+  int sizes[KEYSPACES];
+
+  /** True for each keyspace whose map is kept in a file. */
+  bool inFile[KEYSPACES];
+
+  /** Feed every change is sent to, or NULL if the maps aren't being replicated. */
+  ReplFeed *feed;
+
+  /** Where each keyspace's map sends its changes to be replicated. */
+  KeyspaceRef refs[KEYSPACES];
+
+  /** Map that's being compacted, or NULL if there isn't one. */
+  Map *compacting;
+
+  /** Index of the keyspace commands go to. */
+  int current;
+
+  /** Flushed maps waiting to be freed, oldest first. */
+  Map **doomed;
+
+  /** Number of flushed maps waiting to be freed. */
+  int dcount;
+
+  /** Capacity of the doomed array. */
+  int dcap;
+} Keyspaces;
+
+/** A trace of the commands being recorded or replayed. While either is happening, each
+    command's output is collected on its own so it can be recorded or checked. */
+typedef struct
+{
+  /** Trace the commands are recorded into, or NULL. */
+  TraceWriter *writer;
+
+  /** Trace the commands are replayed from, or NULL. */
+  TraceReader *reader;
+
+  /** How many times faster than they were recorded to replay the commands, or 0 for as
+      fast as possible. */
+  double speed;
+
+  /** Stream the output of the current command goes to, or NULL if nothing's being traced. */
+  FILE *capture;
+
+  /** Buffer the capture stream writes to. */
+  char *text;
+
+  /** Length of the text in the buffer. */
+  size_t len;
+
+  /** Clock reading when the trace started. */
+  uint64_t start;
+
+  /** Copy of the command being recorded, since running a command splits it up. */
+  char *comm;
+
+  /** Clock reading when the current command arrived, or was due to arrive in a replay. */
+  uint64_t arrived;
+
+  /** Command being replayed. */
+  TraceEntry entry;
+
+  /** Nanoseconds each replayed command took, counting from when it was due. */
+  uint64_t *latencies;
+
+  /** Number of commands replayed. */
+  int count;
+
+  /** Capacity of the latencies array. */
+  int cap;
+
+  /** Number of replayed commands whose output didn't match the trace. */
+  int mismatches;
+} Recorder;
+
+/** Stream every response goes to: standard output, or the capture stream of a trace. */
+static FILE *out;
+
+/** Where commands are read from standard input. It keeps its own buffer, so it can tell when a
+    command has already been read in and nothing has to be waited for. */
+static LineReader *in;
+
 /**
   This function is a helper function responsible for parsing either a key or a value from a given
   string. The function zeros out for the Value structure that is provided and then
@@ -65,8 +345,8 @@ static int detKeyOrVal(Value *value, char *str, bool hasK)
     }
     else
     {
-      // Otherwise, parse as an integer.
-      parseResult = parseInteger(value, str);
+      // Otherwise, parse as a number.
+      parseResult = parseNumber(value, str);
     }
   }
 
@@ -74,23 +354,20 @@ static int detKeyOrVal(Value *value, char *str, bool hasK)
 }
 
 /**
-  This function is a helper function responsible for handling the command specified to "set" for
-  the map. It breaks down the command string to get the key and the value, while parsing them and
-  adding them to the map. The key can be a string or an integer and the detKeyOrVal is used to help
-  parse the key and the value from the command string. For any reason, if the command string is not
-  in the proper format, an error exits the map.
-  @param map pointer to the map that the key and values will be set onto.
-  @param comm the command represented as a string.
+  This function is a helper function that parses the key and the value out of a set command.
+  The key can be a string or an integer and the detKeyOrVal is used to help parse the key and
+  the value from the command string.
+  @param key pointer to the value structure the key is parsed into.
+  @param value pointer to the value structure the value is parsed into.
+  @param comm the command represented as a string. It gets split up while it's parsed.
+  @return true if both the key and the value were parsed. If not, nothing is left to free.
 */
-static void commSet(Map *m, char *comm)
+static bool parseSet(Value *key, Value *value, char *comm)
 {
   // Splits the string into a key and a value.
   strtok(comm, " ");
   char *sepKey = strtok(NULL, " ");
 
-  // Initializing key for Val struct.
-  Value key = {0};
-
   // Check if the Key is a string with quotes.
   if (sepKey[0] == '\"')
   {
@@ -99,55 +376,75 @@ static void commSet(Map *m, char *comm)
     *(endOfStr + 1) = '\0';
 
     // Parse the key with the string format.
-    if (!detKeyOrVal(&key, sepKey, true))
+    if (!detKeyOrVal(key, sepKey, true))
     {
-      key.empty(&key);
-      return;
+      return false;
     }
   }
   else
   {
     // Parsing the key for an integer format.
-    if (!detKeyOrVal(&key, sepKey, false))
+    if (!detKeyOrVal(key, sepKey, false))
     {
-      key.empty(&key);
-      return;
+      return false;
     }
   }
 
   char *sepVal = strtok(NULL, "");
 
-  // Initializing value for Val struct.
-  Value value = {0};
-
   // Parse as either a string or an integer format.
-  if (!detKeyOrVal(&value, sepVal, false))
+  if (!detKeyOrVal(value, sepVal, false))
   {
-    key.empty(&key);
-    return;
+    key->empty(key);
+    return false;
+  }
+
+  return true;
+}
+
+/**
+  This function is a helper function responsible for handling the command specified to "set" for
+  the map. It breaks down the command string to get the key and the value, while parsing them and
+  adding them to the map. For any reason, if the command string is not in the proper format,
+  nothing is added to the map.
+  @param map pointer to the map that the key and values will be set onto.
+  @param comm the command represented as a string.
+  @param hot tracker the key is counted in.
+  @return true if the pair was set.
+*/
+static bool commSet(Map *m, char *comm, HotKeys *hot)
+{
+  // Initializing key and value for Val struct.
+  Value key = {0};
+  Value value = {0};
+  if (!parseSet(&key, &value, comm))
+  {
+    return false;
   }
+  hotKeysAdd(hot, &key);
 
   // Set the parsed key and value onto the map.
   mapSet(m, &key, &value);
+  return true;
 }
 
 /**
-  This function is a helper function that is responsible for getting the value that is
-  associated with the specified key on the map. First, the function parses the command string
-  to extract the key and then it gets the value that is corresponding to the key. The key can
+  This function is a helper function that parses the key out of a get command. The key can
   either be a string or an integer and it uses detKeyOrVal to parse the key that is directly
   from the command line.
-  @param map pointer to the map that the value is getting retrieved from.
-  @param comm pointer to the command that is represented as a string.
+  @param key pointer to the value structure the key is parsed into.
+  @param comm pointer to the command that is represented as a string. It gets split up
+  while it's parsed.
+  @return true if the key was parsed.
 */
-static void commGet(Map *m, char *comm)
+static bool parseGetKey(Value *key, char *comm)
 {
   // Splits the string into a key and a value.
   strtok(comm, " ");
   char *sepKey = strtok(NULL, " ");
 
   // Initializing key for Val struct.
-  Value key = {0};
+  memset(key, 0, sizeof(Value));
 
   // Check if the Key is a string with quotes.
   if (sepKey[0] == '\"')
@@ -157,34 +454,125 @@ static void commGet(Map *m, char *comm)
     *(endOfStr + 1) = '\0';
 
     // Parse the key with the string format.
-    if (!detKeyOrVal(&key, sepKey, true))
-    {
-      return;
-    }
+    return detKeyOrVal(key, sepKey, true);
+  }
+
+  // Parse the key with the integer format.
+  return detKeyOrVal(key, sepKey, false);
+}
+
+/**
+  This function is a helper function that prints the answer to a get command, either the
+  value that was found or Undefined if there wasn't one.
+  @param value pointer to the value that was found, or NULL.
+*/
+static void printGetResult(Value *value)
+{
+  if (value && value->print)
+  {
+    writeValue(value, out);
+    fprintf(out, "\n");
   }
   else
   {
-    // Parse the key with the integer format.
-    if (!detKeyOrVal(&key, sepKey, false))
+    fprintf(out, "Undefined\n");
+  }
+}
+
+/**
+  This function is a helper function that is responsible for getting the value that is
+  associated with the specified key on the map. First, the function parses the command string
+  to extract the key and then it gets the value that is corresponding to the key.
+  @param map pointer to the map that the value is getting retrieved from.
+  @param comm pointer to the command that is represented as a string.
+  @param hot tracker the key is counted in.
+*/
+static void commGet(Map *m, char *comm, HotKeys *hot)
+{
+  // Initializing key for Val struct.
+  Value key;
+  if (!parseGetKey(&key, comm))
+  {
+    return;
+  }
+  hotKeysAdd(hot, &key);
+
+  // Initializing value for Val struct.
+  printGetResult(mapGet(m, &key));
+
+  key.empty(&key);
+}
+
+/**
+  This function is a helper function that handles a run of get commands in a row. Starting
+  with a get command that was already read and echoed, it reads ahead for more get commands
+  that have already arrived, up to GET_BATCH of them, and looks up all their keys together
+  with mapGetBatch, so the lookups can overlap their cache misses. Then each command is echoed
+  and answered in order, just like they would be one at a time.
+  @param m pointer to the map the values are retrieved from.
+  @param first the get command that starts the run.
+  @param hot tracker the keys are counted in.
+  @return the line that was read after the run, which isn't a get command, or NULL if no
+  line was read after it.
+*/
+static char *commGetRun(Map *m, char *first, HotKeys *hot)
+{
+  char *lines[GET_BATCH];
+  Value keys[GET_BATCH];
+  Value *vals[GET_BATCH];
+  int parsed[GET_BATCH];
+  int count = 0;
+  int nkeys = 0;
+  char *next = NULL;
+
+  // Read ahead while the lines are get commands. A client waiting on the answer to the last
+  // one won't send any more, so only lines that are already there are read.
+  lines[count++] = first;
+  while (count < GET_BATCH && lineReady(in))
+  {
+    next = nextLine(in);
+    if (next == NULL || strncmp(next, "get", GET_COMM) != 0)
     {
-      return;
+      break;
     }
+    lines[count++] = next;
+    next = NULL;
   }
 
-  // Initializing value for Val struct.
-  Value *value = mapGet(m, &key);
+  // Parse each key from a copy, since the lines still need to be echoed.
+  for (int i = 0; i < count; i++)
+  {
+    char *copy = malloc(strlen(lines[i]) + 1);
+    strcpy(copy, lines[i]);
+    parsed[i] = parseGetKey(&keys[nkeys], copy) ? nkeys++ : -1;
+    free(copy);
+  }
 
-  if (value && value->print)
+  mapGetBatch(m, keys, nkeys, vals);
+  for (int i = 0; i < nkeys; i++)
   {
-    value->print(value);
-    printf("\n");
+    hotKeysAdd(hot, &keys[i]);
   }
-  else
+
+  // Echo and answer the commands in order. The first one was already echoed.
+  for (int i = 0; i < count; i++)
   {
-    printf("Undefined\n");
+    if (i > 0)
+    {
+      fprintf(out, "\ncmd> %s\n", lines[i]);
+      free(lines[i]);
+    }
+    if (parsed[i] >= 0)
+    {
+      printGetResult(vals[parsed[i]]);
+    }
   }
 
-  key.empty(&key);
+  for (int i = 0; i < nkeys; i++)
+  {
+    keys[i].empty(&keys[i]);
+  }
+  return next;
 }
 
 /**
@@ -194,8 +582,9 @@ static void commGet(Map *m, char *comm)
    key is not found, error messages are presented towards the standard output.
    @param m pointer to the map that the value will be removed from.
    @param comm pointer to the command that is represented as a string.
+   @return true if a pair was removed.
 */
-static void commRemove(Map *m, char *comm)
+static bool commRemove(Map *m, char *comm)
 {
   // Splits the string into a key and a value.
   strtok(comm, " ");
@@ -214,7 +603,7 @@ static void commRemove(Map *m, char *comm)
     // Parse the key with the string format.
     if (!detKeyOrVal(&key, sepKey, true))
     {
-      return;
+      return false;
     }
   }
   else
@@ -222,17 +611,19 @@ static void commRemove(Map *m, char *comm)
     // Parse the key with the integer format.
     if (!detKeyOrVal(&key, sepKey, false))
     {
-      return;
+      return false;
     }
   }
 
   // Remove the key-value pair from the map.
-  if (!mapRemove(m, &key))
+  bool removed = mapRemove(m, &key);
+  if (!removed)
   {
-    printf("ERROR: Pair not\n");
+    fprintf(out, "ERROR: Pair not\n");
   }
 
   key.empty(&key);
+  return removed;
 }
 
 /**
@@ -242,80 +633,1486 @@ static void commRemove(Map *m, char *comm)
 */
 static void commSize(Map *map)
 {
-  printf("%d\n", mapSize(map));
+  fprintf(out, "%d\n", mapSize(map));
 }
 
 /**
-  This function acts as the main function of the entire program. This function acts as the "brain"
-  of the entire program. It is represented as the entry point of the program. The function initializes
-  a map and processes commands that are directly from the standard input. The program uses the other
-  helper functions to process these user commands.
-  @return 0 if the function exits properly without any problems and 1 if there are any errors.
+  This is a helper function that prints a single key/value pair on its own line, with the key
+  first and the value after it. It has the right type to be passed to mapScan.
+  @param key pointer to the key of the pair.
+  @param val pointer to the value of the pair.
+  @param data unused pointer passed along by the map.
 */
-int main()
+static void printPair(Value const *key, Value const *val, void *data)
 {
-  Map *newMap = makeMap(MAP_SIZE);
+  writeValue(key, out);
+  fprintf(out, " ");
+  writeValue(val, out);
+  fprintf(out, "\n");
+}
 
-  // Declare variables to read the line and flag for current command.
-  char *lineRead = NULL;
-  bool firComm = true;
+/**
+  This is a helper function that is responsible for handling the scan command. The command gives
+  the cursor to continue from and, optionally, about how many pairs to print. The pairs are
+  printed one per line, followed by the cursor for the next scan command, which is 0 once every
+  pair has been visited. A missing or bad cursor is treated as a request to start over.
+  @param m pointer to the map that is being scanned.
+  @param comm pointer to the command that is represented as a string.
+*/
+static void commScan(Map *m, char *comm)
+{
+  unsigned int cursor = 0;
+  int count = SCAN_COUNT;
 
-  // Traverse whiole true to process all commands
-  while (true)
+  // Read the cursor and the count, leaving the defaults for any that are missing.
+  sscanf(comm + SCAN_COMM, "%u%d", &cursor, &count);
+  if (count < 1)
   {
-    // Prints line to new line.
-    if (!firComm)
-    {
-      printf("\n");
-    }
+    count = SCAN_COUNT;
+  }
+
+  fprintf(out, "%u\n", mapScan(m, cursor, count, printPair, NULL));
+}
 
-    printf("cmd> ");
+/**
+  This is a helper function that prints just the key of a pair on its own line. It has the
+  right type to be passed to mapKeysWithPrefix.
+  @param key pointer to the key of the pair.
+  @param val pointer to the value of the pair.
+  @param data unused pointer passed along by the map.
+*/
+static void printKey(Value const *key, Value const *val, void *data)
+{
+  writeValue(key, out);
+  fprintf(out, "\n");
+}
 
-    // Reads the line of input from the user.
-    lineRead = readLine(stdin);
+/**
+  This is a helper function that is responsible for handling the keys command. The command gives
+  a quoted pattern, and every string key matching it is printed on its own line. A pattern
+  ending in '*' matches every key starting with the rest of the pattern, and any other pattern
+  only matches a key that's exactly the same.
+  @param m pointer to the map that is being searched.
+  @param comm pointer to the command that is represented as a string.
+*/
+static void commKeys(Map *m, char *comm)
+{
+  // Parse the pattern as a string value.
+  Value pattern = {0};
+  if (!parseString(&pattern, comm + KEYS_COMM))
+  {
+    fprintf(out, "Invalid command\n");
+    return;
+  }
 
-    // Checks if the function of readLine is null.
-    if (lineRead == NULL)
-    {
-      free(lineRead);
-      break;
-    }
+  char *str = pattern.vptr;
+  int len = strlen(str);
 
-    firComm = false;
+  if (len > 0 && str[len - 1] == '*')
+  {
+    // Drop the star and look for everything starting with what's left.
+    str[len - 1] = '\0';
+    mapKeysWithPrefix(m, str, printKey, NULL);
+  }
+  else if (mapGet(m, &pattern))
+  {
+    printKey(&pattern, NULL, NULL);
+  }
 
-    // Command entered back to the user.s
-    printf("%s\n", lineRead);
+  pattern.empty(&pattern);
+}
 
-    // Go through all the commands in the loop.
-    if (strncmp(lineRead, "set", SET_COMM) == 0)
-    {
-      commSet(newMap, lineRead);
-    }
-    else if (strncmp(lineRead, "get", GET_COMM) == 0)
-    {
-      commGet(newMap, lineRead);
-    }
-    else if (strncmp(lineRead, "remove", REM_COMM) == 0)
-    {
-      commRemove(newMap, lineRead);
-    }
-    else if (strncmp(lineRead, "size", SIZE_COMM) == 0)
-    {
-      commSize(newMap);
-    }
-    else if (strncmp(lineRead, "quit", QUIT_COMM) == 0)
-    {
-      break;
-    }
-    else
-    {
-      printf("Invalid command\n");
-    }
-    free(lineRead);
-    lineRead = NULL;
+/**
+  This is a helper function that is responsible for handling the keysof command. The command
+  gives a value, and every key holding that value is printed on its own line. The first keysof
+  on a keyspace turns on its reverse index, so only keyspaces that are asked about pay to keep
+  one up to date, and the ones after that don't have to look at every pair.
+  @param m pointer to the map that is being searched.
+  @param comm pointer to the command that is represented as a string.
+*/
+static void commKeysOf(Map *m, char *comm)
+{
+  // The value is the rest of the line, the same way it's given to set, so strings can have
+  // spaces in them.
+  strtok(comm, " ");
+  char *sepVal = strtok(NULL, "");
+  Value val;
+  if (sepVal == NULL || !detKeyOrVal(&val, sepVal, false))
+  {
+    fprintf(out, "Invalid command\n");
+    return;
   }
-  free(lineRead);
 
-  freeMap(newMap);
-  return 0;
+  mapIndexValues(m);
+  mapKeysOf(m, &val, printKey, NULL);
+
+  val.empty(&val);
+}
+
+/**
+  This is a helper function that writes a pair to a save file as a set command, so the file
+  can be fed back into the driver to load the pairs again.
+  @param key pointer to the key of the pair.
+  @param val pointer to the value of the pair.
+  @param data the file being written.
+*/
+static void writePair(Value const *key, Value const *val, void *data)
+{
+  FILE *fp = data;
+  fprintf(fp, "set ");
+  writeValue(key, fp);
+  fprintf(fp, " ");
+  writeValue(val, fp);
+  fprintf(fp, "\n");
+}
+
+/**
+  This is a helper function that writes the next part of a running save. The pairs are
+  collected into one chunk that's written in the background, so the command loop doesn't wait
+  on the file. Once the whole snapshot has been written, the file is flushed to disk and closed,
+  also in the background, and the snapshot is released.
+  @param job pointer to the save, which may not be running.
+  @param count number of snapshot buckets to write.
+*/
+static void stepSave(SaveJob *job, int count)
+{
+  if (!job->snap)
+  {
+    return;
+  }
+
+  char *chunk = NULL;
+  size_t len = 0;
+  FILE *fp = open_memstream(&chunk, &len);
+  bool done = snapshotStep(job->snap, count, writePair, fp);
+  fclose(fp);
+  if (len > 0)
+  {
+    asyncWrite(job->io, job->fd, chunk, len, job->end);
+    job->end += len;
+  }
+  else
+  {
+    free(chunk);
+  }
+
+  if (done)
+  {
+    releaseSnapshot(job->snap);
+    asyncSync(job->io, job->fd);
+    asyncClose(job->io, job->fd);
+    job->snap = NULL;
+    job->fd = -1;
+  }
+}
+
+/**
+  This is a helper function that is responsible for handling the save command. It takes a
+  snapshot of the map and starts writing it to the quoted file name. The writing is done a
+  little at a time after each of the following commands, so those commands keep running while
+  the save is going, and they don't change what ends up in the file.
+  @param m pointer to the map that is being saved. Its snapshot may be taken by the replication
+  snapshot that's being sent, in which case the save has to wait until that's done.
+  @param job pointer to the save, which must not already be running.
+  @param comm pointer to the command that is represented as a string.
+*/
+static void commSave(Map *m, SaveJob *job, char *comm)
+{
+  // Parse the file name as a string value.
+  Value path = {0};
+  if (!parseString(&path, comm + SAVE_COMM))
+  {
+    fprintf(out, "Invalid command\n");
+    return;
+  }
+
+  if (job->snap)
+  {
+    fprintf(out, "ERROR: Save in progress\n");
+  }
+  else if (mapHasSnapshot(m))
+  {
+    fprintf(out, "ERROR: Snapshot in progress\n");
+  }
+  else if ((job->snap = mapSnapshot(m)) == NULL)
+  {
+    // Maps kept in a file are already saved. The file isn't touched until the save can run.
+    fprintf(out, "ERROR: Can't save this keyspace\n");
+  }
+  else if ((job->fd = open(path.vptr, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+  {
+    fprintf(out, "ERROR: Can't open file\n");
+    releaseSnapshot(job->snap);
+    job->snap = NULL;
+  }
+  else
+  {
+    job->end = 0;
+  }
+
+  path.empty(&path);
+}
+
+/**
+  This is a helper function that adds text to the end of the command log and then flushes the
+  log to disk, both in the background, so the command loop never waits on the disk. The text
+  is written with a single request, so it goes to the file all together. The sync command waits
+  for everything to be on disk.
+  @param log pointer to the command log, which may not be open.
+  @param text the text to add to the log, from malloc. The log frees it.
+  @param len length of the text.
+*/
+static void writeLog(CommandLog *log, char *text, size_t len)
+{
+  if (log->fd < 0)
+  {
+    free(text);
+    return;
+  }
+
+  asyncWrite(log->io, log->fd, text, len, log->end);
+  asyncSync(log->io, log->fd);
+  log->end += len;
+}
+
+/**
+  This is a helper function that adds a single command to the command log, if there is one.
+  @param log pointer to the command log, which may not be open.
+  @param comm the command to add, without its newline.
+*/
+static void logComm(CommandLog *log, char const *comm)
+{
+  // Put the newline on a copy, so the command goes in one write like a transaction.
+  size_t len = strlen(comm);
+  char *line = malloc(len + 1);
+  memcpy(line, comm, len);
+  line[len] = '\n';
+  writeLog(log, line, len + 1);
+}
+
+/**
+  This is a helper function that is responsible for handling the log command. It opens the
+  quoted file name for appending, and from then on every command that changes a map is added
+  to it. The log starts by selecting the current keyspace, so feeding the file back into the
+  driver rebuilds the maps.
+  @param log pointer to the command log, which is replaced if it's already open.
+  @param comm pointer to the command that is represented as a string.
+  @param current keyspace that's selected when the log is opened.
+*/
+static void commLog(CommandLog *log, char *comm, int current)
+{
+  // Parse the file name as a string value.
+  Value path = {0};
+  if (!parseString(&path, comm + LOG_COMM))
+  {
+    fprintf(out, "Invalid command\n");
+    return;
+  }
+
+  // New commands go after whatever the file already has.
+  int fd = open(path.vptr, O_WRONLY | O_CREAT, 0666);
+  off_t end = fd < 0 ? -1 : lseek(fd, 0, SEEK_END);
+  if (end < 0)
+  {
+    fprintf(out, "ERROR: Can't open file\n");
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+  }
+  else
+  {
+    // The old log is closed once what's already been written to it is done.
+    if (log->fd >= 0)
+    {
+      asyncClose(log->io, log->fd);
+    }
+    log->fd = fd;
+    log->end = end;
+
+    char select[SELECT_LINE];
+    snprintf(select, sizeof(select), "select %d", current);
+    logComm(log, select);
+  }
+
+  path.empty(&path);
+}
+
+/**
+  This is a helper function that prints one of the hot keys and about how many times it was
+  used.
+  @param key pointer to the key.
+  @param count estimated number of gets and sets of the key.
+  @param data unused.
+*/
+static void printHotKey(Value const *key, unsigned long count, void *data)
+{
+  writeValue(key, out);
+  fprintf(out, " %lu\n", count);
+}
+
+/**
+  This is a helper function that is responsible for handling the hotkeys command. It prints
+  the keys that gets and sets have used the most, the most used first, with an estimate of how
+  many times each was used. The estimates come from a sample of the commands, so they're
+  only close for keys that are used a lot.
+  @param hot tracker the keys were counted in.
+*/
+static void commHotKeys(HotKeys *hot)
+{
+  hotKeysVisit(hot, printHotKey, NULL);
+}
+
+/**
+  This is a helper function that is responsible for handling the sync command. It's the one
+  command that waits on the disk: it returns once everything written to the log and to any
+  save so far is on disk.
+  @param io where the writes go.
+*/
+static void commSync(AsyncIO *io)
+{
+  if (asyncWait(io) > 0)
+  {
+    fprintf(out, "ERROR: Write failed\n");
+  }
+}
+
+/**
+  This is a helper function that cleans up after the writes that finished while the last
+  command ran, without waiting for any others, and reports any that failed.
+  @param io where the writes go.
+*/
+static void reapWrites(AsyncIO *io)
+{
+  int failed = asyncReap(io);
+  if (failed > 0)
+  {
+    fprintf(stderr, "%d writes to disk failed\n", failed);
+  }
+}
+
+/**
+  This is a helper function that is responsible for handling the multi command. Until exec or
+  discard, set and remove commands are parsed and queued up instead of being run. Any other
+  command is turned away with an error and left out of the transaction, which goes on as if it
+  hadn't been given; a set or remove that can't be parsed makes the whole transaction fail.
+  @param tx pointer to the transaction, which must not already be open.
+*/
+static void commMulti(Transaction *tx)
+{
+  tx->open = true;
+  tx->failed = false;
+  tx->count = 0;
+  tx->text = open_memstream(&tx->buf, &tx->len);
+  fprintf(tx->text, "multi\n");
+}
+
+/**
+  This is a helper function that queues up a command while a transaction is open. Set and
+  remove commands are parsed right away, so exec doesn't have to, and one that can't be parsed
+  makes the whole transaction fail. Any other command is only reported.
+  @param tx pointer to the open transaction.
+  @param comm pointer to the command that is represented as a string.
+*/
+static void queueComm(Transaction *tx, char *comm)
+{
+  bool isSet = strncmp(comm, "set", SET_COMM) == 0;
+  if (!isSet && strncmp(comm, "remove", REM_COMM) != 0)
+  {
+    fprintf(out, "ERROR: Only set and remove in a transaction\n");
+    return;
+  }
+
+  if (tx->count >= tx->cap)
+  {
+    tx->cap = tx->cap ? tx->cap * 2 : GET_BATCH;
+    tx->comms = realloc(tx->comms, tx->cap * sizeof(QueuedComm));
+  }
+
+  // Keep the text for the log before the command gets split up.
+  fprintf(tx->text, "%s\n", comm);
+
+  QueuedComm *qc = &tx->comms[tx->count];
+  memset(qc, 0, sizeof(QueuedComm));
+  qc->isSet = isSet;
+  bool ok = isSet ? parseSet(&qc->key, &qc->val, comm) : parseGetKey(&qc->key, comm);
+
+  if (ok)
+  {
+    tx->count++;
+  }
+  else
+  {
+    fprintf(out, "Invalid command\n");
+    tx->failed = true;
+  }
+}
+
+/**
+  This is a helper function that goes through the queued commands in order and checks that every
+  remove is for a key that will be in the map when its turn comes, counting the sets and removes
+  queued ahead of it. The keys are tracked in a small hash table of command indexes, so this
+  takes one pass.
+  @param m pointer to the map the commands will be applied to.
+  @param tx pointer to the transaction.
+  @return true if all the commands can be applied.
+*/
+static bool checkQueued(Map *m, Transaction *tx)
+{
+  int tlen = 1;
+  while (tlen < tx->count * 2)
+  {
+    tlen *= 2;
+  }
+  int *slots = malloc(tlen * sizeof(int));
+  memset(slots, -1, tlen * sizeof(int));
+
+  bool ok = true;
+  for (int i = 0; ok && i < tx->count; i++)
+  {
+    // Find the last command queued for the same key, if there was one.
+    Value *key = &tx->comms[i].key;
+    unsigned int h = key->hash(key) & (tlen - 1);
+    while (slots[h] >= 0 && !key->equals(key, &tx->comms[slots[h]].key))
+    {
+      h = (h + 1) & (tlen - 1);
+    }
+
+    int prior = slots[h];
+    bool present = prior >= 0 ? tx->comms[prior].isSet : mapGet(m, key) != NULL;
+    ok = tx->comms[i].isSet || present;
+    slots[h] = i;
+  }
+
+  free(slots);
+  return ok;
+}
+
+/**
+  This is a helper function that closes the transaction and frees everything that was queued.
+  @param tx pointer to the open transaction.
+*/
+static void endTransaction(Transaction *tx)
+{
+  for (int i = 0; i < tx->count; i++)
+  {
+    tx->comms[i].key.empty(&tx->comms[i].key);
+    if (tx->comms[i].isSet)
+    {
+      tx->comms[i].val.empty(&tx->comms[i].val);
+    }
+  }
+
+  fclose(tx->text);
+  free(tx->buf);
+  tx->buf = NULL;
+  tx->count = 0;
+  tx->open = false;
+}
+
+/**
+  This is a helper function that is responsible for handling the exec command. If every queued
+  command was parsed and every remove will find its key, all of them are written to the log with
+  one write, room is reserved in the map once, and the commands are applied in order. Otherwise
+  none of them are applied.
+  @param m pointer to the map the commands are applied to.
+  @param tx pointer to the open transaction.
+  @param log pointer to the command log, which may not be open.
+*/
+static void commExec(Map *m, Transaction *tx, CommandLog *log)
+{
+  if (tx->failed || !checkQueued(m, tx))
+  {
+    fprintf(out, "ERROR: Transaction aborted\n");
+    endTransaction(tx);
+    return;
+  }
+
+  // The log gets the whole transaction at once.
+  fprintf(tx->text, "exec\n");
+  fflush(tx->text);
+  char *text = malloc(tx->len);
+  memcpy(text, tx->buf, tx->len);
+  writeLog(log, text, tx->len);
+
+  int sets = 0;
+  for (int i = 0; i < tx->count; i++)
+  {
+    sets += tx->comms[i].isSet;
+  }
+  mapReserve(m, mapSize(m) + sets);
+
+  // The map takes the keys and values of the sets, the removes' keys are still ours.
+  for (int i = 0; i < tx->count; i++)
+  {
+    QueuedComm *qc = &tx->comms[i];
+    if (qc->isSet)
+    {
+      mapSet(m, &qc->key, &qc->val);
+    }
+    else
+    {
+      mapRemove(m, &qc->key);
+      qc->key.empty(&qc->key);
+    }
+  }
+
+  tx->count = 0;
+  endTransaction(tx);
+}
+
+/** The snapshot of every keyspace that a new replication feed starts with, sent a little at a time. */
+typedef struct
+{
+  /** Snapshot of each keyspace that still has to be sent, or NULL. */
+  MapSnapshot *snaps[KEYSPACES];
+
+  /** Keyspace being sent. */
+  int next;
+
+  /** True while the snapshot is being sent. */
+  bool running;
+} Bootstrap;
+
+/** Where the pairs of a snapshot are being sent. */
+typedef struct
+{
+  /** Feed the pairs go to. */
+  ReplFeed *feed;
+
+  /** Keyspace the pairs are from. */
+  int space;
+} FeedTarget;
+
+/**
+  This is a helper function that sends a change made to a keyspace's map to the follower. It has
+  the right type to be a map's observer.
+  @param key pointer to the key that was set or removed.
+  @param val pointer to the value it was set to, or NULL if it was removed.
+  @param data pointer to the KeyspaceRef of the keyspace the map belongs to.
+*/
+static void replicateChange(Value const *key, Value const *val, void *data)
+{
+  KeyspaceRef *ref = data;
+  feedRecord(ref->ks->feed, val ? REPL_SET : REPL_REMOVE, ref->space, key, val);
+}
+
+/**
+  This is a helper function that starts sending the changes made to a keyspace's map to the
+  follower. Changes are tagged with the keyspace the map belongs to, which isn't always the
+  selected one.
+  @param ks pointer to the keyspaces.
+  @param index keyspace whose map is observed.
+*/
+static void observeKeyspace(Keyspaces *ks, int index)
+{
+  ks->refs[index].ks = ks;
+  ks->refs[index].space = index;
+  mapObserve(ks->maps[index], replicateChange, &ks->refs[index]);
+}
+
+/**
+  This is a helper function that sends one pair of a snapshot to the follower.
+  @param key pointer to the key of the pair.
+  @param val pointer to the value of the pair.
+  @param data pointer to the FeedTarget.
+*/
+static void sendPair(Value const *key, Value const *val, void *data)
+{
+  FeedTarget *target = data;
+  feedSnapshotPair(target->feed, target->space, key, val);
+}
+
+/**
+  This is a helper function that makes the map for a keyspace, with all the options the driver
+  uses turned on.
+  @param size length of the new map's hash table.
+  @return pointer to the new map.
+*/
+static Map *makeKeyspace(int size)
+{
+  Map *m = makeMap(size);
+  mapUseFilter(m);
+  mapIndexKeys(m);
+  mapInternStrings(m);
+  mapCompressValues(m, COMPRESS_AT);
+  return m;
+}
+
+/**
+  This is a helper function that makes a new, empty map for a keyspace, and passes its changes
+  along to the follower if the maps are being replicated.
+  @param ks pointer to the keyspaces.
+  @param index keyspace that gets the new map.
+*/
+static void newKeyspace(Keyspaces *ks, int index)
+{
+  ks->maps[index] = makeKeyspace(ks->sizes[index]);
+  if (ks->feed)
+  {
+    observeKeyspace(ks, index);
+  }
+}
+
+/**
+  This is a helper function that is responsible for handling the select command. The command
+  gives the number of the keyspace that later commands go to, and optionally the hash table
+  size to make it with. The map for a keyspace is made the first time it's selected; selecting
+  one that already exists with a size reserves room for that many pairs instead.
+  @param ks pointer to the keyspaces.
+  @param comm pointer to the command that is represented as a string.
+  @return true if the keyspace was selected.
+*/
+static bool commSelect(Keyspaces *ks, char *comm)
+{
+  int index, size = 0;
+  if (sscanf(comm + SELECT_COMM, "%d%d", &index, &size) < 1 || index < 0 ||
+      index >= KEYSPACES || size < 0)
+  {
+    fprintf(out, "Invalid command\n");
+    return false;
+  }
+
+  if (!ks->maps[index])
+  {
+    ks->sizes[index] = size > 0 ? size : MAP_SIZE;
+    newKeyspace(ks, index);
+  }
+  else if (size > 0)
+  {
+    mapReserve(ks->maps[index], size);
+  }
+  ks->current = index;
+  return true;
+}
+
+/**
+  This is a helper function that is responsible for handling the flush command. The selected
+  keyspace gets a new, empty map right away, and the old one is queued up to be freed a little
+  at a time after each of the following commands, so flushing a big keyspace doesn't hold up
+  the commands after it.
+  @param ks pointer to the keyspaces.
+  @return true if the keyspace was emptied.
+*/
+static bool commFlush(Keyspaces *ks)
+{
+  if (ks->inFile[ks->current])
+  {
+    fprintf(out, "ERROR: Can't flush a file keyspace\n");
+    return false;
+  }
+
+  if (ks->dcount >= ks->dcap)
+  {
+    ks->dcap = ks->dcap ? ks->dcap * 2 : KEYSPACES;
+    ks->doomed = realloc(ks->doomed, ks->dcap * sizeof(Map *));
+  }
+  ks->doomed[ks->dcount++] = ks->maps[ks->current];
+  mapObserve(ks->maps[ks->current], NULL, NULL);
+
+  // Freeing the map gives up on compacting it.
+  if (ks->compacting == ks->maps[ks->current])
+  {
+    ks->compacting = NULL;
+  }
+  newKeyspace(ks, ks->current);
+
+  if (ks->feed)
+  {
+    feedRecord(ks->feed, REPL_CLEAR, ks->current, NULL, NULL);
+  }
+  return true;
+}
+
+/**
+  This is a helper function that frees the next part of the oldest flushed map, if there is one.
+  @param ks pointer to the keyspaces.
+  @param count about how many pairs to free.
+*/
+static void stepFlush(Keyspaces *ks, int count)
+{
+  if (ks->dcount > 0 && freeMapStep(ks->doomed[0], count))
+  {
+    ks->dcount--;
+    memmove(ks->doomed, ks->doomed + 1, ks->dcount * sizeof(Map *));
+  }
+}
+
+/**
+  This is a helper function that is responsible for handling the compact command. It starts
+  compacting the selected keyspace, which goes on a little at a time after each command, so the
+  memory left behind by removed pairs is given back without holding up the commands.
+  @param ks pointer to the keyspaces.
+*/
+static void commCompact(Keyspaces *ks)
+{
+  if (ks->compacting)
+  {
+    fprintf(out, "ERROR: Compaction in progress\n");
+    return;
+  }
+  ks->compacting = ks->maps[ks->current];
+}
+
+/**
+  This is a helper function that compacts a little more of the keyspace being compacted, if
+  there is one.
+  @param ks pointer to the keyspaces.
+  @param count about how many pairs to look at.
+*/
+static void stepCompact(Keyspaces *ks, int count)
+{
+  if (ks->compacting && mapCompact(ks->compacting, count))
+  {
+    ks->compacting = NULL;
+  }
+}
+
+/**
+  This is a helper function that is responsible for handling the replicate command. It opens the
+  quoted FIFO or file as a feed for a follower, and from then on every change made to any keyspace
+  is sent to it. The feed starts with a snapshot of all the keyspaces, sent a little at a time
+  after each of the following commands; changes made in the meantime are held back until the
+  snapshot has been sent, so the follower applies everything in the right order.
+  @param ks pointer to the keyspaces.
+  @param boot pointer to the snapshot that starts the feed.
+  @param save pointer to the save, which can't be running at the same time.
+  @param comm pointer to the command that is represented as a string.
+*/
+static void commReplicate(Keyspaces *ks, Bootstrap *boot, SaveJob *save, char *comm)
+{
+  // Parse the feed name as a string value.
+  Value path = {0};
+  if (!parseString(&path, comm + REPLICATE_COMM))
+  {
+    fprintf(out, "Invalid command\n");
+    return;
+  }
+
+  if (ks->feed)
+  {
+    fprintf(out, "ERROR: Already replicating\n");
+  }
+  else if (save->snap)
+  {
+    fprintf(out, "ERROR: Save in progress\n");
+  }
+  else if ((ks->feed = openFeed(path.vptr)) == NULL)
+  {
+    fprintf(out, "ERROR: Can't open feed\n");
+  }
+  else
+  {
+    // A follower that goes away shouldn't take the leader with it.
+    signal(SIGPIPE, SIG_IGN);
+
+    feedBeginBootstrap(ks->feed);
+    for (int i = 0; i < KEYSPACES; i++)
+    {
+      if (!ks->maps[i])
+      {
+        continue;
+      }
+      observeKeyspace(ks, i);
+
+      // A map kept in a file can't have a snapshot, so it's sent all at once.
+      if ((boot->snaps[i] = mapSnapshot(ks->maps[i])) == NULL)
+      {
+        FeedTarget target = {ks->feed, i};
+        mapForEach(ks->maps[i], sendPair, &target);
+      }
+    }
+    boot->next = 0;
+    boot->running = true;
+  }
+
+  path.empty(&path);
+}
+
+/**
+  This is a helper function that sends the next part of the snapshot that starts a replication
+  feed. Once every keyspace has been sent, the changes that were held back go out after it.
+  @param ks pointer to the keyspaces.
+  @param boot pointer to the snapshot, which may not be running.
+  @param count number of snapshot buckets to send.
+*/
+static void stepBootstrap(Keyspaces *ks, Bootstrap *boot, int count)
+{
+  if (!boot->running)
+  {
+    return;
+  }
+
+  while (boot->next < KEYSPACES && !boot->snaps[boot->next])
+  {
+    boot->next++;
+  }
+
+  if (boot->next == KEYSPACES)
+  {
+    feedEndBootstrap(ks->feed);
+    boot->running = false;
+    return;
+  }
+
+  FeedTarget target = {ks->feed, boot->next};
+  if (snapshotStep(boot->snaps[boot->next], count, sendPair, &target))
+  {
+    releaseSnapshot(boot->snaps[boot->next]);
+    boot->snaps[boot->next] = NULL;
+  }
+}
+
+/**
+  This is a helper function that stops sending changes to the follower.
+  @param ks pointer to the keyspaces.
+  @param boot pointer to the snapshot that starts the feed, which is given up on if it's
+  still running.
+*/
+static void stopReplication(Keyspaces *ks, Bootstrap *boot)
+{
+  for (int i = 0; i < KEYSPACES; i++)
+  {
+    if (boot->snaps[i])
+    {
+      releaseSnapshot(boot->snaps[i]);
+      boot->snaps[i] = NULL;
+    }
+    if (ks->maps[i])
+    {
+      mapObserve(ks->maps[i], NULL, NULL);
+    }
+  }
+  boot->running = false;
+
+  closeFeed(ks->feed);
+  ks->feed = NULL;
+}
+
+/**
+  This is a helper function that applies a record from the leader to a follower's keyspaces. It
+  has the right type to be passed to readerPoll.
+  @param op type of the record.
+  @param space keyspace the record is for.
+  @param key key of the record, which this function takes, or NULL.
+  @param val value of the record, which this function takes, or NULL.
+  @param data pointer to the keyspaces.
+*/
+static void applyRecord(char op, int space, Value *key, Value *val, void *data)
+{
+  Keyspaces *ks = data;
+  if (space >= 0 && space < KEYSPACES && !ks->maps[space])
+  {
+    ks->sizes[space] = MAP_SIZE;
+    newKeyspace(ks, space);
+  }
+
+  if (space < 0 || space >= KEYSPACES)
+  {
+    // Nothing to apply it to.
+  }
+  else if (op == REPL_SET && key && val)
+  {
+    mapSet(ks->maps[space], key, val);
+    return;
+  }
+  else if (op == REPL_REMOVE && key)
+  {
+    mapRemove(ks->maps[space], key);
+  }
+  else if (op == REPL_CLEAR)
+  {
+    int current = ks->current;
+    ks->current = space;
+    commFlush(ks);
+    ks->current = current;
+  }
+
+  if (key)
+  {
+    key->empty(key);
+  }
+  if (val)
+  {
+    val->empty(val);
+  }
+}
+
+/**
+  This is a helper function that keeps a follower caught up with the leader while it waits for the
+  next command, applying records whenever the feed has some. Once the feed has no more, it's only
+  checked again every so often, since waiting on it would return right away.
+  @param reader the feed from the leader.
+  @param ks pointer to the keyspaces the records are applied to.
+*/
+static void followUntilInput(ReplReader *reader, Keyspaces *ks)
+{
+  readerPoll(reader, applyRecord, ks);
+  while (!lineReady(in))
+  {
+    struct pollfd fds[2] = {{lineReaderFd(in), POLLIN, 0}, {readerFd(reader), POLLIN, 0}};
+    bool ended = readerAtEnd(reader);
+    poll(fds, ended ? 1 : 2, ended ? FOLLOW_WAIT : -1);
+    readerPoll(reader, applyRecord, ks);
+  }
+}
+
+/**
+  This is a helper function that tells whether a command would change the maps, which a follower
+  can't do, since its maps only change to match the leader.
+  @param comm the command represented as a string.
+  @return true if the command changes the maps.
+*/
+static bool changesMaps(char const *comm)
+{
+  return strncmp(comm, "set", SET_COMM) == 0 || strncmp(comm, "remove", REM_COMM) == 0 ||
+         strncmp(comm, "flush", FLUSH_COMM) == 0 || strncmp(comm, "multi", MULTI_COMM) == 0 ||
+         strncmp(comm, "log", LOG_COMM) == 0 || strncmp(comm, "replicate", REPLICATE_COMM) == 0;
+}
+
+/**
+  This is a helper function that reads the monotonic clock.
+  @return the clock reading in nanoseconds.
+*/
+static uint64_t clockNanos(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+  This is a helper function that starts recording or replaying a trace, if the command line asked
+  for one. Output goes to a capture stream from then on.
+  @param rec pointer to the recorder to set up.
+  @param argc number of command line arguments.
+  @param argv the command line arguments.
+  @return false if the command line asked for a trace that couldn't be opened.
+*/
+static bool startRecorder(Recorder *rec, int argc, char *argv[])
+{
+  if (argc >= 3 && strcmp(argv[1], TRACE_FLAG) == 0)
+  {
+    if ((rec->writer = openTrace(argv[2])) == NULL)
+    {
+      fprintf(stderr, "Can't create trace: %s\n", argv[2]);
+      return false;
+    }
+  }
+  else if (argc >= 3 && strcmp(argv[1], REPLAY_FLAG) == 0)
+  {
+    rec->speed = 1;
+    if (argc == 4)
+    {
+      rec->speed = strcmp(argv[3], REPLAY_MAX) == 0 ? 0 : strtod(argv[3], NULL);
+      if (strcmp(argv[3], REPLAY_MAX) != 0 && rec->speed <= 0)
+      {
+        fprintf(stderr, "Invalid replay speed: %s\n", argv[3]);
+        return false;
+      }
+    }
+    if ((rec->reader = openTraceReader(argv[2])) == NULL)
+    {
+      fprintf(stderr, "Can't open trace: %s\n", argv[2]);
+      return false;
+    }
+  }
+  else
+  {
+    return true;
+  }
+
+  out = rec->capture = open_memstream(&rec->text, &rec->len);
+  rec->start = clockNanos();
+  return true;
+}
+
+/**
+  This is a helper function that gets the next command. In a replay it comes from the trace, once
+  it's due: at the time it was recorded, scaled by the replay speed, or right away at full speed.
+  Otherwise it's read from standard input, unless it was already read ahead.
+  @param rec pointer to the recorder.
+  @param pending a command that was already read ahead, or NULL.
+  @return the command, which the caller has to free, or NULL if there are no more.
+*/
+static char *nextCommand(Recorder *rec, char *pending)
+{
+  if (!rec->reader)
+  {
+    char *line = pending ? pending : nextLine(in);
+    rec->arrived = clockNanos();
+    if (rec->writer && line)
+    {
+      rec->comm = realloc(rec->comm, strlen(line) + 1);
+      strcpy(rec->comm, line);
+    }
+    return line;
+  }
+
+  if (!traceNext(rec->reader, &rec->entry))
+  {
+    return NULL;
+  }
+
+  if (rec->speed > 0)
+  {
+    // Wait for the command to come due.
+    rec->arrived = rec->start + (uint64_t)(rec->entry.when / rec->speed);
+    for (uint64_t now = clockNanos(); now < rec->arrived; now = clockNanos())
+    {
+      uint64_t left = rec->arrived - now;
+      if (left > REPLAY_SPIN)
+      {
+        struct timespec wait = {(left - REPLAY_SPIN) / 1000000000, (left - REPLAY_SPIN) % 1000000000};
+        nanosleep(&wait, NULL);
+      }
+    }
+  }
+  else
+  {
+    rec->arrived = clockNanos();
+  }
+
+  char *comm = malloc(strlen(rec->entry.comm) + 1);
+  strcpy(comm, rec->entry.comm);
+  return comm;
+}
+
+/**
+  This is a helper function that finishes with a command's output. When recording, the output
+  is passed on to standard output and recorded with the command. When replaying, the time the
+  command took is kept, and its output is checked against the recorded output. Either way, the
+  capture stream starts over for the next command.
+  @param rec pointer to the recorder.
+*/
+static void endCommand(Recorder *rec)
+{
+  if (!rec->capture)
+  {
+    return;
+  }
+  fflush(rec->capture);
+  size_t len = ftello(rec->capture);
+  fseeko(rec->capture, 0, SEEK_SET);
+
+  if (rec->writer)
+  {
+    fwrite(rec->text, 1, len, stdout);
+    traceCommand(rec->writer, rec->arrived - rec->start, rec->comm, rec->text, len);
+    return;
+  }
+
+  if (rec->count >= rec->cap)
+  {
+    rec->cap = rec->cap ? rec->cap * 2 : FLUSH_STEP;
+    rec->latencies = realloc(rec->latencies, rec->cap * sizeof(uint64_t));
+  }
+  rec->latencies[rec->count++] = clockNanos() - rec->arrived;
+
+  if (len != rec->entry.outLen || memcmp(rec->text, rec->entry.out, len) != 0)
+  {
+    if (rec->mismatches++ < REPLAY_REPORTS)
+    {
+      fprintf(stderr, "Output of command %d (%s) doesn't match the trace\n", rec->count,
+              rec->entry.comm);
+    }
+  }
+}
+
+/**
+  This is a helper function that compares two latencies, for sorting them with qsort.
+  @param a pointer to the first latency.
+  @param b pointer to the second latency.
+  @return negative, zero or positive as the first is less than, equal to or greater than the second.
+*/
+static int compareLatency(void const *a, void const *b)
+{
+  uint64_t x = *(uint64_t const *)a;
+  uint64_t y = *(uint64_t const *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+  This is a helper function that gives a percentile of the sorted latencies, in microseconds.
+  @param rec pointer to the recorder, with its latencies sorted.
+  @param pct the percentile.
+  @return the latency below which pct percent of the commands finished.
+*/
+static double percentile(Recorder const *rec, double pct)
+{
+  int idx = (int)(pct / 100 * (rec->count - 1) + 0.5);
+  return rec->latencies[idx] / 1000.0;
+}
+
+/**
+  This is a helper function that stops recording or replaying. After a recording, the prompt
+  left in the capture stream goes to standard output. After a replay, the throughput and the
+  latency percentiles are reported, along with how many outputs didn't match.
+  @param rec pointer to the recorder.
+  @return false if a replay found outputs that didn't match.
+*/
+static bool finishRecorder(Recorder *rec)
+{
+  if (!rec->capture)
+  {
+    return true;
+  }
+  fflush(rec->capture);
+  size_t len = ftello(rec->capture);
+  double secs = (clockNanos() - rec->start) / 1e9;
+
+  if (rec->writer)
+  {
+    fwrite(rec->text, 1, len, stdout);
+    closeTrace(rec->writer);
+  }
+  else
+  {
+    printf("Replayed %d commands in %.3f s (%.0f commands/s)\n", rec->count, secs,
+           rec->count / secs);
+    if (rec->count > 0)
+    {
+      qsort(rec->latencies, rec->count, sizeof(uint64_t), compareLatency);
+      printf("Latency (us): p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+             percentile(rec, 50), percentile(rec, 90), percentile(rec, 99),
+             percentile(rec, 99.9), percentile(rec, 100));
+    }
+    printf("Mismatched outputs: %d\n", rec->mismatches);
+    closeTraceReader(rec->reader);
+  }
+
+  fclose(rec->capture);
+  free(rec->text);
+  free(rec->comm);
+  free(rec->latencies);
+  out = stdout;
+  return rec->mismatches == 0;
+}
+
+/**
+  This function acts as the main function of the entire program. This function acts as the "brain"
+  of the entire program. It is represented as the entry point of the program. The function initializes
+  a map and processes commands that are directly from the standard input. The program uses the other
+  helper functions to process these user commands. If a file name is given on the command line,
+  keyspace 0 is kept in that file, so its contents are still there the next time the driver
+  is run with it. With --trace, every command is recorded into a trace file along with when it
+  arrived and what it printed. With --replay, the commands come from a trace instead, at the
+  speed they were recorded, a multiple of it, or as fast as possible, and their outputs are
+  checked against the trace.
+  @param argc number of command line arguments.
+  @param argv the command line arguments.
+  @return 0 if the function exits properly without any problems and 1 if there are any errors,
+  including outputs that didn't match during a replay.
+*/
+int main(int argc, char *argv[])
+{
+  out = stdout;
+  in = makeLineReader(STDIN_FILENO);
+  Recorder rec = {0};
+  bool tracing = argc >= 3 && (strcmp(argv[1], TRACE_FLAG) == 0 ||
+                               (strcmp(argv[1], REPLAY_FLAG) == 0 && argc <= 4));
+
+  // A follower gets all its changes from the leader's feed.
+  ReplReader *reader = NULL;
+  if (tracing)
+  {
+    if (!startRecorder(&rec, argc, argv))
+    {
+      return 1;
+    }
+  }
+  else if (argc == 3 && strcmp(argv[1], FOLLOW_FLAG) == 0)
+  {
+    if ((reader = openReader(argv[2])) == NULL)
+    {
+      fprintf(stderr, "Can't open feed: %s\n", argv[2]);
+      return 1;
+    }
+  }
+  else if (argc > 2)
+  {
+    fprintf(stderr, "usage: driver [map-file | --follow feed | --trace trace | "
+                    "--replay trace [speed | max]]\n");
+    return 1;
+  }
+
+  // Commands go to keyspace 0 until another one is selected.
+  Keyspaces spaces = {{NULL}};
+  spaces.sizes[0] = MAP_SIZE;
+  if (argc == 2)
+  {
+    spaces.inFile[0] = true;
+    if ((spaces.maps[0] = openMap(argv[1])) == NULL)
+    {
+      fprintf(stderr, "Can't open map file: %s\n", argv[1]);
+      return 1;
+    }
+  }
+  else
+  {
+    spaces.maps[0] = makeKeyspace(MAP_SIZE);
+  }
+
+  // Declare variables to read the line and flag for current command.
+  char *lineRead = NULL;
+  char *pending = NULL;
+  bool firComm = true;
+
+  // Gets are only read ahead when the commands aren't being typed in, and each command in a
+  // trace needs its own time and output.
+  bool batchGets = !isatty(lineReaderFd(in)) && !tracing;
+  AsyncIO *io = makeAsync(AIO_DEPTH, true);
+  HotKeys *hot = makeHotKeys(HOT_KEYS, HOT_SAMPLE);
+  SaveJob save = {NULL, -1, 0, io};
+  Transaction tx = {0};
+  CommandLog log = {-1, 0, io};
+  Bootstrap boot = {{NULL}};
+
+  // Traverse whiole true to process all commands
+  while (true)
+  {
+    // Prints line to new line.
+    if (!firComm)
+    {
+      fprintf(out, "\n");
+    }
+
+    fprintf(out, "cmd> ");
+
+    // Reads the line of input from the user, unless it was already read ahead. If that means
+    // waiting, the client may be waiting on the output so far, so send it first.
+    if (!pending && !lineReady(in))
+    {
+      fflush(out);
+    }
+
+    // A follower applies what the leader sends while it waits.
+    if (reader && !pending)
+    {
+      followUntilInput(reader, &spaces);
+    }
+    lineRead = nextCommand(&rec, pending);
+    pending = NULL;
+
+    // Checks if the function of readLine is null.
+    if (lineRead == NULL)
+    {
+      free(lineRead);
+      break;
+    }
+
+    firComm = false;
+
+    // Command entered back to the user.s
+    fprintf(out, "%s\n", lineRead);
+
+    // Catch up with the leader before running the command.
+    if (reader)
+    {
+      readerPoll(reader, applyRecord, &spaces);
+    }
+    Map *newMap = spaces.maps[spaces.current];
+
+    // Commands that change the map go in the log once they've worked. Running a command
+    // splits up its line, so the log gets a copy.
+    char *logLine = NULL;
+    bool applied = false;
+    if (log.fd >= 0 && !tx.open && !reader &&
+        (strncmp(lineRead, "set", SET_COMM) == 0 || strncmp(lineRead, "remove", REM_COMM) == 0 ||
+         strncmp(lineRead, "select", SELECT_COMM) == 0 ||
+         strncmp(lineRead, "flush", FLUSH_COMM) == 0))
+    {
+      logLine = malloc(strlen(lineRead) + 1);
+      strcpy(logLine, lineRead);
+    }
+
+    // Go through all the commands in the loop.
+    if (reader && changesMaps(lineRead))
+    {
+      fprintf(out, "ERROR: Read-only follower\n");
+    }
+    else if (tx.open && strncmp(lineRead, "exec", EXEC_COMM) == 0)
+    {
+      commExec(newMap, &tx, &log);
+    }
+    else if (tx.open && strncmp(lineRead, "discard", DISCARD_COMM) == 0)
+    {
+      endTransaction(&tx);
+    }
+    else if (tx.open && strncmp(lineRead, "quit", QUIT_COMM) != 0)
+    {
+      queueComm(&tx, lineRead);
+    }
+    else if (strncmp(lineRead, "multi", MULTI_COMM) == 0)
+    {
+      commMulti(&tx);
+    }
+    else if (strncmp(lineRead, "log", LOG_COMM) == 0)
+    {
+      commLog(&log, lineRead, spaces.current);
+    }
+    else if (strncmp(lineRead, "hotkeys", HOTKEYS_COMM) == 0)
+    {
+      commHotKeys(hot);
+    }
+    else if (strncmp(lineRead, "sync", SYNC_COMM) == 0)
+    {
+      commSync(io);
+    }
+    else if (strncmp(lineRead, "set", SET_COMM) == 0)
+    {
+      applied = commSet(newMap, lineRead, hot);
+    }
+    else if (strncmp(lineRead, "get", GET_COMM) == 0 && batchGets)
+    {
+      pending = commGetRun(newMap, lineRead, hot);
+    }
+    else if (strncmp(lineRead, "get", GET_COMM) == 0)
+    {
+      commGet(newMap, lineRead, hot);
+    }
+    else if (strncmp(lineRead, "remove", REM_COMM) == 0)
+    {
+      applied = commRemove(newMap, lineRead);
+    }
+    else if (strncmp(lineRead, "size", SIZE_COMM) == 0)
+    {
+      commSize(newMap);
+    }
+    else if (strncmp(lineRead, "scan", SCAN_COMM) == 0)
+    {
+      commScan(newMap, lineRead);
+    }
+    else if (strncmp(lineRead, "keysof", KEYSOF_COMM) == 0)
+    {
+      commKeysOf(newMap, lineRead);
+    }
+    else if (strncmp(lineRead, "keys", KEYS_COMM) == 0)
+    {
+      commKeys(newMap, lineRead);
+    }
+    else if (strncmp(lineRead, "save", SAVE_COMM) == 0)
+    {
+      commSave(newMap, &save, lineRead);
+    }
+    else if (strncmp(lineRead, "select", SELECT_COMM) == 0)
+    {
+      applied = commSelect(&spaces, lineRead);
+    }
+    else if (strncmp(lineRead, "flush", FLUSH_COMM) == 0)
+    {
+      applied = commFlush(&spaces);
+    }
+    else if (strncmp(lineRead, "replicate", REPLICATE_COMM) == 0)
+    {
+      commReplicate(&spaces, &boot, &save, lineRead);
+    }
+    else if (strncmp(lineRead, "compact", COMPACT_COMM) == 0)
+    {
+      commCompact(&spaces);
+    }
+    else if (strncmp(lineRead, "checkpoint", CHECKPOINT_COMM) == 0)
+    {
+      mapCheckpoint(newMap);
+    }
+    else if (strncmp(lineRead, "quit", QUIT_COMM) == 0)
+    {
+      break;
+    }
+    else
+    {
+      fprintf(out, "Invalid command\n");
+    }
+
+    if (logLine && applied)
+    {
+      logComm(&log, logLine);
+    }
+    free(logLine);
+
+    // Write a little more of the save, if one is running, free a little more of any flushed
+    // keyspace, and compact a little more of the keyspace being compacted.
+    stepSave(&save, SAVE_STEP);
+    stepFlush(&spaces, FLUSH_STEP);
+    stepCompact(&spaces, COMPACT_STEP);
+    reapWrites(io);
+
+    // Send a little more of the snapshot to the follower, and then whatever has built up. Gets
+    // are read ahead in batches, so the writes to the follower are batched too.
+    if (spaces.feed)
+    {
+      stepBootstrap(&spaces, &boot, SAVE_STEP);
+      if (!feedSend(spaces.feed, !batchGets))
+      {
+        fprintf(stderr, "Follower stopped keeping up; replication stopped\n");
+        stopReplication(&spaces, &boot);
+      }
+    }
+
+    endCommand(&rec);
+    free(lineRead);
+    lineRead = NULL;
+  }
+
+  // Quit doesn't get to the end of the loop.
+  if (lineRead)
+  {
+    endCommand(&rec);
+  }
+  free(lineRead);
+  bool matched = finishRecorder(&rec);
+
+  // A transaction that never got to exec is thrown away.
+  if (tx.open)
+  {
+    endTransaction(&tx);
+  }
+  free(tx.comms);
+  if (log.fd >= 0)
+  {
+    asyncClose(io, log.fd);
+  }
+
+  // Finish any save that's still running, and wait for everything to reach the disk, before
+  // exiting.
+  while (save.snap)
+  {
+    stepSave(&save, SAVE_STEP);
+  }
+  if (asyncWait(io) > 0)
+  {
+    fprintf(stderr, "Writes to disk failed\n");
+  }
+  freeAsync(io);
+  freeHotKeys(hot);
+
+  // The follower gets the rest of the feed before exiting.
+  if (spaces.feed)
+  {
+    while (boot.running)
+    {
+      stepBootstrap(&spaces, &boot, SAVE_STEP);
+    }
+    stopReplication(&spaces, &boot);
+  }
+  if (reader)
+  {
+    closeReader(reader);
+  }
+
+  while (spaces.dcount > 0)
+  {
+    stepFlush(&spaces, FLUSH_STEP);
+  }
+  free(spaces.doomed);
+
+  for (int i = 0; i < KEYSPACES; i++)
+  {
+    if (spaces.maps[i])
+    {
+      freeMap(spaces.maps[i]);
+    }
+  }
+  freeLineReader(in);
+  return matched ? 0 : 1;
 }
\ No newline at end of file
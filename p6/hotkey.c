@@ -0,0 +1,308 @@
+/**
+    @file hotkey.c
+    @author Shlok Dave (ssdave)
+    Implementation for the hotkey component.  Sampled keys are counted in a
+    count-min sketch, a few rows of counters each indexed by a different
+    hash of the key, where the smallest of a key's counters is an estimate
+    that's never too low.  The keys with the highest estimates are kept in
+    a small min-heap, so a new key only has to beat the root to get in.
+    Every so often all the counts are halved, so keys that stop being used
+    cool off.
+  */
+
+#include "hotkey.h"
+#include <stdlib.h>
+#include <stdint.h>
+
+/** Number of rows in the sketch. */
+#define SKETCH_ROWS 4
+
+/** Number of bits in the index of a counter in a row. */
+#define SKETCH_BITS 10
+
+/** Number of counters in each row. */
+#define SKETCH_WIDTH (1 << SKETCH_BITS)
+
+/** Number of samples between halvings of the counts. */
+#define DECAY_SAMPLES (1 << 16)
+
+/** Multipliers that give each row its own hash of a key. */
+static uint32_t const rowSeeds[SKETCH_ROWS] = {0x9E3779B1u, 0x85EBCA77u, 0xC2B2AE3Du,
+                                               0x27D4EB2Fu};
+
+/** One of the hot keys. */
+typedef struct
+{
+  /** Copy of the key, owned by the tracker. */
+  Value key;
+
+  /** Hash of the key. */
+  unsigned int hash;
+
+  /** Estimated number of samples of the key. */
+  uint32_t count;
+} HotKey;
+
+/** Representation of a hot key tracker. */
+struct HotKeysStruct
+{
+  /** Rows of the count-min sketch. */
+  uint32_t sketch[SKETCH_ROWS][SKETCH_WIDTH];
+
+  /** The hot keys, a min-heap by count. */
+  HotKey *heap;
+
+  /** Number of keys in the heap. */
+  int size;
+
+  /** Most keys the heap holds. */
+  int top;
+
+  /** Average number of keys per sample. */
+  int rate;
+
+  /** Keys left to skip before the next sample. */
+  int skip;
+
+  /** State of the random sequence that spaces the samples. */
+  uint32_t random;
+
+  /** Samples since the counts were last halved. */
+  int samples;
+};
+
+/**
+  Helper function that picks the next number from a simple random sequence.
+  @param state the sequence's state.
+  @return the next number.
+*/
+static uint32_t nextRandom(uint32_t *state)
+{
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+/**
+  Helper function that picks how many keys to skip before the next sample. The gaps
+  average out to the sampling rate, but vary so a pattern in the commands can't line up
+  with them.
+  @param hk the tracker.
+  @return the number of keys to skip.
+*/
+static int nextGap(HotKeys *hk)
+{
+  if (hk->rate <= 1)
+    return 0;
+  return nextRandom(&hk->random) % (2 * hk->rate - 1);
+}
+
+/**
+  Helper function that swaps two keys of the heap.
+  @param a one key.
+  @param b the other key.
+*/
+static void swapKeys(HotKey *a, HotKey *b)
+{
+  HotKey tmp = *a;
+  *a = *b;
+  *b = tmp;
+}
+
+/**
+  Helper function that moves a key down the heap until neither of its children has a
+  smaller count.
+  @param hk the tracker.
+  @param i index of the key.
+*/
+static void siftDown(HotKeys *hk, int i)
+{
+  while (true)
+  {
+    int least = i;
+    for (int c = 2 * i + 1; c <= 2 * i + 2 && c < hk->size; c++)
+    {
+      if (hk->heap[c].count < hk->heap[least].count)
+        least = c;
+    }
+    if (least == i)
+      return;
+    swapKeys(&hk->heap[i], &hk->heap[least]);
+    i = least;
+  }
+}
+
+/**
+  Helper function that moves a key up the heap until its parent doesn't have a larger
+  count.
+  @param hk the tracker.
+  @param i index of the key.
+*/
+static void siftUp(HotKeys *hk, int i)
+{
+  while (i > 0 && hk->heap[(i - 1) / 2].count > hk->heap[i].count)
+  {
+    swapKeys(&hk->heap[i], &hk->heap[(i - 1) / 2]);
+    i = (i - 1) / 2;
+  }
+}
+
+/**
+  Helper function that copies a key for the heap. The copy goes through the key's byte
+  encoding, which works for every type.
+  @param dest the value to fill in.
+  @param key the key to copy.
+*/
+static void copyKey(Value *dest, Value const *key)
+{
+  int len = encodeValue(key, NULL, 0);
+  unsigned char *buf = malloc(len);
+  encodeValue(key, buf, len);
+  decodeValue(dest, buf, len);
+  free(buf);
+}
+
+/**
+  Helper function that halves every count, in the sketch and in the heap. Halving keeps
+  the heap in order.
+  @param hk the tracker.
+*/
+static void decay(HotKeys *hk)
+{
+  for (int r = 0; r < SKETCH_ROWS; r++)
+  {
+    for (int i = 0; i < SKETCH_WIDTH; i++)
+      hk->sketch[r][i] >>= 1;
+  }
+  for (int i = 0; i < hk->size; i++)
+    hk->heap[i].count >>= 1;
+  hk->samples = 0;
+}
+
+/**
+  This function makes a new tracker with no keys in it.
+  @param top number of hot keys to keep.
+  @param rate about one key in this many is sampled.
+  @return pointer to the new tracker.
+*/
+HotKeys *makeHotKeys(int top, int rate)
+{
+  HotKeys *hk = calloc(1, sizeof(HotKeys));
+  hk->top = top;
+  hk->heap = calloc(top, sizeof(HotKey));
+  hk->rate = rate;
+  hk->random = 2463534242u;
+  hk->skip = nextGap(hk);
+  return hk;
+}
+
+/**
+  This function notes that a key was used. Most keys are only counted down past; a
+  sampled key is added to the sketch, and if its estimate now beats the least hot key,
+  it takes that key's place.
+  @param hk pointer to the tracker.
+  @param key the key that was used.
+*/
+void hotKeysAdd(HotKeys *hk, Value const *key)
+{
+  if (hk->skip-- > 0)
+    return;
+  hk->skip = nextGap(hk);
+
+  // Count the key in every row, and keep the smallest count as its estimate.
+  unsigned int hash = key->hash(key);
+  uint32_t h = hash ^ (hash >> 16);
+  uint32_t count = UINT32_MAX;
+  for (int r = 0; r < SKETCH_ROWS; r++)
+  {
+    uint32_t *c = &hk->sketch[r][(h * rowSeeds[r]) >> (32 - SKETCH_BITS)];
+    if (*c < UINT32_MAX)
+      (*c)++;
+    if (*c < count)
+      count = *c;
+  }
+
+  // The heap is small, so a key already in it is found by looking at each one.
+  int found = -1;
+  for (int i = 0; i < hk->size && found < 0; i++)
+  {
+    if (hk->heap[i].hash == hash && hk->heap[i].key.equals(&hk->heap[i].key, key))
+      found = i;
+  }
+
+  if (found >= 0)
+  {
+    hk->heap[found].count = count;
+    siftDown(hk, found);
+  }
+  else if (hk->size < hk->top)
+  {
+    HotKey *hot = &hk->heap[hk->size];
+    copyKey(&hot->key, key);
+    hot->hash = hash;
+    hot->count = count;
+    siftUp(hk, hk->size++);
+  }
+  else if (hk->size > 0 && count > hk->heap[0].count)
+  {
+    HotKey *hot = &hk->heap[0];
+    hot->key.empty(&hot->key);
+    copyKey(&hot->key, key);
+    hot->hash = hash;
+    hot->count = count;
+    siftDown(hk, 0);
+  }
+
+  if (++hk->samples >= DECAY_SAMPLES)
+    decay(hk);
+}
+
+/**
+  Helper function for sorting hot keys from the highest count to the lowest.
+  @param a pointer to a pointer to one key.
+  @param b pointer to a pointer to the other key.
+  @return negative if a goes first, positive if b does.
+*/
+static int compareHot(void const *a, void const *b)
+{
+  HotKey const *x = *(HotKey const *const *)a;
+  HotKey const *y = *(HotKey const *const *)b;
+  if (x->count != y->count)
+    return x->count < y->count ? 1 : -1;
+
+  // Ties go by place in the heap, so the order doesn't change from one call to the next.
+  return x < y ? -1 : x > y;
+}
+
+/**
+  This function calls a function on each hot key, the most used first, with its
+  estimated number of uses scaled back up by the sampling rate.
+  @param hk pointer to the tracker.
+  @param fn function to call for each key.
+  @param data pointer passed along to fn.
+*/
+void hotKeysVisit(HotKeys const *hk, HotKeyVisitor fn, void *data)
+{
+  HotKey const **order = malloc((hk->size + 1) * sizeof(HotKey const *));
+  for (int i = 0; i < hk->size; i++)
+    order[i] = &hk->heap[i];
+  qsort(order, hk->size, sizeof(HotKey const *), compareHot);
+
+  for (int i = 0; i < hk->size; i++)
+    fn(&order[i]->key, (unsigned long)order[i]->count * (hk->rate > 1 ? hk->rate : 1), data);
+  free(order);
+}
+
+/**
+  This function frees the tracker and its copies of the keys.
+  @param hk pointer to the tracker to free.
+*/
+void freeHotKeys(HotKeys *hk)
+{
+  for (int i = 0; i < hk->size; i++)
+    hk->heap[i].key.empty(&hk->heap[i].key);
+  free(hk->heap);
+  free(hk);
+}
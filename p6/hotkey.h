@@ -0,0 +1,50 @@
+/**
+    @file hotkey.h
+    @author Shlok Dave (ssdave)
+    Header for the hotkey component, which watches the keys commands use
+    and keeps track of the few that are used the most.  Only a sample of
+    the keys is looked at, so watching a key usually costs one decrement.
+*/
+
+#ifndef HOTKEY_H
+#define HOTKEY_H
+
+#include "value.h"
+
+/** Incomplete type for the hot key tracker representation. */
+typedef struct HotKeysStruct HotKeys;
+
+/** Type for a function called on each hot key.
+    @param key The key.
+    @param count Estimate of how many times the key was used.
+    @param data Pointer given by the caller.
+*/
+typedef void (*HotKeyVisitor)(Value const *key, unsigned long count, void *data);
+
+/** Make a tracker with no keys in it.
+    @param top Number of hot keys to keep.
+    @param rate About one key in this many is sampled; 1 samples every key.
+    @return pointer to a new tracker.
+*/
+HotKeys *makeHotKeys(int top, int rate);
+
+/** Note that a command used a key.  The tracker keeps its own copy of
+    any key it holds on to.
+    @param hk The tracker.
+    @param key The key that was used.
+*/
+void hotKeysAdd(HotKeys *hk, Value const *key);
+
+/** Call a function on each hot key, the most used first.
+    @param hk The tracker.
+    @param fn Function to call for each key.
+    @param data Pointer passed to each call of fn.
+*/
+void hotKeysVisit(HotKeys const *hk, HotKeyVisitor fn, void *data);
+
+/** Free all the memory used by a tracker.
+    @param hk The tracker to free.
+*/
+void freeHotKeys(HotKeys *hk);
+
+#endif
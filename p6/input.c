@@ -8,9 +8,13 @@
   are inputted by the user.
 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <poll.h>
 #include "input.h"
 
 /** Initial capacity that helps allocate for buffer. The value represents the starting size. */
@@ -22,6 +26,31 @@
 /** Represents the growth factor that is used for increasing the capacity of the buffer. */
 #define CAPACITY_ADD 2
 
+/** Number of bytes a line reader asks for with each read. */
+#define READ_SIZE 4096
+
+/** Representation of a line reader, with the bytes read so far that haven't been returned. */
+struct LineReaderStruct
+{
+  /** File descriptor the lines come from. */
+  int fd;
+
+  /** Bytes that have been read. */
+  char *buf;
+
+  /** Number of bytes in buf. */
+  size_t len;
+
+  /** Capacity of buf. */
+  size_t cap;
+
+  /** Index in buf of the first byte that hasn't been returned yet. */
+  size_t pos;
+
+  /** True once a read found the end of the input. */
+  bool ended;
+};
+
 /**
   This is the only function that is part of the input component. The main
   responsibility of this function is to read a single input from the given input
@@ -74,4 +103,106 @@ char *readLine(FILE *fp)
   }
 
   return newLineChar;
-}
\ No newline at end of file
+}
+
+/**
+  This function makes a reader for the lines that come in on a file descriptor, with room
+  for one block of input to start with.
+  @param fd the file descriptor to read from.
+  @return pointer to the new reader.
+*/
+LineReader *makeLineReader(int fd)
+{
+  LineReader *r = calloc(1, sizeof(LineReader));
+  r->fd = fd;
+  r->cap = READ_SIZE;
+  r->buf = malloc(r->cap);
+  return r;
+}
+
+/**
+  Helper function that finds the end of the next line in a reader's buffer.
+  @param r pointer to the reader.
+  @return pointer to the newline, or null if a whole line hasn't been read yet.
+*/
+static char *findNewline(LineReader *r)
+{
+  return r->pos < r->len ? memchr(r->buf + r->pos, '\n', r->len - r->pos) : NULL;
+}
+
+/**
+  This function reads the next line from a reader. Bytes are read in blocks until a newline
+  turns up, so lines of any length work, and whatever comes after the line stays in the
+  buffer for next time.
+  @param r pointer to the reader.
+  @return pointer to the line in a block of dynamically allocated memory, or null once there
+  are no more lines.
+*/
+char *nextLine(LineReader *r)
+{
+  char *newline;
+  while ((newline = findNewline(r)) == NULL && !r->ended)
+  {
+    // Move what's left to the front, and make room for another block.
+    memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+    r->len -= r->pos;
+    r->pos = 0;
+    if (r->cap - r->len < READ_SIZE)
+    {
+      r->cap = r->cap * CAPACITY_ADD + READ_SIZE;
+      r->buf = realloc(r->buf, r->cap);
+    }
+
+    ssize_t n = read(r->fd, r->buf + r->len, READ_SIZE);
+    if (n <= 0)
+      r->ended = true;
+    else
+      r->len += n;
+  }
+
+  // A last line without a newline still counts.
+  size_t end = newline ? (size_t)(newline - r->buf) : r->len;
+  if (!newline && end == r->pos)
+    return NULL;
+
+  size_t lineLen = end - r->pos;
+  char *line = malloc(lineLen + 1);
+  memcpy(line, r->buf + r->pos, lineLen);
+  line[lineLen] = '\0';
+  r->pos = newline ? end + 1 : end;
+  return line;
+}
+
+/**
+  This function tells whether nextLine can return without waiting for more input to be sent.
+  @param r pointer to the reader.
+  @return true if a whole line is buffered, the input has ended, or the file descriptor has
+  more input ready.
+*/
+bool lineReady(LineReader *r)
+{
+  if (findNewline(r) || r->ended)
+    return true;
+  struct pollfd pfd = {r->fd, POLLIN, 0};
+  return poll(&pfd, 1, 0) > 0;
+}
+
+/**
+  This function gives the file descriptor a reader reads from.
+  @param r pointer to the reader.
+  @return the file descriptor.
+*/
+int lineReaderFd(LineReader const *r)
+{
+  return r->fd;
+}
+
+/**
+  This function frees a reader and its buffer.
+  @param r pointer to the reader to free.
+*/
+void freeLineReader(LineReader *r)
+{
+  free(r->buf);
+  free(r);
+}
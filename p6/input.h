@@ -9,9 +9,14 @@
 */
 
 #include <stdio.h>
+#include <stdbool.h>
+
+/** Incomplete type for a reader that reads lines from a file descriptor through its own
+    buffer, so it knows whether a whole line is already waiting. */
+typedef struct LineReaderStruct LineReader;
 
 /**
-  This is the only function that is part of the input component. The main
+  This is the first function that is part of the input component. The main
   responsibility of this function is to read a single input from the given input
   stream. After reading the input, it returns it as a string inside a block of
   dynamically allocated memory. This function also reads commands from the user
@@ -22,4 +27,42 @@
   @return pointer to the line that is read stored in the allocated array. It returns
   null if the EOF is reached without any of the characters being read.
 */
-char *readLine(FILE *fp);
\ No newline at end of file
+char *readLine(FILE *fp);
+
+/**
+  This function makes a reader for the lines that come in on a file descriptor.
+  @param fd the file descriptor to read from.
+  @return pointer to the new reader.
+*/
+LineReader *makeLineReader(int fd);
+
+/**
+  This function reads the next line from a reader, waiting for it if it hasn't all come in
+  yet. The newline is taken off, and a last line without one is still returned.
+  @param r pointer to the reader.
+  @return pointer to the line in a block of dynamically allocated memory, or null once there
+  are no more lines.
+*/
+char *nextLine(LineReader *r);
+
+/**
+  This function tells whether nextLine can return without waiting: either a whole line is
+  already in the reader's buffer, or the file descriptor has more input ready.
+  @param r pointer to the reader.
+  @return true if reading the next line won't wait for more input to be sent.
+*/
+bool lineReady(LineReader *r);
+
+/**
+  This function gives the file descriptor a reader reads from, so a caller can wait on it
+  along with other ones.
+  @param r pointer to the reader.
+  @return the file descriptor.
+*/
+int lineReaderFd(LineReader const *r);
+
+/**
+  This function frees a reader and its buffer. The file descriptor is left open.
+  @param r pointer to the reader to free.
+*/
+void freeLineReader(LineReader *r);
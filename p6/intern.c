@@ -0,0 +1,225 @@
+/**
+    @file intern.c
+    @author Shlok Dave (ssdave)
+    Implementation for the intern component.  Each pooled string is kept in
+    one allocation with a small header in front of its characters, so the
+    pointer handed out can be used as an ordinary C string.
+  */
+
+#include "intern.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+/** Number of buckets a new pool starts with. */
+#define FIRST_BUCKETS 64
+
+/** Header and characters of a pooled string. */
+typedef struct PoolEntryStruct PoolEntry;
+
+struct PoolEntryStruct
+{
+  /** Pool the string belongs to. */
+  StringPool *pool;
+
+  /** Next string in the same bucket. */
+  PoolEntry *next;
+
+  /** Number of references held to the string. */
+  int refs;
+
+  /** Length of the string. */
+  int len;
+
+  /** Hash of the string. */
+  unsigned int hash;
+
+  /** Null-terminated characters of the string. */
+  char chars[];
+};
+
+/** Representation of a string pool, a chained hash table of entries. */
+struct StringPoolStruct
+{
+  /** Buckets of the table. */
+  PoolEntry **table;
+
+  /** Number of buckets, a power of two. */
+  int tlen;
+
+  /** Number of distinct strings in the pool. */
+  int size;
+};
+
+/**
+  Helper function that finds the entry a pooled string is stored in.
+  @param str characters of a pooled string.
+  @return the entry holding them.
+*/
+static PoolEntry *entryOf(char const *str)
+{
+  return (PoolEntry *)(str - offsetof(PoolEntry, chars));
+}
+
+/**
+  Helper function that doubles the number of buckets in the pool.
+  @param pool the pool to grow.
+*/
+static void growPool(StringPool *pool)
+{
+  int len = pool->tlen * 2;
+  PoolEntry **table = calloc(len, sizeof(PoolEntry *));
+  for (int idx = 0; idx < pool->tlen; idx++)
+  {
+    PoolEntry *entry = pool->table[idx];
+    while (entry)
+    {
+      PoolEntry *next = entry->next;
+      entry->next = table[entry->hash & (len - 1)];
+      table[entry->hash & (len - 1)] = entry;
+      entry = next;
+    }
+  }
+  free(pool->table);
+  pool->table = table;
+  pool->tlen = len;
+}
+
+/**
+  This function makes an empty pool.
+  @return pointer to the new pool.
+*/
+StringPool *makePool(void)
+{
+  StringPool *pool = malloc(sizeof(StringPool));
+  pool->table = calloc(FIRST_BUCKETS, sizeof(PoolEntry *));
+  pool->tlen = FIRST_BUCKETS;
+  pool->size = 0;
+  return pool;
+}
+
+/**
+  This function gets the shared copy of a string, adding one to the pool if it doesn't
+  have the string yet. Either way the caller gets a reference to it.
+  @param pool pointer to the pool.
+  @param str characters of the string.
+  @param len length of the string.
+  @param hash hash of the string, which picks its bucket.
+  @return the pooled copy, which can be used as an ordinary C string.
+*/
+char const *poolIntern(StringPool *pool, char const *str, int len, unsigned int hash)
+{
+  // See if we already have a copy.
+  for (PoolEntry *entry = pool->table[hash & (pool->tlen - 1)]; entry; entry = entry->next)
+  {
+    if (entry->hash == hash && entry->len == len && memcmp(entry->chars, str, len) == 0)
+    {
+      entry->refs++;
+      return entry->chars;
+    }
+  }
+
+  PoolEntry *entry = malloc(sizeof(PoolEntry) + len + 1);
+  entry->pool = pool;
+  entry->refs = 1;
+  entry->len = len;
+  entry->hash = hash;
+  memcpy(entry->chars, str, len);
+  entry->chars[len] = '\0';
+
+  entry->next = pool->table[hash & (pool->tlen - 1)];
+  pool->table[hash & (pool->tlen - 1)] = entry;
+  if (++pool->size > pool->tlen)
+    growPool(pool);
+
+  return entry->chars;
+}
+
+/**
+  This function looks for the shared copy of a string without adding it or taking a
+  reference to it.
+  @param pool pointer to the pool.
+  @param str characters of the string.
+  @param len length of the string.
+  @param hash hash of the string.
+  @return the pooled copy, or NULL if the pool doesn't have the string.
+*/
+char const *poolFind(StringPool const *pool, char const *str, int len, unsigned int hash)
+{
+  for (PoolEntry *entry = pool->table[hash & (pool->tlen - 1)]; entry; entry = entry->next)
+  {
+    if (entry->hash == hash && entry->len == len && memcmp(entry->chars, str, len) == 0)
+      return entry->chars;
+  }
+  return NULL;
+}
+
+/**
+  This function adds a reference to a pooled string.
+  @param str a string returned by poolIntern.
+*/
+void poolRetain(char const *str)
+{
+  entryOf(str)->refs++;
+}
+
+/**
+  This function drops a reference to a pooled string. When the last one is dropped, the
+  string is taken out of its bucket and freed.
+  @param str a string returned by poolIntern.
+*/
+void poolRelease(char const *str)
+{
+  PoolEntry *entry = entryOf(str);
+  if (--entry->refs > 0)
+    return;
+
+  // Unlink the entry from its bucket before freeing it.
+  StringPool *pool = entry->pool;
+  PoolEntry **link = &pool->table[entry->hash & (pool->tlen - 1)];
+  while (*link != entry)
+    link = &(*link)->next;
+  *link = entry->next;
+  pool->size--;
+  free(entry);
+}
+
+/**
+  This function gets the pool a pooled string belongs to, from the header in front of it.
+  @param str a string returned by poolIntern.
+  @return the pool that holds it.
+*/
+StringPool *poolOf(char const *str)
+{
+  return entryOf(str)->pool;
+}
+
+/**
+  This function gets the length of a pooled string from the header in front of it.
+  @param str a string returned by poolIntern.
+  @return its length.
+*/
+int poolLength(char const *str)
+{
+  return entryOf(str)->len;
+}
+
+/**
+  This function gets the hash of a pooled string from the header in front of it.
+  @param str a string returned by poolIntern.
+  @return the hash it was added with.
+*/
+unsigned int poolHash(char const *str)
+{
+  return entryOf(str)->hash;
+}
+
+/**
+  This function frees the pool. Every string in it must have been released already.
+  @param pool pointer to the pool to free.
+*/
+void freePool(StringPool *pool)
+{
+  free(pool->table);
+  free(pool);
+}
@@ -0,0 +1,72 @@
+/**
+    @file intern.h
+    @author Shlok Dave (ssdave)
+    Header for the intern component, a pool that keeps one shared, reference
+    counted copy of each distinct string, along with its length and hash.
+*/
+
+#ifndef INTERN_H
+#define INTERN_H
+
+/** Incomplete type for the string pool representation. */
+typedef struct StringPoolStruct StringPool;
+
+/** Make an empty string pool.
+    @return pointer to a new pool.
+*/
+StringPool *makePool(void);
+
+/** Get the shared copy of a string, adding it to the pool if it isn't there
+    yet.  Either way the caller holds one more reference to the copy.
+    @param pool Pool to look in.
+    @param str Characters of the string.
+    @param len Length of the string.
+    @param hash Hash of the string, used to find it in the pool.
+    @return the pooled, null-terminated copy of the string.
+*/
+char const *poolIntern(StringPool *pool, char const *str, int len, unsigned int hash);
+
+/** Find the shared copy of a string without adding it to the pool.  No
+    reference is taken, so the copy is only good while the pool keeps it.
+    @param pool Pool to look in.
+    @param str Characters of the string.
+    @param len Length of the string.
+    @param hash Hash of the string.
+    @return the pooled copy, or NULL if the pool doesn't have the string.
+*/
+char const *poolFind(StringPool const *pool, char const *str, int len, unsigned int hash);
+
+/** Add a reference to a pooled string.
+    @param str String returned by poolIntern.
+*/
+void poolRetain(char const *str);
+
+/** Drop a reference to a pooled string, freeing it when the last one is gone.
+    @param str String returned by poolIntern.
+*/
+void poolRelease(char const *str);
+
+/** Get the pool a pooled string belongs to.
+    @param str String returned by poolIntern.
+    @return the pool that holds it.
+*/
+StringPool *poolOf(char const *str);
+
+/** Get the length of a pooled string without looking at its characters.
+    @param str String returned by poolIntern.
+    @return the length that was given to poolIntern.
+*/
+int poolLength(char const *str);
+
+/** Get the hash of a pooled string without looking at its characters.
+    @param str String returned by poolIntern.
+    @return the hash that was given to poolIntern.
+*/
+unsigned int poolHash(char const *str);
+
+/** Free a pool.  Every string in it must have been released already.
+    @param pool The pool to free.
+*/
+void freePool(StringPool *pool);
+
+#endif
@@ -0,0 +1,229 @@
+/**
+    @file lz.c
+    @author Shlok Dave (ssdave)
+    Implementation for the lz component.  Compressed bytes are a series of
+    sequences, each a token byte, some literal bytes copied as they are, and
+    then a match: an earlier run of the output to copy again, given by how
+    far back it starts.  The high half of the token is the number of
+    literals and the low half is the match length less MIN_MATCH; a half of
+    15 means more length bytes follow, each added on, until one is less
+    than 255.  The last sequence has only literals.  Matches are found
+    with a hash table of where each four-byte run was last seen, so
+    compressing takes one pass.
+  */
+
+#include "lz.h"
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+
+/** Shortest match worth encoding. */
+#define MIN_MATCH 4
+
+/** Farthest back a match can start, the most a two-byte offset holds. */
+#define MAX_OFFSET 65535
+
+/** Number of bits in a hash of four bytes. */
+#define HASH_BITS 12
+
+/** Value of a half token that means more length bytes follow. */
+#define LONG_LEN 15
+
+/** Value of a length byte that means another one follows. */
+#define MORE_LEN 255
+
+/**
+  Helper function that reads four bytes as one number.
+  @param p the bytes.
+  @return the number.
+*/
+static uint32_t read32(unsigned char const *p)
+{
+  uint32_t x;
+  memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+/**
+  Helper function that picks the hash table slot for four bytes.
+  @param x the four bytes, as read by read32.
+  @return slot in the table.
+*/
+static unsigned int hash4(uint32_t x)
+{
+  return (x * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/**
+  Helper function that writes the extra bytes of a length that didn't fit in its half
+  of the token.
+  @param dst buffer to write to.
+  @param cap number of bytes available in dst.
+  @param out where in dst to write.
+  @param len what's left of the length, after the 15 in the token.
+  @return where in dst the next byte goes, or -1 if there wasn't room.
+*/
+static int writeLength(unsigned char *dst, int cap, int out, int len)
+{
+  for (; len >= MORE_LEN; len -= MORE_LEN)
+  {
+    if (out >= cap)
+      return -1;
+    dst[out++] = MORE_LEN;
+  }
+  if (out >= cap)
+    return -1;
+  dst[out++] = len;
+  return out;
+}
+
+/**
+  Helper function that writes one sequence: its token, its literals and its match, if
+  it has one.
+  @param dst buffer to write to.
+  @param cap number of bytes available in dst.
+  @param out where in dst to write.
+  @param lit the literal bytes.
+  @param litLen number of literal bytes.
+  @param offset how far back the match starts, or zero for the last sequence.
+  @param matchLen length of the match.
+  @return where in dst the next sequence goes, or -1 if there wasn't room.
+*/
+static int writeSequence(unsigned char *dst, int cap, int out, unsigned char const *lit,
+                         int litLen, int offset, int matchLen)
+{
+  if (out >= cap)
+    return -1;
+  int token = out++;
+  int extra = matchLen - MIN_MATCH;
+  dst[token] = (litLen < LONG_LEN ? litLen : LONG_LEN) << 4;
+  if (offset)
+    dst[token] |= extra < LONG_LEN ? extra : LONG_LEN;
+
+  if (litLen >= LONG_LEN && (out = writeLength(dst, cap, out, litLen - LONG_LEN)) < 0)
+    return -1;
+  if (out + litLen > cap)
+    return -1;
+  memcpy(dst + out, lit, litLen);
+  out += litLen;
+  if (!offset)
+    return out;
+
+  if (out + 2 > cap)
+    return -1;
+  dst[out++] = offset & 0xFF;
+  dst[out++] = offset >> 8;
+  if (extra >= LONG_LEN)
+    out = writeLength(dst, cap, out, extra - LONG_LEN);
+  return out;
+}
+
+/**
+  This function compresses a run of bytes. At each position it checks the last place
+  the same four bytes were seen, and if they're still there and close enough, extends
+  the match as far as it goes.
+  @param src bytes to compress.
+  @param len number of bytes in src.
+  @param dst buffer the compressed bytes are written to.
+  @param cap number of bytes available in dst.
+  @return number of compressed bytes, or zero if they didn't fit in cap.
+*/
+int lzCompress(unsigned char const *src, int len, unsigned char *dst, int cap)
+{
+  // Positions are stored one higher, so zero means the slot was never used.
+  int table[1 << HASH_BITS];
+  memset(table, 0, sizeof(table));
+
+  int anchor = 0, pos = 0, out = 0;
+  while (pos + MIN_MATCH <= len)
+  {
+    uint32_t seq = read32(src + pos);
+    unsigned int h = hash4(seq);
+    int cand = table[h] - 1;
+    table[h] = pos + 1;
+    if (cand < 0 || pos - cand > MAX_OFFSET || read32(src + cand) != seq)
+    {
+      pos++;
+      continue;
+    }
+
+    int matchLen = MIN_MATCH;
+    while (pos + matchLen < len && src[cand + matchLen] == src[pos + matchLen])
+      matchLen++;
+    out = writeSequence(dst, cap, out, src + anchor, pos - anchor, pos - cand, matchLen);
+    if (out < 0)
+      return 0;
+    pos += matchLen;
+    anchor = pos;
+  }
+
+  out = writeSequence(dst, cap, out, src + anchor, len - anchor, 0, 0);
+  return out < 0 ? 0 : out;
+}
+
+/**
+  Helper function that reads the extra bytes of a length.
+  @param src compressed bytes.
+  @param len number of bytes in src.
+  @param in where in src the length bytes start; moved past them.
+  @param total the length so far, which the bytes are added to.
+  @return false if src ended first.
+*/
+static bool readLength(unsigned char const *src, int len, int *in, int *total)
+{
+  int b;
+  do
+  {
+    if (*in >= len)
+      return false;
+    b = src[(*in)++];
+    *total += b;
+  } while (b == MORE_LEN);
+  return true;
+}
+
+/**
+  This function decompresses bytes written by lzCompress, checking every length and
+  offset against the buffers so bad input can't read or write outside them.
+  @param src compressed bytes.
+  @param len number of bytes in src.
+  @param dst buffer the original bytes are written to.
+  @param cap number of bytes available in dst.
+  @return number of bytes written to dst, or -1 if src isn't valid or doesn't fit in cap.
+*/
+int lzDecompress(unsigned char const *src, int len, unsigned char *dst, int cap)
+{
+  int in = 0, out = 0;
+  while (in < len)
+  {
+    int token = src[in++];
+    int litLen = token >> 4;
+    if (litLen == LONG_LEN && !readLength(src, len, &in, &litLen))
+      return -1;
+    if (litLen > len - in || litLen > cap - out)
+      return -1;
+    memcpy(dst + out, src + in, litLen);
+    in += litLen;
+    out += litLen;
+
+    // The last sequence ends with its literals.
+    if (in == len)
+      return out;
+
+    if (in + 2 > len)
+      return -1;
+    int offset = src[in] | src[in + 1] << 8;
+    in += 2;
+    int matchLen = token & 0xF;
+    if (matchLen == LONG_LEN && !readLength(src, len, &in, &matchLen))
+      return -1;
+    matchLen += MIN_MATCH;
+    if (offset == 0 || offset > out || matchLen > cap - out)
+      return -1;
+
+    // The match can overlap what it's writing, so copy a byte at a time.
+    for (int i = 0; i < matchLen; i++, out++)
+      dst[out] = dst[out - offset];
+  }
+  return out;
+}
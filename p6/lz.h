@@ -0,0 +1,30 @@
+/**
+    @file lz.h
+    @author Shlok Dave (ssdave)
+    Header for the lz component, a small LZ77 codec used to keep large
+    string values compressed in memory.
+*/
+
+#ifndef LZ_H
+#define LZ_H
+
+/** Compress a run of bytes.
+    @param src Bytes to compress.
+    @param len Number of bytes in src.
+    @param dst Buffer the compressed bytes are written to.
+    @param cap Number of bytes available in dst.
+    @return number of compressed bytes, or zero if they didn't fit in cap.
+*/
+int lzCompress(unsigned char const *src, int len, unsigned char *dst, int cap);
+
+/** Decompress bytes written by lzCompress.
+    @param src Compressed bytes.
+    @param len Number of bytes in src.
+    @param dst Buffer the original bytes are written to.
+    @param cap Number of bytes available in dst.
+    @return number of bytes written to dst, or -1 if src isn't valid or
+    doesn't fit in cap.
+*/
+int lzDecompress(unsigned char const *src, int len, unsigned char *dst, int cap);
+
+#endif
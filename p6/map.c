@@ -6,7 +6,48 @@
 
 #include "map.h"
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
 #include "value.h"
+#include "bloom.h"
+#include "radix.h"
+#include "pmap.h"
+#include "vindex.h"
+
+/** Largest average chain length we allow before the table is doubled. */
+#define MAX_LOAD 1
+
+/** The table is shrunk once it has more than this many buckets for each pair.  This is
+    far below MAX_LOAD, so a map that hovers around one size doesn't keep resizing. */
+#define SHRINK_LOAD 8
+
+/** Number of buckets a scan may look at for each pair it was asked to visit,
+    so a scan over a mostly empty table still returns quickly. */
+#define SCAN_BUCKETS 10
+
+/** Number of lookups mapGetBatch keeps going at the same time. */
+#define BATCH_WIDTH 8
+
+/** Ask the processor to start loading an address into the cache. */
+#ifdef __GNUC__
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p) ((void)(p))
+#endif
+
+/** Number of pairs in the first block of pairs a map allocates.  Each block
+    after that is as big as all the earlier ones put together. */
+#define FIRST_BLOCK 64
+
+/** Fewest slots a dense array has, and the number of slots it may have on top of
+    DENSE_FILL slots for each key. */
+#define DENSE_MIN 64
+
+/** Most slots for each key a dense array can grow to before the map goes back to
+    using its hash table. */
+#define DENSE_FILL 2
 
 typedef struct MapPairStruct MapPair;
 
@@ -19,23 +60,246 @@ struct MapPairStruct
   /** Value part of this node, stored right in the node to improve locality. */
   Value val;
 
+  /** Hash of the key, saved so the table can be resized without rehashing keys. */
+  unsigned int hash;
+
   /** Pointer to the next node at the same element of this table. */
   MapPair *next;
 };
 
+typedef struct PairBlockStruct PairBlock;
+
+/** Block of memory that pairs are handed out from, so a map's pairs are packed
+    together and can be freed a whole block at a time. */
+struct PairBlockStruct
+{
+  /** Block allocated before this one. */
+  PairBlock *next;
+
+  /** Number of pairs handed out from this block so far. */
+  int used;
+
+  /** Number of pairs the block can hold. */
+  int cap;
+
+  /** The pairs themselves. */
+  MapPair pairs[];
+};
+
 /** Representation of a hash table implementation of a map. */
 struct MapStruct
 {
   /** Table of key / value pairs. */
   MapPair **table;
 
-  /** Length of the table. */
+  /** Length of the table, always a power of two so a hash can be masked into it. */
   int tlen;
 
   /** Number of key / value pairs in the map. */
   int size;
+
+  /** Optional Bloom filter over the key hashes, or NULL if the map doesn't use one. */
+  Bloom *filter;
+
+  /** Number of keys removed since the filter was last built.  Their bits are
+      still set in the filter, so it gets less useful as this grows. */
+  int staleRemoves;
+
+  /** Optional radix tree over the string keys, or NULL if the map doesn't keep one.
+      Each key in the tree is stored with the pair that holds it. */
+  Radix *keyIndex;
+
+  /** Optional reverse index from each value to the keys holding it, or NULL if the
+      map doesn't keep one.  It points at the keys stored in the pairs. */
+  ValueIndex *valIndex;
+
+  /** Blocks the pairs are allocated from, newest first. */
+  PairBlock *blocks;
+
+  /** List of removed pairs that can be handed out again, linked through next. */
+  MapPair *freePairs;
+
+  /** Number of pairs whose key or value has memory of its own to free. */
+  int ownedPairs;
+
+  /** Blocks that mapCompact is moving the pairs out of, or NULL if it isn't running.
+      Pairs removed from these blocks aren't reused, since the blocks are going away. */
+  PairBlock *oldBlocks;
+
+  /** Block of oldBlocks that mapCompact looks at next. */
+  PairBlock *cblock;
+
+  /** Index in cblock of the next pair mapCompact looks at. */
+  int cnext;
+
+  /** Arena the strings of the pairs mapCompact moves are packed into. */
+  StringArena *arena;
+
+  /** Length the table was made with, which it never shrinks below. */
+  int minLen;
+
+  /** Snapshot that's currently open on this map, or NULL if there isn't one. */
+  MapSnapshot *snap;
+
+  /** Values of a map in dense mode, with the value for key k at index k - dbase,
+      or NULL while the map keeps its pairs in the hash table.  A map switches to
+      dense mode when its keys are all integers packed closely together. */
+  Value *dense;
+
+  /** Bitmap with a bit set for each slot of dense that holds a value. */
+  uint64_t *present;
+
+  /** Key that goes in the first slot of dense, a multiple of 64. */
+  int dbase;
+
+  /** Number of slots in dense, a multiple of 64. */
+  int dlen;
+
+  /** While the map is using its hash table, the number of integer keys in it. */
+  int intKeys;
+
+  /** Pool that string keys and values are interned into, or NULL if the map
+      doesn't intern its strings. */
+  StringPool *strings;
+
+  /** True if every string key went through the pool, so a string the pool doesn't have
+      can't be a key. */
+  bool keysInterned;
+
+  /** Shortest string value the map compresses, or zero if it doesn't compress them. */
+  int compressAt;
+
+  /** Table in a memory-mapped file that holds all the pairs of a map made with
+      openMap, or NULL for a map kept in memory. */
+  PMap *disk;
+
+  /** Values decoded from the file for the last mapGet or mapGetBatch. */
+  Value *found;
+
+  /** Number of values in found. */
+  int fcount;
+
+  /** Capacity of the found array. */
+  int fcap;
+
+  /** Function told about every change made to the map, or NULL. */
+  MapObserver observer;
+
+  /** Pointer passed along to the observer. */
+  void *odata;
+
+  /** Smallest integer key added since the map last had no integer keys. */
+  int minKey;
+
+  /** Largest integer key added since the map last had no integer keys. */
+  int maxKey;
+};
+
+/** Representation of a point-in-time view of a map.  Buckets are copied the
+    first time they are changed after the snapshot is taken, and keys and
+    values the map drops are kept alive until the snapshot is released, so
+    the copies never point at freed memory. */
+struct MapSnapshotStruct
+{
+  /** Map the snapshot was taken of. */
+  Map *map;
+
+  /** Copy of each bucket's chain as it was when the snapshot was taken,
+      only filled in for buckets that have changed since. */
+  MapPair **saved;
+
+  /** Whether each bucket has been copied into saved. */
+  bool *copied;
+
+  /** Keys and values the map has dropped while the snapshot was open. */
+  Value *dropped;
+
+  /** Number of values in dropped. */
+  int dcount;
+
+  /** Capacity of the dropped array. */
+  int dcap;
+
+  /** Next bucket snapshotStep will visit, or the next slot for a snapshot of a
+      map in dense mode. */
+  int next;
+
+  /** Copy of the map's dense array if it was in dense mode when the snapshot was
+      taken, or NULL.  The table isn't looked at for these snapshots. */
+  Value *dense;
+
+  /** Copy of the map's bitmap of used dense slots. */
+  uint64_t *present;
+
+  /** Key that goes in the first slot of the copied dense array. */
+  int dbase;
+
+  /** Number of slots in the copied dense array. */
+  int dlen;
 };
 
+/** Steps of a lookup done by mapGetBatch.  Each step uses memory that the
+    step before it asked to have prefetched. */
+typedef enum
+{
+  /** Check the filter and load the head of the bucket. */
+  LOOKUP_BUCKET,
+
+  /** Look at the hash saved in the current pair. */
+  LOOKUP_PAIR,
+
+  /** Compare the current pair's key with the key being looked for. */
+  LOOKUP_KEY,
+
+  /** The lookup is finished. */
+  LOOKUP_DONE
+} LookupStep;
+
+/** One lookup in progress inside mapGetBatch. */
+typedef struct
+{
+  /** Index of the key being looked for in the batch. */
+  int which;
+
+  /** Key being looked for, as found in the map's string pool if it has one. */
+  Value key;
+
+  /** Hash of the key being looked for. */
+  unsigned int hash;
+
+  /** Pair the lookup is at in the chain. */
+  MapPair *pair;
+
+  /** What the lookup does next. */
+  LookupStep step;
+} Lookup;
+
+/** Prefix query passed through the radix tree to the map's visitor. */
+typedef struct
+{
+  /** Function to call for each matching pair. */
+  MapVisitor fn;
+
+  /** Pointer the caller wants passed to fn. */
+  void *data;
+
+  /** Prefix being looked for, when the keys are checked one at a time. */
+  char const *prefix;
+} PrefixQuery;
+
+/** Query for the keys holding a value, passed along to the map's visitor. */
+typedef struct
+{
+  /** Function to call for each matching pair. */
+  MapVisitor fn;
+
+  /** Pointer the caller wants passed to fn. */
+  void *data;
+
+  /** Value being looked for, when the pairs are checked one at a time. */
+  Value const *val;
+} ValueQuery;
+
 /**
   Helper function that is designed to help implement a new empty hash table. This table
   takes in a specific size as an integer to develop the table. It is mainly created to help
@@ -51,173 +315,1872 @@ static MapPair **implementNewTable(int size)
 }
 
 /**
-  This function is responsible for creating an empty, dynamically allocated Map. The function
-  initializes its fields and helps return a pointer of the new map created. The len parameter
-  helps give the initial size of the hash table. In all, the function helps creates a new map
-  with a certain specified length.
-  @param len the length of the hash table that is created within the new map.
-  @return pointer of the new map that is created.
+  Helper function that adds a new block for pairs to the map. The block is made at
+  least as big as all the earlier blocks together, so a map only ever has a handful
+  of blocks.
+  @param m pointer to the map the block is for.
+  @param count number of pairs the block needs room for, at least.
 */
-Map *makeMap(int len)
+static void addBlock(Map *m, int count)
 {
-  // Memory is allocated for the map struct.
-  Map *newMap = calloc(1, sizeof(Map));
-  newMap->table = implementNewTable(len);
-  newMap->tlen = len;
+  int cap = FIRST_BLOCK;
+  for (PairBlock *b = m->blocks; b; b = b->next)
+    cap += b->cap;
+  if (cap < count)
+    cap = count;
 
-  // Pointer returned after initializing fields.
-  return newMap;
+  PairBlock *block = malloc(sizeof(PairBlock) + cap * sizeof(MapPair));
+  block->used = 0;
+  block->cap = cap;
+  block->next = m->blocks;
+  m->blocks = block;
 }
 
 /**
-  This function is responsible for returning the current number of key/value
-  pairs that are in the provided map. It uses the ternary operator for directly
-  checking if the map is non-null.
-  @param m pointer to the map to check what the size is.
-  @return the size of the map, 0 is returned if the map is null.
+  Helper function that hands out room for the given number of pairs, all next to
+  each other in one block, adding a new block if the newest one is too full.
+  @param m pointer to the map the pairs are for.
+  @param count number of pairs needed.
+  @return pointer to the first of the pairs.
 */
-int mapSize(Map *m)
+static MapPair *allocPairs(Map *m, int count)
 {
-  // Returning 0 if the pointer to map is null, if not, return size of map.
-  return m ? m->size : 0;
+  if (!m->blocks || m->blocks->cap - m->blocks->used < count)
+    addBlock(m, count);
+
+  MapPair *pairs = m->blocks->pairs + m->blocks->used;
+  m->blocks->used += count;
+  return pairs;
 }
 
 /**
-  This function is responsible for adding the given key/value pair to the provided
-  map. For the function, if the key is already in the map, it is replaced with the given
-  value. The map will gain ownership of the key and value objects and can move the values
-  into its representation if needed.
-  @param m pointer to the map to help set the key and values.
-  @param key pointer to the key value that it needs to be set.
-  @param val pointer to the value that needs to be together with the key.
+  Helper function that gets room for a single new pair, reusing a removed pair
+  if there is one.
+  @param m pointer to the map the pair is for.
+  @return pointer to the pair.
 */
-void mapSet(Map *m, Value *key, Value *val)
+static MapPair *allocPair(Map *m)
 {
-  // Hash value is calculated for key.
-  unsigned int newHash = key->hash(key);
-  int mapIdx = newHash % m->tlen;
+  if (m->freePairs)
+  {
+    MapPair *pair = m->freePairs;
+    m->freePairs = pair->next;
+    return pair;
+  }
+  return allocPairs(m, 1);
+}
 
-  // Double pointer is used to traverse properly.
-  MapPair **currPairs = &m->table[mapIdx];
-  while (*currPairs)
+/**
+  Helper function that puts a removed pair on the free list. Its empty function
+  is cleared to mark it as unused, so freeMap knows to skip it.
+  @param m pointer to the map the pair belongs to.
+  @param pair the pair being given back, with its key and value already emptied.
+*/
+static void releasePair(Map *m, MapPair *pair)
+{
+  pair->key.empty = NULL;
+
+  // Pairs in blocks that are being compacted away are just left there.
+  for (PairBlock *b = m->oldBlocks; b; b = b->next)
   {
-    if (key->equals(&(*currPairs)->key, key))
-    {
-      // Free existing string value here.
-      (*currPairs)->val.empty(&(*currPairs)->val);
-      val->move(val, &(*currPairs)->val);
+    if (pair >= b->pairs && pair < b->pairs + b->cap)
       return;
-    }
-    currPairs = &(*currPairs)->next;
   }
 
-  // If the key is not found, memory is allocated.
-  MapPair *keySearch = malloc(sizeof(MapPair));
+  pair->next = m->freePairs;
+  m->freePairs = pair;
+}
 
-  // Initialize the map pair with the given value and key.
-  key->move(key, &keySearch->key);
-  val->move(val, &keySearch->val);
-  keySearch->next = m->table[mapIdx];
-  m->table[mapIdx] = keySearch;
+/**
+  Helper function that checks if a pair has any memory besides the pair itself.
+  @param pair the pair to check.
+  @return true if the key or the value has to be emptied when the pair goes away.
+*/
+static bool ownsMemory(MapPair const *pair)
+{
+  return !valueIsInline(&pair->key) || !valueIsInline(&pair->val);
+}
 
-  m->size++;
+/**
+  Helper function that copies a bucket's chain into the open snapshot, the first
+  time the bucket is about to change after the snapshot was taken. The keys and
+  values aren't copied, just the Value structs that refer to them.
+  @param m pointer to the map being changed.
+  @param idx index of the bucket that is about to change.
+*/
+static void preserveBucket(Map *m, int idx)
+{
+  MapSnapshot *snap = m->snap;
+  if (!snap || snap->dense || snap->copied[idx])
+    return;
+  snap->copied[idx] = true;
+
+  MapPair **tail = &snap->saved[idx];
+  for (MapPair *currPairs = m->table[idx]; currPairs; currPairs = currPairs->next)
+  {
+    *tail = malloc(sizeof(MapPair));
+    **tail = *currPairs;
+    tail = &(*tail)->next;
+  }
+  *tail = NULL;
 }
 
 /**
-  This function is implemented to return the value associated with the given key.
-  If the key is not part of the map, it is returned as null. The new value that is returned
-  is still part of the map representation, as the value should not be changed. In general, the
-  function is responsible for getting the value that is part of the specific key in the map.
-  @param m pointer to the map to retrieve the specific value.
-  @param key pointer to the key whose value the function will get.
-  @return pointer to the value that is part of the specific key.
+  Helper function for getting rid of a key or value the map no longer needs. If a
+  snapshot is open, the snapshot may still refer to it, so it is kept until the
+  snapshot is released. Otherwise it's emptied right away.
+  @param m pointer to the map that's dropping the value.
+  @param v the value to get rid of.
 */
-Value *mapGet(Map *m, Value *key)
+static void dropValue(Map *m, Value *v)
 {
-  // Hash value is calculated for key.
-  unsigned int newHash = key->hash(key);
-  int idx = newHash % m->tlen;
+  MapSnapshot *snap = m->snap;
+  if (!snap)
+  {
+    v->empty(v);
+    return;
+  }
 
-  // Double pointer is used to traverse properly.
-  MapPair **currPairs = &m->table[idx];
-  while (*currPairs)
+  if (snap->dcount >= snap->dcap)
   {
-    // If the current key matches the given key, get the value.
-    if (key->equals(&(*currPairs)->key, key))
-    {
-      return &(*currPairs)->val;
-    }
-    currPairs = &(*currPairs)->next;
+    snap->dcap = snap->dcap ? snap->dcap * 2 : FIRST_BLOCK;
+    snap->dropped = realloc(snap->dropped, snap->dcap * sizeof(Value));
   }
+  snap->dropped[snap->dcount++] = *v;
+}
 
-  // Return null if the key is not found.
-  return NULL;
+/**
+  Helper function that gets a file map ready to hand back the given number of values
+  from a lookup. The values from the last lookup are emptied first, which is why the
+  values a file map returns are only good until the next lookup.
+  @param m pointer to the file map.
+  @param count number of values the lookup may return.
+*/
+static void resetFound(Map *m, int count)
+{
+  for (int i = 0; i < m->fcount; i++)
+    m->found[i].empty(&m->found[i]);
+  m->fcount = 0;
+
+  if (count > m->fcap)
+  {
+    m->fcap = count;
+    m->found = realloc(m->found, count * sizeof(Value));
+  }
 }
 
 /**
-  This function acts to remove the key/pair for the given key from the
-  provided map. The function's implementation is similar to the previous functions,
-  expect that we are removing the specific key/value. It returns true if there was
-  a matching key for removal and false otherwise.
-  @param m pointer to the map for where the key/value will be removed.
-  @param key pointer to the key that is going to be removed from the map.
+  Helper function that looks up a key in a file map, keeping the decoded value in
+  the map's found array.
+  @param m pointer to the file map, which must have room in found.
+  @param key the key to look for.
+  @return pointer to the decoded value, or NULL if the key isn't in the map.
 */
-bool mapRemove(Map *m, Value *key)
+static Value *diskGet(Map *m, Value *key)
 {
-  // Hash value is calculated for key.
-  unsigned int newHash = key->hash(key);
-  int idx = newHash % m->tlen;
+  Value *val = &m->found[m->fcount];
+  if (!pmapGet(m->disk, key, val))
+    return NULL;
+  m->fcount++;
+  return val;
+}
 
-  // Double pointer is used to traverse properly.
-  MapPair **currPairs = &m->table[idx];
+/**
+  Helper function that rounds a key down to the start of its group of 64 slots.
+  @param k the key to round.
+  @return the largest multiple of 64 that is no bigger than k.
+*/
+static long long floor64(long long k)
+{
+  return k & ~63LL;
+}
 
-  while (*currPairs)
+/**
+  Helper function that checks whether a slot of the dense array holds a value.
+  @param present the bitmap of used slots.
+  @param dlen number of slots in the dense array.
+  @param slot index of the slot, which may be out of range.
+  @return true if the slot is in range and holds a value.
+*/
+static bool denseHas(uint64_t const *present, int dlen, long long slot)
+{
+  return slot >= 0 && slot < dlen && ((present[slot >> 6] >> (slot & 63)) & 1);
+}
+
+/**
+  Helper function that checks whether the map may switch to dense mode right now.
+  A snapshot expects the map to stay in the form it was taken in, and the reverse
+  index points at keys stored in pairs, which a dense array doesn't have. A running
+  compaction is still walking the pairs.
+  @param m pointer to the map to check.
+  @return true if the map may use a dense array.
+*/
+static bool canDense(Map const *m)
+{
+  return !m->snap && !m->valIndex && !m->oldBlocks;
+}
+
+/**
+  Helper function that keeps track of the range of integer keys in the hash table,
+  so the map can tell when switching to a dense array would pay off. The range only
+  ever widens until the last integer key is removed.
+  @param m pointer to the map the key was added to.
+  @param k the integer key that was added.
+*/
+static void noteIntKey(Map *m, int k)
+{
+  if (m->intKeys++ == 0)
   {
-    // If key is found, begin removal process.
-    if (key->equals(&(*currPairs)->key, key))
-    {
-      MapPair *valRem = *currPairs;
-      *currPairs = valRem->next;
+    m->minKey = k;
+    m->maxKey = k;
+  }
+  else if (k < m->minKey)
+    m->minKey = k;
+  else if (k > m->maxKey)
+    m->maxKey = k;
+}
 
-      // Free the key and value
-      valRem->key.empty(&valRem->key);
-      valRem->val.empty(&valRem->val);
-      free(valRem);
+/**
+  Helper function that moves the dense array to a new range of keys. Everything
+  in the old array is copied into the matching slots of the new one.
+  @param m pointer to the map whose dense array is replaced.
+  @param base key for the first slot of the new array, a multiple of 64 no
+  bigger than the old base.
+  @param len number of slots in the new array, a multiple of 64, big enough to
+  cover the old array.
+*/
+static void resizeDense(Map *m, long long base, long long len)
+{
+  Value *dense = malloc(len * sizeof(Value));
+  uint64_t *present = calloc(len / 64, sizeof(uint64_t));
 
-      m->size--;
-      return true;
+  if (m->dense)
+  {
+    long long shift = m->dbase - base;
+    memcpy(dense + shift, m->dense, m->dlen * sizeof(Value));
+    memcpy(present + shift / 64, m->present, m->dlen / 64 * sizeof(uint64_t));
+    free(m->dense);
+    free(m->present);
+  }
+
+  m->dense = dense;
+  m->present = present;
+  m->dbase = base;
+  m->dlen = len;
+}
+
+/**
+  Helper function that empties every value left in the dense array and frees it.
+  @param m pointer to the map whose dense array is freed.
+*/
+static void freeDense(Map *m)
+{
+  for (long long slot = 0; m->ownedPairs > 0 && slot < m->dlen; slot++)
+  {
+    if (denseHas(m->present, m->dlen, slot) && !valueIsInline(&m->dense[slot]))
+    {
+      m->ownedPairs--;
+      m->dense[slot].empty(&m->dense[slot]);
     }
   }
-  return false;
+
+  free(m->dense);
+  free(m->present);
+  m->dense = NULL;
+  m->present = NULL;
 }
 
 /**
-  This function is responsible for freeing all of the memory that is used
-  to store the provided map. In this process, it includes freeing the memory
-  for the hash table and all of the map pairs.
-  @param m pointer to the map that needs to be freed.
+  Helper function that sets a key in a map that's in dense mode. If the key is
+  outside the array, the array is grown to cover it, as long as that wouldn't
+  leave the array with too many empty slots.
+  @param m pointer to the map in dense mode.
+  @param key the integer key to set, which the map takes ownership of.
+  @param val the value to set, which the map takes ownership of.
+  @return true if the key was set, or false if the key is too far from the
+  others and the map should go back to its hash table.
 */
-void freeMap(Map *m)
+static bool denseSet(Map *m, Value *key, Value *val)
 {
-  // Go through each part of the hash table.
-  for (int idx = 0; idx < m->tlen; idx++)
+  long long k = key->ival;
+  long long slot = k - m->dbase;
+
+  if (slot < 0 || slot >= m->dlen)
   {
-    MapPair *currPairs = m->table[idx];
+    // Find the range that's needed to cover the key.
+    long long lo = k < m->dbase ? floor64(k) : m->dbase;
+    long long end = k < m->dbase ? (long long)m->dbase + m->dlen : floor64(k) + 64;
+    long long limit = (long long)DENSE_FILL * (m->size + 1) + DENSE_MIN;
+    if (end - lo > limit)
+      return false;
 
-    // Free memory for each key and value.
-    while (currPairs != NULL)
+    // Double the array if that fits in the limit, so growing one key at a time is cheap.
+    long long len = 2LL * m->dlen < limit ? 2LL * m->dlen : floor64(limit);
+    if (len > end - lo)
     {
-      MapPair *next = currPairs->next;
+      if (k < m->dbase)
+        lo = end - len < INT_MIN ? INT_MIN : end - len;
+      else
+        end = lo + len;
+    }
+    resizeDense(m, lo, end - lo);
+    slot = k - m->dbase;
+  }
 
-      currPairs->key.empty(&currPairs->key);
-      currPairs->val.empty(&currPairs->val);
-      free(currPairs);
+  Value *dest = &m->dense[slot];
+  if (denseHas(m->present, m->dlen, slot))
+  {
+    bool owned = !valueIsInline(dest);
+    dropValue(m, dest);
+    val->move(val, dest);
+    m->ownedPairs += !valueIsInline(dest) - owned;
+  }
+  else
+  {
+    val->move(val, dest);
+    m->present[slot >> 6] |= 1ULL << (slot & 63);
+    m->ownedPairs += !valueIsInline(dest);
+    m->size++;
+  }
 
-      currPairs = next;
+  // Keys aren't stored in dense mode, the slot says what the key is.
+  key->empty(key);
+  return true;
+}
+
+/**
+  Helper function that switches a map from its hash table to a dense array. All the
+  keys must be integers between minKey and maxKey. Every value moves into its slot,
+  and then all the pairs are freed at once.
+  @param m pointer to the map to switch.
+*/
+static void enterDense(Map *m)
+{
+  long long base = floor64(m->minKey);
+  resizeDense(m, base, floor64(m->maxKey) + 64 - base);
+
+  for (int idx = 0; idx < m->tlen; idx++)
+  {
+    for (MapPair *currPairs = m->table[idx]; currPairs; currPairs = currPairs->next)
+    {
+      long long slot = (long long)currPairs->key.ival - m->dbase;
+      currPairs->val.move(&currPairs->val, &m->dense[slot]);
+      m->present[slot >> 6] |= 1ULL << (slot & 63);
     }
+    m->table[idx] = NULL;
   }
 
-  // Hash table and map are freed.
-  free(m->table);
-  free(m);
-}
\ No newline at end of file
+  // None of the pairs are used anymore.
+  while (m->blocks)
+  {
+    PairBlock *next = m->blocks->next;
+    free(m->blocks);
+    m->blocks = next;
+  }
+  m->freePairs = NULL;
+  m->intKeys = 0;
+}
+
+/**
+  This function is responsible for creating an empty, dynamically allocated Map. The function
+  initializes its fields and helps return a pointer of the new map created. The len parameter
+  helps give the initial size of the hash table. In all, the function helps creates a new map
+  with a certain specified length.
+  @param len the length of the hash table that is created within the new map.
+  @return pointer of the new map that is created.
+*/
+Map *makeMap(int len)
+{
+  // Round the length up to a power of two.
+  int tlen = 1;
+  while (tlen < len)
+    tlen *= 2;
+
+  // Memory is allocated for the map struct.
+  Map *newMap = calloc(1, sizeof(Map));
+  newMap->table = implementNewTable(tlen);
+  newMap->tlen = tlen;
+  newMap->minLen = tlen;
+
+  // Pointer returned after initializing fields.
+  return newMap;
+}
+
+/**
+  This function opens a map that's stored in a memory-mapped file instead of in
+  memory, creating the file if it doesn't exist. The buckets and pairs are linked
+  by file offsets, so reopening the file later gives back the same map right away,
+  with pages only read in as lookups touch them. Values that come back from the
+  map are decoded copies that are only good until the next lookup. Filters, key
+  indexes, string pools and snapshots aren't used for these maps.
+  @param path name of the file holding the map.
+  @return pointer to the map, or NULL if the file couldn't be opened as a map.
+*/
+Map *openMap(char const *path)
+{
+  PMap *disk = openPMap(path);
+  if (!disk)
+    return NULL;
+
+  Map *newMap = calloc(1, sizeof(Map));
+  newMap->disk = disk;
+  return newMap;
+}
+
+/**
+  This function sets the function that's told about every key the map sets or
+  removes, replacing any earlier one. It's how changes get passed along to
+  something that keeps a copy of the map.
+  @param m pointer to the map to watch.
+  @param fn function to call for each change, or NULL to stop watching.
+  @param data pointer passed along to each call of fn.
+*/
+void mapObserve(Map *m, MapObserver fn, void *data)
+{
+  m->observer = fn;
+  m->odata = data;
+}
+
+/**
+  This function writes all the changes made to a file map out to its file and
+  waits for them to get there. Maps kept in memory don't have anything to write.
+  @param m pointer to the map to write out.
+*/
+void mapCheckpoint(Map *m)
+{
+  if (m->disk)
+    pmapSync(m->disk);
+}
+
+/**
+  Helper function that throws away the map's Bloom filter and builds a new one
+  containing just the keys that are in the map right now. This is how the filter
+  gets rid of the bits left behind by removed keys, and how it is made bigger once
+  the map holds more keys than it was sized for.
+  @param m pointer to the map whose filter is rebuilt.
+  @param capacity number of keys the new filter should be sized for.
+*/
+static void rebuildFilter(Map *m, int capacity)
+{
+  if (m->filter)
+    freeBloom(m->filter);
+  m->filter = makeBloom(capacity);
+  m->staleRemoves = 0;
+
+  // Add the hash of every key that is still in the table.
+  for (int idx = 0; idx < m->tlen; idx++)
+  {
+    for (MapPair *currPairs = m->table[idx]; currPairs; currPairs = currPairs->next)
+      bloomAdd(m->filter, currPairs->hash);
+  }
+}
+
+/**
+  Helper function that moves every pair into a new table of the given length.
+  Pairs keep their saved hash, so no key has to be hashed again. Since the new
+  length is a power of two, each bucket of the old table splits into buckets
+  that share its low-order bits, which is what keeps a scan cursor valid.
+  @param m pointer to the map whose table is replaced.
+  @param len length of the new table, a power of two.
+*/
+static void resizeTable(Map *m, int len)
+{
+  // Buckets can't move while a snapshot is open, so growth waits until it's released.
+  if (m->snap)
+    return;
+
+  MapPair **newTable = implementNewTable(len);
+
+  // Move each pair to the front of its new chain.
+  for (int idx = 0; idx < m->tlen; idx++)
+  {
+    MapPair *currPairs = m->table[idx];
+    while (currPairs)
+    {
+      MapPair *next = currPairs->next;
+      int newIdx = currPairs->hash & (len - 1);
+      currPairs->next = newTable[newIdx];
+      newTable[newIdx] = currPairs;
+      currPairs = next;
+    }
+  }
+
+  free(m->table);
+  m->table = newTable;
+  m->tlen = len;
+
+  // Rebuild the filter so it is sized for the new table.
+  if (m->filter && bloomCapacity(m->filter) < len)
+    rebuildFilter(m, len);
+}
+
+/**
+  Helper function that halves the table once the map has far fewer pairs than buckets,
+  down to a length where each bucket has at most half a pair on average, but never below
+  the length the map was made with. Since it only happens well below MAX_LOAD, a map
+  has to lose most of its pairs before it shrinks. The filter is rebuilt too, which also
+  gets rid of the bits the removed keys left in it.
+  @param m pointer to the map that may shrink.
+*/
+static void shrinkTable(Map *m)
+{
+  if (m->snap || m->tlen <= m->minLen || (long long)m->size * SHRINK_LOAD >= m->tlen)
+    return;
+
+  int len = m->tlen;
+  while (len / 2 >= m->minLen && (long long)m->size * 2 <= len / 2)
+    len /= 2;
+  resizeTable(m, len);
+
+  // The filter isn't kept up to date in dense mode, it's rebuilt when the map leaves it.
+  if (m->filter && !m->dense)
+    rebuildFilter(m, m->size > m->tlen ? m->size : m->tlen);
+}
+
+/**
+  This function turns on the Bloom filter for the given map. After this, a get or
+  remove for a key that isn't in the map can usually be answered by looking at a
+  single cache line of the filter, without walking the hash chain.
+  @param m pointer to the map that should use a filter.
+*/
+void mapUseFilter(Map *m)
+{
+  if (m->filter || m->disk)
+    return;
+
+  // Size the filter for whichever is bigger, the table or the current contents.
+  rebuildFilter(m, m->size > m->tlen ? m->size : m->tlen);
+}
+
+/**
+  Helper function that switches a map from a dense array back to its hash table,
+  when a key that isn't an integer shows up or the integer keys get too spread out.
+  Each value is moved into a new pair with its key.
+  @param m pointer to the map to switch.
+*/
+static void leaveDense(Map *m)
+{
+  Value *dense = m->dense;
+  uint64_t *present = m->present;
+  m->dense = NULL;
+  m->present = NULL;
+
+  // Make room for everything first, so the table doesn't resize along the way.
+  int len = m->tlen;
+  while (m->size > len * MAX_LOAD)
+    len *= 2;
+  if (len > m->tlen)
+    resizeTable(m, len);
+
+  m->intKeys = 0;
+  for (long long slot = 0; slot < m->dlen; slot++)
+  {
+    if (!denseHas(present, m->dlen, slot))
+      continue;
+
+    MapPair *pair = allocPair(m);
+    setInteger(&pair->key, m->dbase + slot);
+    dense[slot].move(&dense[slot], &pair->val);
+    pair->hash = pair->key.hash(&pair->key);
+    pair->next = m->table[pair->hash & (m->tlen - 1)];
+    m->table[pair->hash & (m->tlen - 1)] = pair;
+    noteIntKey(m, pair->key.ival);
+  }
+
+  free(dense);
+  free(present);
+
+  // The filter wasn't kept up to date while the map was dense.
+  if (m->filter)
+    rebuildFilter(m, m->size > m->tlen ? m->size : m->tlen);
+}
+
+/**
+  This function gives the map a string pool. Strings that are set in the map from
+  then on are interned into it, so repeated values share storage and keys that came
+  through the pool compare by pointer. Strings already in the map stay as they are,
+  since the radix tree may be pointing at their characters. Keys that are looked up
+  are found in the pool too, so they compare by pointer as well, and if the map was
+  empty when it got its pool, a string the pool doesn't have is known to be missing.
+  @param m pointer to the map that should intern its strings.
+*/
+void mapInternStrings(Map *m)
+{
+  if (!m->strings && !m->disk)
+  {
+    m->strings = makePool();
+    m->keysInterned = m->size == 0;
+  }
+}
+
+/**
+  Helper function that gets the form of a key to look for in the table. A plain
+  string is swapped for the pool's copy, so hashing it is a field load and comparing
+  it with an interned key is a pointer compare.
+  @param m pointer to the map being searched.
+  @param key the key being looked for.
+  @param probe filled in with the key to look for, which must not be emptied.
+  @return false if the key can't be in the map: it's a string the pool doesn't have,
+  and every string key went through the pool.
+*/
+static bool probeKey(Map const *m, Value const *key, Value *probe)
+{
+  if (!m->strings)
+  {
+    *probe = *key;
+    return true;
+  }
+  return findInterned(key, m->strings, probe) || !m->keysInterned;
+}
+
+/**
+  This function has the map compress string values that are at least the given length.
+  Values set from then on are compressed before they're stored, ahead of any interning,
+  and are only decompressed when they're printed or compared with a plain string.
+  @param m pointer to the map that should compress its values.
+  @param threshold shortest value worth compressing.
+*/
+void mapCompressValues(Map *m, int threshold)
+{
+  if (!m->disk && threshold > 0)
+    m->compressAt = threshold;
+}
+
+/**
+  This function turns on the radix tree index over the string keys of the given
+  map. Every string key already in the map is added to it, and from then on mapSet
+  and mapRemove keep it up to date, so mapKeysWithPrefix doesn't have to look at
+  the whole table.
+  @param m pointer to the map that should index its keys.
+*/
+void mapIndexKeys(Map *m)
+{
+  if (m->keyIndex || m->disk)
+    return;
+  m->keyIndex = makeRadix();
+
+  // Add every string key that's already in the table.
+  for (int idx = 0; idx < m->tlen; idx++)
+  {
+    for (MapPair *currPairs = m->table[idx]; currPairs; currPairs = currPairs->next)
+    {
+      char const *str = valueString(&currPairs->key);
+      if (str)
+        radixInsert(m->keyIndex, str, currPairs);
+    }
+  }
+}
+
+/**
+  This function turns on the reverse index from values to keys for the given map.
+  Every pair already in the map is added to it, and from then on mapSet and
+  mapRemove keep it up to date, so mapKeysOf only has to look at the keys holding
+  the value. A map in dense mode goes back to its hash table first, and stays
+  there, since the index needs a pair for each key.
+  @param m pointer to the map that should index its values.
+*/
+void mapIndexValues(Map *m)
+{
+  if (m->valIndex || m->disk)
+    return;
+  if (m->dense)
+    leaveDense(m);
+  m->valIndex = makeValueIndex();
+
+  for (int idx = 0; idx < m->tlen; idx++)
+  {
+    for (MapPair *currPairs = m->table[idx]; currPairs; currPairs = currPairs->next)
+      vindexAdd(m->valIndex, &currPairs->val, &currPairs->key);
+  }
+}
+
+/**
+  This function is responsible for returning the current number of key/value
+  pairs that are in the provided map. It uses the ternary operator for directly
+  checking if the map is non-null.
+  @param m pointer to the map to check what the size is.
+  @return the size of the map, 0 is returned if the map is null.
+*/
+int mapSize(Map *m)
+{
+  // Returning 0 if the pointer to map is null, if not, return size of map.
+  if (m && m->disk)
+    return pmapSize(m->disk);
+  return m ? m->size : 0;
+}
+
+/**
+  This function is responsible for adding the given key/value pair to the provided
+  map. For the function, if the key is already in the map, it is replaced with the given
+  value. The map will gain ownership of the key and value objects and can move the values
+  into its representation if needed.
+  @param m pointer to the map to help set the key and values.
+  @param key pointer to the key value that it needs to be set.
+  @param val pointer to the value that needs to be together with the key.
+*/
+void mapSet(Map *m, Value *key, Value *val)
+{
+  // Tell the observer before the map takes the key and value.
+  if (m->observer)
+    m->observer(key, val, m->odata);
+
+  // A file map keeps its own encoded copies.
+  if (m->disk)
+  {
+    pmapSet(m->disk, key, val);
+    key->empty(key);
+    val->empty(val);
+    return;
+  }
+
+  if (m->compressAt)
+    compressString(val, m->compressAt);
+  if (m->strings)
+  {
+    internString(key, m->strings);
+    internString(val, m->strings);
+  }
+
+  if (m->dense)
+  {
+    if (valueIsInteger(key) && denseSet(m, key, val))
+    {
+      // The table stays empty, but scans go by its length, so it grows with the map.
+      if (m->size > m->tlen * MAX_LOAD)
+        resizeTable(m, m->tlen * 2);
+      return;
+    }
+    leaveDense(m);
+  }
+
+  // Hash value is calculated for key.
+  unsigned int newHash = key->hash(key);
+  int mapIdx = newHash & (m->tlen - 1);
+
+  // The bucket is about to change one way or the other.
+  preserveBucket(m, mapIdx);
+
+  // Double pointer is used to traverse properly.
+  MapPair **currPairs = &m->table[mapIdx];
+  while (*currPairs)
+  {
+    if ((*currPairs)->hash == newHash && key->equals(&(*currPairs)->key, key))
+    {
+      // The key moves from the old value's keys to the new one's.
+      if (m->valIndex)
+      {
+        vindexRemove(m->valIndex, &(*currPairs)->val, &(*currPairs)->key);
+        vindexAdd(m->valIndex, val, &(*currPairs)->key);
+      }
+
+      // Free existing string value here.
+      bool owned = ownsMemory(*currPairs);
+      dropValue(m, &(*currPairs)->val);
+      val->move(val, &(*currPairs)->val);
+      m->ownedPairs += ownsMemory(*currPairs) - owned;
+
+      // The map owns the given key, but already has an equal one.
+      key->empty(key);
+      return;
+    }
+    currPairs = &(*currPairs)->next;
+  }
+
+  // If the key is not found, memory is allocated.
+  MapPair *keySearch = allocPair(m);
+
+  // Initialize the map pair with the given value and key.
+  key->move(key, &keySearch->key);
+  val->move(val, &keySearch->val);
+  keySearch->hash = newHash;
+  keySearch->next = m->table[mapIdx];
+  m->table[mapIdx] = keySearch;
+  m->ownedPairs += ownsMemory(keySearch);
+
+  // String keys also go in the radix tree, if the map has one.
+  char const *str = valueString(&keySearch->key);
+  if (m->keyIndex && str)
+    radixInsert(m->keyIndex, str, keySearch);
+  if (m->valIndex)
+    vindexAdd(m->valIndex, &keySearch->val, &keySearch->key);
+
+  m->size++;
+  if (valueIsInteger(&keySearch->key))
+    noteIntKey(m, keySearch->key.ival);
+
+  // Double the table once the chains get too long on average.
+  if (m->size > m->tlen * MAX_LOAD)
+    resizeTable(m, m->tlen * 2);
+
+  // Keep the filter up to date, growing it once it is holding too many keys.
+  if (m->filter)
+  {
+    if (m->size > bloomCapacity(m->filter))
+      rebuildFilter(m, m->size * 2);
+    else
+      bloomAdd(m->filter, newHash);
+  }
+
+  // Switch to a dense array once the keys are all integers packed closely enough.
+  if (canDense(m) && m->intKeys == m->size &&
+      (long long)m->maxKey - m->minKey + 1 <= m->size + DENSE_MIN)
+    enterDense(m);
+}
+
+/**
+  This function is implemented to return the value associated with the given key.
+  If the key is not part of the map, it is returned as null. The new value that is returned
+  is still part of the map representation, as the value should not be changed. In general, the
+  function is responsible for getting the value that is part of the specific key in the map.
+  @param m pointer to the map to retrieve the specific value.
+  @param key pointer to the key whose value the function will get.
+  @return pointer to the value that is part of the specific key.
+*/
+Value *mapGet(Map *m, Value *key)
+{
+  if (m->disk)
+  {
+    resetFound(m, 1);
+    return diskGet(m, key);
+  }
+
+  // In dense mode the key says exactly where the value is.
+  if (m->dense)
+  {
+    if (!valueIsInteger(key))
+      return NULL;
+    long long slot = (long long)key->ival - m->dbase;
+    return denseHas(m->present, m->dlen, slot) ? &m->dense[slot] : NULL;
+  }
+
+  Value probe;
+  if (!probeKey(m, key, &probe))
+    return NULL;
+  key = &probe;
+
+  // Hash value is calculated for key.
+  unsigned int newHash = key->hash(key);
+
+  // A key the filter has never seen can't be in the table.
+  if (m->filter && !bloomMayContain(m->filter, newHash))
+    return NULL;
+
+  int idx = newHash & (m->tlen - 1);
+
+  // Double pointer is used to traverse properly.
+  MapPair **currPairs = &m->table[idx];
+  while (*currPairs)
+  {
+    // If the current key matches the given key, get the value.
+    if ((*currPairs)->hash == newHash && key->equals(&(*currPairs)->key, key))
+    {
+      return &(*currPairs)->val;
+    }
+    currPairs = &(*currPairs)->next;
+  }
+
+  // Return null if the key is not found.
+  return NULL;
+}
+
+/**
+  Helper function that starts a lookup for one key of a batch. The key is hashed,
+  and the filter block and the bucket for it are prefetched, so they may be in the
+  cache by the time the lookup gets its next turn.
+  @param m pointer to the map being searched.
+  @param look the lookup to start.
+  @param keys the keys of the batch.
+  @param which index of the key this lookup is for.
+*/
+static void startLookup(Map *m, Lookup *look, Value *keys, int which)
+{
+  look->which = which;
+  if (!probeKey(m, &keys[which], &look->key))
+  {
+    look->step = LOOKUP_DONE;
+    return;
+  }
+  look->hash = look->key.hash(&look->key);
+  look->step = LOOKUP_BUCKET;
+  if (m->filter)
+    bloomPrefetch(m->filter, look->hash);
+  PREFETCH(&m->table[look->hash & (m->tlen - 1)]);
+}
+
+/**
+  Helper function that moves a lookup on to the next pair in its chain, asking for
+  that pair to be prefetched.
+  @param look the lookup to advance.
+  @param next the next pair in the chain, or NULL at the end of the chain.
+*/
+static void nextPair(Lookup *look, MapPair *next)
+{
+  look->pair = next;
+  look->step = next ? LOOKUP_PAIR : LOOKUP_DONE;
+  PREFETCH(next);
+}
+
+/**
+  Helper function that runs one step of a lookup. Each step only touches memory
+  that was prefetched by the step before, then prefetches what the next step
+  will need and gives up its turn.
+  @param m pointer to the map being searched.
+  @param look the lookup to run.
+  @param vals where the results of the batch go.
+*/
+static void stepLookup(Map *m, Lookup *look, Value **vals)
+{
+  Value *key = &look->key;
+  switch (look->step)
+  {
+  case LOOKUP_BUCKET:
+    if (m->filter && !bloomMayContain(m->filter, look->hash))
+      look->step = LOOKUP_DONE;
+    else
+      nextPair(look, m->table[look->hash & (m->tlen - 1)]);
+    break;
+
+  case LOOKUP_PAIR:
+    if (look->pair->hash != look->hash)
+    {
+      nextPair(look, look->pair->next);
+      break;
+    }
+
+    // The hash matches, so the key itself needs comparing. Strings keep it elsewhere.
+    PREFETCH(valueString(&look->pair->key));
+    look->step = LOOKUP_KEY;
+    break;
+
+  case LOOKUP_KEY:
+    if (key->equals(&look->pair->key, key))
+    {
+      vals[look->which] = &look->pair->val;
+      look->step = LOOKUP_DONE;
+    }
+    else
+      nextPair(look, look->pair->next);
+    break;
+
+  case LOOKUP_DONE:
+    break;
+  }
+}
+
+/**
+  This function looks up a whole batch of keys at once. Instead of finishing one
+  lookup before starting the next, it keeps several going and takes turns between
+  them. Every time a lookup needs memory that might not be in the cache (the filter,
+  the bucket, a pair, or a string key), it asks for it to be prefetched and lets
+  the other lookups run while it loads.
+  @param m pointer to the map to search.
+  @param keys array of keys to look for.
+  @param count number of keys in the array.
+  @param vals array where the value for each key is stored, or NULL for keys that
+  aren't in the map. The values are still owned by the map.
+*/
+void mapGetBatch(Map *m, Value *keys, int count, Value **vals)
+{
+  // Values from a file map all have to stay good until the next lookup.
+  if (m->disk)
+  {
+    resetFound(m, count);
+    for (int i = 0; i < count; i++)
+      vals[i] = diskGet(m, &keys[i]);
+    return;
+  }
+
+  // Dense lookups don't chase any pointers, so there's nothing to overlap.
+  if (m->dense)
+  {
+    for (int i = 0; i < count; i++)
+      vals[i] = mapGet(m, &keys[i]);
+    return;
+  }
+
+  Lookup looks[BATCH_WIDTH];
+  int started = 0;
+  int active = 0;
+
+  // Start as many lookups as there is room for.
+  for (; started < count && active < BATCH_WIDTH; started++, active++)
+  {
+    vals[started] = NULL;
+    startLookup(m, &looks[active], keys, started);
+  }
+
+  // Go around the lookups, replacing each finished one with the next key.
+  while (active > 0)
+  {
+    for (int i = 0; i < active; i++)
+    {
+      stepLookup(m, &looks[i], vals);
+      if (looks[i].step != LOOKUP_DONE)
+        continue;
+
+      if (started < count)
+      {
+        vals[started] = NULL;
+        startLookup(m, &looks[i], keys, started++);
+      }
+      else
+      {
+        looks[i--] = looks[--active];
+      }
+    }
+  }
+}
+
+/**
+  Helper function that removes the key/pair for the given key from the provided map,
+  in whichever form the map is keeping its pairs right now.
+  @param m pointer to the map for where the key/value will be removed.
+  @param key pointer to the key that is going to be removed from the map.
+  @return true if there was a matching key for removal and false otherwise.
+*/
+static bool removeKey(Map *m, Value *key)
+{
+  if (m->disk)
+    return pmapRemove(m->disk, key);
+
+  if (m->dense)
+  {
+    if (!valueIsInteger(key))
+      return false;
+    long long slot = (long long)key->ival - m->dbase;
+    if (!denseHas(m->present, m->dlen, slot))
+      return false;
+
+    m->present[slot >> 6] &= ~(1ULL << (slot & 63));
+    m->ownedPairs -= !valueIsInline(&m->dense[slot]);
+    dropValue(m, &m->dense[slot]);
+    m->size--;
+
+    // Go back to hashing once most of the array is empty.
+    if (m->dlen > 2LL * DENSE_FILL * m->size + DENSE_MIN)
+      leaveDense(m);
+    shrinkTable(m);
+    return true;
+  }
+
+  Value probe;
+  if (!probeKey(m, key, &probe))
+    return false;
+  key = &probe;
+
+  // Hash value is calculated for key.
+  unsigned int newHash = key->hash(key);
+
+  // A key the filter has never seen can't be in the table.
+  if (m->filter && !bloomMayContain(m->filter, newHash))
+    return false;
+
+  int idx = newHash & (m->tlen - 1);
+
+  // Double pointer is used to traverse properly.
+  MapPair **currPairs = &m->table[idx];
+
+  while (*currPairs)
+  {
+    // If key is found, begin removal process.
+    if ((*currPairs)->hash == newHash && key->equals(&(*currPairs)->key, key))
+    {
+      preserveBucket(m, idx);
+      MapPair *valRem = *currPairs;
+      *currPairs = valRem->next;
+
+      // Take the key out of the radix tree before its string is freed.
+      char const *str = valueString(&valRem->key);
+      if (m->keyIndex && str)
+        radixRemove(m->keyIndex, str);
+      if (m->valIndex)
+        vindexRemove(m->valIndex, &valRem->val, &valRem->key);
+
+      // Free the key and value
+      m->ownedPairs -= ownsMemory(valRem);
+      if (valueIsInteger(&valRem->key))
+        m->intKeys--;
+      dropValue(m, &valRem->key);
+      dropValue(m, &valRem->val);
+      releasePair(m, valRem);
+
+      m->size--;
+
+      // Rebuild the filter once removed keys make up a good part of it.
+      if (m->filter && ++m->staleRemoves > bloomCapacity(m->filter) / 2)
+        rebuildFilter(m, m->size > m->tlen ? m->size : m->tlen);
+      shrinkTable(m);
+      return true;
+    }
+    currPairs = &(*currPairs)->next;
+  }
+  return false;
+}
+
+/**
+  This function acts to remove the key/pair for the given key from the
+  provided map. It returns true if there was a matching key for removal and false
+  otherwise. The map's observer hears about the key only if it was removed.
+  @param m pointer to the map for where the key/value will be removed.
+  @param key pointer to the key that is going to be removed from the map.
+*/
+bool mapRemove(Map *m, Value *key)
+{
+  if (!removeKey(m, key))
+    return false;
+
+  if (m->observer)
+    m->observer(key, NULL, m->odata);
+  return true;
+}
+
+/**
+  This function gets the map ready to hold at least the given number of pairs.
+  The table is grown to the length it would reach on its own, the filter is sized
+  for that many keys, and room for the new pairs is allocated in one block, so
+  adding that many pairs afterward won't resize anything.
+  @param m pointer to the map to get ready.
+  @param count number of pairs the map should be able to hold.
+*/
+void mapReserve(Map *m, int count)
+{
+  if (m->disk)
+  {
+    pmapReserve(m->disk, count);
+    return;
+  }
+
+  int len = m->tlen;
+  while (count > len * MAX_LOAD)
+    len *= 2;
+  if (len > m->tlen)
+    resizeTable(m, len);
+
+  if (m->filter && bloomCapacity(m->filter) < count)
+    rebuildFilter(m, count);
+
+  // A map in dense mode doesn't use pairs.
+  if (m->dense)
+    return;
+
+  // Only ask for pairs beyond the ones the map already has or can reuse.
+  int avail = m->blocks ? m->blocks->cap - m->blocks->used : 0;
+  for (MapPair *pair = m->freePairs; pair && avail < count - m->size; pair = pair->next)
+    avail++;
+  if (count - m->size > avail)
+    addBlock(m, count - m->size);
+}
+
+/**
+  This function fills an empty map from arrays of keys and values in one pass.
+  The keys are sorted by bucket with a counting sort, and each bucket's pairs
+  are put next to each other in memory, so no key has to be compared with any
+  other and walking a chain later stays in one part of memory. Like mapSet, the
+  map takes ownership of the keys and values. If the map isn't empty, or has a
+  snapshot open, the pairs are just added one at a time with mapSet.
+  @param m pointer to the map to fill.
+  @param keys array of keys to add, which must all be different.
+  @param vals array of values, where vals[i] goes with keys[i].
+  @param count number of keys and values in the arrays.
+*/
+void mapBuild(Map *m, Value *keys, Value *vals, int count)
+{
+  if (m->size > 0 || m->snap || m->disk)
+  {
+    for (int i = 0; i < count; i++)
+      mapSet(m, &keys[i], &vals[i]);
+    return;
+  }
+  if (count <= 0)
+    return;
+
+  // Build into the hash table, and see afterward whether a dense array would be better.
+  if (m->dense)
+    freeDense(m);
+
+  // Size the table once, then get all the pairs in one piece.
+  int len = m->tlen;
+  while (count > len * MAX_LOAD)
+    len *= 2;
+  if (len > m->tlen)
+    resizeTable(m, len);
+  MapPair *pairs = allocPairs(m, count);
+
+  // Count how many keys land in each bucket.
+  unsigned int *hashes = malloc(count * sizeof(unsigned int));
+  int *starts = calloc(m->tlen + 1, sizeof(int));
+  for (int i = 0; i < count; i++)
+  {
+    if (m->compressAt)
+      compressString(&vals[i], m->compressAt);
+    if (m->strings)
+    {
+      internString(&keys[i], m->strings);
+      internString(&vals[i], m->strings);
+    }
+    if (m->observer)
+      m->observer(&keys[i], &vals[i], m->odata);
+    hashes[i] = keys[i].hash(&keys[i]);
+    starts[(hashes[i] & (m->tlen - 1)) + 1]++;
+  }
+
+  // Turn the counts into where each bucket's pairs start.
+  for (int idx = 0; idx < m->tlen; idx++)
+    starts[idx + 1] += starts[idx];
+
+  // Move each key and value into the next free spot for its bucket.
+  for (int i = 0; i < count; i++)
+  {
+    int idx = hashes[i] & (m->tlen - 1);
+    MapPair *pair = &pairs[starts[idx]++];
+    keys[i].move(&keys[i], &pair->key);
+    vals[i].move(&vals[i], &pair->val);
+    pair->hash = hashes[i];
+    m->ownedPairs += ownsMemory(pair);
+    if (valueIsInteger(&pair->key))
+      noteIntKey(m, pair->key.ival);
+  }
+
+  // Each bucket's pairs now end where the next one's start, so link them up.
+  int first = 0;
+  for (int idx = 0; idx < m->tlen; idx++)
+  {
+    int end = starts[idx];
+    m->table[idx] = first < end ? &pairs[first] : NULL;
+    for (int i = first; i < end; i++)
+      pairs[i].next = i + 1 < end ? &pairs[i + 1] : NULL;
+    first = end;
+  }
+  m->size = count;
+
+  free(hashes);
+  free(starts);
+
+  // Bring the indexes up to date with everything at once.
+  if (m->filter)
+    rebuildFilter(m, m->size > m->tlen ? m->size : m->tlen);
+  if (m->keyIndex)
+  {
+    for (int i = 0; i < count; i++)
+    {
+      char const *str = valueString(&pairs[i].key);
+      if (str)
+        radixInsert(m->keyIndex, str, &pairs[i]);
+    }
+  }
+  if (m->valIndex)
+  {
+    for (int i = 0; i < count; i++)
+      vindexAdd(m->valIndex, &pairs[i].val, &pairs[i].key);
+  }
+
+  if (canDense(m) && m->intKeys == m->size &&
+      (long long)m->maxKey - m->minKey + 1 <= m->size + DENSE_MIN)
+    enterDense(m);
+}
+
+/**
+  Helper function that moves a pair out of a block that's being compacted, into the
+  newest block, and packs its strings into the compaction's arena. Everything that
+  points at the pair is pointed at the new one: the link in its chain, the radix tree
+  and the reverse index.
+  @param m pointer to the map being compacted.
+  @param pair the pair to move, which is still in the table.
+*/
+static void movePair(Map *m, MapPair *pair)
+{
+  MapPair **link = &m->table[pair->hash & (m->tlen - 1)];
+  while (*link != pair)
+    link = &(*link)->next;
+
+  MapPair *moved = allocPair(m);
+  *moved = *pair;
+  *link = moved;
+  pair->key.empty = NULL;
+
+  if (m->valIndex)
+  {
+    vindexRemove(m->valIndex, &moved->val, &pair->key);
+    vindexAdd(m->valIndex, &moved->val, &moved->key);
+  }
+
+  // The tree compares against the old string, so the key comes out before it moves.
+  char const *str = valueString(&moved->key);
+  if (m->keyIndex && str)
+    radixRemove(m->keyIndex, str);
+  packString(&moved->key, m->arena);
+  packString(&moved->val, m->arena);
+  if (m->keyIndex && str)
+    radixInsert(m->keyIndex, valueString(&moved->key), moved);
+}
+
+/**
+  This function does the next part of a compaction of the map. The first call shrinks
+  the table if it's much too big, and starts moving every pair into one new block sized
+  for the pairs the map has now, with their strings packed one after another into an
+  arena. Each call looks at about count of the old pairs, so a big map can be compacted
+  a little at a time while it's still being used. Pairs added in the meantime go in new
+  blocks. Once every old pair has been moved, the old blocks are freed. Interned strings
+  are shared with the pool, so they stay where they are.
+  @param m pointer to the map to compact.
+  @param count about how many pairs to look at in this call.
+  @return true once the compaction is finished.
+*/
+bool mapCompact(Map *m, int count)
+{
+  if (m->disk)
+    return true;
+
+  // A snapshot may be pointing right at the pairs, so they can't move yet.
+  if (m->snap)
+    return false;
+
+  if (!m->oldBlocks)
+  {
+    shrinkTable(m);
+    if (!m->blocks)
+      return true;
+
+    m->oldBlocks = m->cblock = m->blocks;
+    m->cnext = 0;
+    m->blocks = NULL;
+    m->freePairs = NULL;
+    m->arena = makeArena();
+    if (m->size > 0)
+      addBlock(m, m->size);
+  }
+
+  while (m->cblock && count > 0)
+  {
+    if (m->cnext == m->cblock->used)
+    {
+      m->cblock = m->cblock->next;
+      m->cnext = 0;
+      continue;
+    }
+
+    MapPair *pair = &m->cblock->pairs[m->cnext++];
+    if (pair->key.empty)
+      movePair(m, pair);
+    count--;
+  }
+  if (m->cblock)
+    return false;
+
+  while (m->oldBlocks)
+  {
+    PairBlock *next = m->oldBlocks->next;
+    free(m->oldBlocks);
+    m->oldBlocks = next;
+  }
+  freeArena(m->arena);
+  m->arena = NULL;
+  return true;
+}
+
+/**
+  Helper function that puts the blocks of a compaction that didn't finish back with the
+  rest, so the map can be freed the usual way.
+  @param m pointer to the map.
+*/
+static void endCompaction(Map *m)
+{
+  PairBlock **tail = &m->blocks;
+  while (*tail)
+    tail = &(*tail)->next;
+  *tail = m->oldBlocks;
+  m->oldBlocks = NULL;
+  m->cblock = NULL;
+
+  if (m->arena)
+    freeArena(m->arena);
+  m->arena = NULL;
+}
+
+/**
+  This function calls the given function on every key/value pair in the map. The
+  pairs are visited in table order. The visitor must not add or remove keys.
+  @param m pointer to the map to walk through.
+  @param fn function called with each key, value and the data pointer.
+  @param data pointer passed along to every call of fn.
+*/
+void mapForEach(Map *m, MapVisitor fn, void *data)
+{
+  if (m->disk)
+  {
+    for (unsigned int idx = 0; idx < pmapBuckets(m->disk); idx++)
+      pmapVisitBucket(m->disk, idx, fn, data);
+    return;
+  }
+
+  if (m->dense)
+  {
+    // Make a key for each used slot to pass along.
+    Value key;
+    for (long long slot = 0; slot < m->dlen; slot++)
+    {
+      if (!denseHas(m->present, m->dlen, slot))
+        continue;
+      setInteger(&key, m->dbase + slot);
+      fn(&key, &m->dense[slot], data);
+    }
+    return;
+  }
+
+  for (int idx = 0; idx < m->tlen; idx++)
+  {
+    for (MapPair *currPairs = m->table[idx]; currPairs; currPairs = currPairs->next)
+      fn(&currPairs->key, &currPairs->val, data);
+  }
+}
+
+/**
+  Helper function that reverses the order of the bits in a cursor.
+  @param v the value to reverse.
+  @return v with bit 0 swapped with bit 31, bit 1 with bit 30 and so on.
+*/
+static unsigned int reverseBits(unsigned int v)
+{
+  v = ((v >> 1) & 0x55555555U) | ((v & 0x55555555U) << 1);
+  v = ((v >> 2) & 0x33333333U) | ((v & 0x33333333U) << 2);
+  v = ((v >> 4) & 0x0F0F0F0FU) | ((v & 0x0F0F0F0FU) << 4);
+  v = ((v >> 8) & 0x00FF00FFU) | ((v & 0x00FF00FFU) << 8);
+  return (v >> 16) | (v << 16);
+}
+
+/**
+  This function visits the next few buckets of an incremental scan over the map.
+  The cursor is advanced by incrementing its bits in reverse order. When the table
+  doubles, every bucket splits into buckets that extend its index with higher bits,
+  and those come after it in reverse-bit order; when it halves, buckets merge into
+  the one they share low bits with. Either way, a pair that stays in the map for the
+  whole scan is visited at least once, although some pairs can be visited twice.
+  @param m pointer to the map to scan.
+  @param cursor 0 to start a scan, or the value returned by the previous call.
+  @param count number of pairs to visit before stopping. Whole buckets are visited,
+  so a few more pairs than this may be passed to out, and the call also stops early
+  after looking at count * SCAN_BUCKETS buckets.
+  @param out function called with each key, value and the data pointer.
+  @param data pointer passed along to every call of out.
+  @return cursor to continue the scan with, or 0 when the scan is finished.
+*/
+unsigned int mapScan(Map *m, unsigned int cursor, int count, MapVisitor out, void *data)
+{
+  unsigned int mask = (m->disk ? pmapBuckets(m->disk) : m->tlen) - 1;
+  int visited = 0;
+  int buckets = 0;
+
+  do
+  {
+    if (m->dense)
+    {
+      // Integer keys hash to themselves, so the bucket holds the keys with the
+      // cursor's low bits. Visiting those keeps a scan valid across switches
+      // between dense mode and the hash table.
+      Value key;
+      long long end = (long long)m->dbase + m->dlen;
+      long long first = (long long)m->dbase + (long long)(((cursor & mask) - (unsigned int)m->dbase) & mask);
+      for (long long k = first; k < end; k += mask + 1)
+      {
+        if (!denseHas(m->present, m->dlen, k - m->dbase))
+          continue;
+        setInteger(&key, k);
+        out(&key, &m->dense[k - m->dbase], data);
+        visited++;
+      }
+    }
+
+    // Visit every pair in the bucket the cursor points at.
+    if (m->disk)
+      visited += pmapVisitBucket(m->disk, cursor & mask, out, data);
+    else
+    {
+      for (MapPair *currPairs = m->table[cursor & mask]; currPairs; currPairs = currPairs->next)
+      {
+        out(&currPairs->key, &currPairs->val, data);
+        visited++;
+      }
+    }
+
+    // Add one to the bits of the cursor that index the table, starting at the top.
+    cursor |= ~mask;
+    cursor = reverseBits(cursor);
+    cursor++;
+    cursor = reverseBits(cursor);
+    buckets++;
+  } while (cursor != 0 && visited < count && buckets < count * SCAN_BUCKETS);
+
+  return cursor;
+}
+
+/**
+  Helper function that passes a pair found in the radix tree on to the visitor
+  of a prefix query.
+  @param key the matching key string.
+  @param item the pair holding the key.
+  @param data the prefix query being answered.
+*/
+static void visitPrefixMatch(char const *key, void *item, void *data)
+{
+  PrefixQuery *query = data;
+  MapPair *pair = item;
+  query->fn(&pair->key, &pair->val, query->data);
+}
+
+/**
+  Helper function that passes a pair from a file map on to the visitor of a prefix
+  query if its key starts with the prefix.
+  @param key the key of the pair.
+  @param val the value of the pair.
+  @param data pointer to the PrefixQuery.
+*/
+static void visitDiskPrefix(Value const *key, Value const *val, void *data)
+{
+  PrefixQuery *query = data;
+  char const *str = valueString(key);
+  if (str && strncmp(str, query->prefix, strlen(query->prefix)) == 0)
+    query->fn(key, val, query->data);
+}
+
+/**
+  This function calls the given function on every pair whose key is a string
+  starting with the given prefix. If the map has a radix tree index, the matches
+  come out in sorted order and the time taken only depends on the length of the
+  prefix and the number of matches. Otherwise every pair in the table is checked.
+  @param m pointer to the map to search.
+  @param prefix the prefix the keys have to start with.
+  @param fn function called with each matching key, value and the data pointer.
+  @param data pointer passed along to every call of fn.
+*/
+void mapKeysWithPrefix(Map *m, char const *prefix, MapVisitor fn, void *data)
+{
+  if (m->keyIndex)
+  {
+    PrefixQuery query = {fn, data};
+    radixPrefix(m->keyIndex, prefix, visitPrefixMatch, &query);
+    return;
+  }
+
+  if (m->disk)
+  {
+    PrefixQuery query = {fn, data, prefix};
+    mapForEach(m, visitDiskPrefix, &query);
+    return;
+  }
+
+  // Without an index, every string key has to be checked.
+  int plen = strlen(prefix);
+  for (int idx = 0; idx < m->tlen; idx++)
+  {
+    for (MapPair *currPairs = m->table[idx]; currPairs; currPairs = currPairs->next)
+    {
+      char const *str = valueString(&currPairs->key);
+      if (str && strncmp(str, prefix, plen) == 0)
+        fn(&currPairs->key, &currPairs->val, data);
+    }
+  }
+}
+
+/**
+  Helper function that finds the pair a key is stored in. Only keys that live in a
+  pair can be passed, like the ones the reverse index is given, which are always the
+  key member of their pair.
+  @param key the key member of a pair.
+  @return the pair holding the key.
+*/
+static MapPair const *pairOfKey(Value const *key)
+{
+  return (MapPair const *)((char const *)key - offsetof(MapPair, key));
+}
+
+/**
+  Helper function that passes a key found in the reverse index on to the visitor of
+  a value query, along with the value in its pair.
+  @param key the key member of its pair.
+  @param val the index's copy of the value.
+  @param data pointer to the ValueQuery.
+*/
+static void visitValueMatch(Value const *key, Value const *val, void *data)
+{
+  ValueQuery *query = data;
+  MapPair const *pair = pairOfKey(key);
+  query->fn(&pair->key, &pair->val, query->data);
+}
+
+/**
+  Helper function that passes a pair on to the visitor of a value query if it holds
+  the value being looked for.
+  @param key the key of the pair.
+  @param val the value of the pair.
+  @param data pointer to the ValueQuery.
+*/
+static void visitValueCheck(Value const *key, Value const *val, void *data)
+{
+  ValueQuery *query = data;
+  if (val->equals(val, query->val))
+    query->fn(key, val, query->data);
+}
+
+/**
+  This function calls the given function on every pair holding the given value. If
+  the map has a reverse index, only the matching keys are looked at, in no
+  particular order. Otherwise every pair in the map is checked.
+  @param m pointer to the map to search.
+  @param val the value the pairs have to hold.
+  @param fn function called with each matching key, value and the data pointer.
+  @param data pointer passed along to every call of fn.
+*/
+void mapKeysOf(Map *m, Value const *val, MapVisitor fn, void *data)
+{
+  ValueQuery query = {fn, data, val};
+  if (m->valIndex)
+    vindexFind(m->valIndex, val, visitValueMatch, &query);
+  else
+    mapForEach(m, visitValueCheck, &query);
+}
+
+/**
+  This function opens a snapshot of the map, a read-only view of the pairs as they
+  are right now. The map can keep changing while the snapshot is open; the first
+  change to each bucket costs a copy of that bucket's chain, and the table won't
+  grow until the snapshot is released. Only one snapshot can be open on a map.
+  @param m pointer to the map to take a snapshot of.
+  @return the new snapshot, or NULL if the map already has one open or keeps its
+  pairs in a file.
+*/
+MapSnapshot *mapSnapshot(Map *m)
+{
+  if (m->snap || m->disk)
+    return NULL;
+
+  MapSnapshot *snap = calloc(1, sizeof(MapSnapshot));
+  snap->map = m;
+  snap->saved = calloc(m->tlen, sizeof(MapPair *));
+  snap->copied = calloc(m->tlen, sizeof(bool));
+  m->snap = snap;
+
+  // A dense array is copied all at once, it's just a block of memory.
+  if (m->dense)
+  {
+    snap->dense = malloc(m->dlen * sizeof(Value));
+    memcpy(snap->dense, m->dense, m->dlen * sizeof(Value));
+    snap->present = malloc(m->dlen / 64 * sizeof(uint64_t));
+    memcpy(snap->present, m->present, m->dlen / 64 * sizeof(uint64_t));
+    snap->dbase = m->dbase;
+    snap->dlen = m->dlen;
+  }
+  return snap;
+}
+
+/**
+  This function tells whether the map has a snapshot open.
+  @param m pointer to the map to check.
+  @return true if a snapshot is open.
+*/
+bool mapHasSnapshot(Map const *m)
+{
+  return m->snap != NULL;
+}
+
+/**
+  This function visits the next few buckets of a snapshot, seeing each one as it
+  was when the snapshot was taken. Calling it repeatedly walks the whole snapshot
+  a piece at a time, so it can be written out in between other work on the map.
+  @param snap pointer to the snapshot to walk.
+  @param count number of buckets to visit in this call.
+  @param fn function called with each key, value and the data pointer.
+  @param data pointer passed along to every call of fn.
+  @return true once every bucket has been visited.
+*/
+bool snapshotStep(MapSnapshot *snap, int count, MapVisitor fn, void *data)
+{
+  Map *m = snap->map;
+
+  // A snapshot of a dense map walks its copy, a slot standing in for a bucket.
+  if (snap->dense)
+  {
+    Value key;
+    for (; count > 0 && snap->next < snap->dlen; count--, snap->next++)
+    {
+      if (!denseHas(snap->present, snap->dlen, snap->next))
+        continue;
+      setInteger(&key, snap->dbase + snap->next);
+      fn(&key, &snap->dense[snap->next], data);
+    }
+    return snap->next >= snap->dlen;
+  }
+
+  for (; count > 0 && snap->next < m->tlen; count--, snap->next++)
+  {
+    // Use the saved copy of a bucket if it has changed.
+    MapPair *chain = snap->copied[snap->next] ? snap->saved[snap->next] : m->table[snap->next];
+    for (MapPair *currPairs = chain; currPairs; currPairs = currPairs->next)
+      fn(&currPairs->key, &currPairs->val, data);
+  }
+  return snap->next >= m->tlen;
+}
+
+/**
+  This function closes a snapshot. The saved bucket copies are freed, along with
+  any keys and values the map dropped while the snapshot was open, and the table
+  gets the chance to grow if it was held back.
+  @param snap pointer to the snapshot to release.
+*/
+void releaseSnapshot(MapSnapshot *snap)
+{
+  Map *m = snap->map;
+  for (int idx = 0; idx < m->tlen; idx++)
+  {
+    MapPair *currPairs = snap->saved[idx];
+    while (currPairs)
+    {
+      MapPair *next = currPairs->next;
+      free(currPairs);
+      currPairs = next;
+    }
+  }
+
+  for (int i = 0; i < snap->dcount; i++)
+    snap->dropped[i].empty(&snap->dropped[i]);
+
+  free(snap->dropped);
+  free(snap->dense);
+  free(snap->present);
+  free(snap->saved);
+  free(snap->copied);
+  free(snap);
+  m->snap = NULL;
+
+  // Catch up on any growth that was put off.
+  int len = m->tlen;
+  while (m->size > len * MAX_LOAD)
+    len *= 2;
+  if (len > m->tlen)
+    resizeTable(m, len);
+}
+
+/**
+  This function is responsible for freeing all of the memory that is used
+  to store the provided map. In this process, it includes freeing the memory
+  for the hash table and all of the map pairs. The pairs are freed a whole block
+  at a time. They only have to be looked at one by one if some of them hold keys
+  or values with memory of their own, and then they're visited in the order
+  they sit in memory instead of by following the hash chains.
+  @param m pointer to the map that needs to be freed.
+*/
+void freeMap(Map *m)
+{
+  // Everything in a file map stays in its file.
+  if (m->disk)
+  {
+    resetFound(m, 0);
+    free(m->found);
+    closePMap(m->disk);
+    free(m);
+    return;
+  }
+
+  if (m->snap)
+    releaseSnapshot(m->snap);
+  if (m->dense)
+    freeDense(m);
+  endCompaction(m);
+
+  PairBlock *block = m->blocks;
+  while (block)
+  {
+    PairBlock *next = block->next;
+
+    // Free memory for each key and value that is still in use.
+    for (int i = 0; m->ownedPairs > 0 && i < block->used; i++)
+    {
+      MapPair *pair = &block->pairs[i];
+      if (pair->key.empty)
+      {
+        m->ownedPairs -= ownsMemory(pair);
+        pair->key.empty(&pair->key);
+        pair->val.empty(&pair->val);
+      }
+    }
+
+    free(block);
+    block = next;
+  }
+
+  // Hash table, indexes and map are freed.
+  if (m->filter)
+    freeBloom(m->filter);
+  if (m->keyIndex)
+    freeRadix(m->keyIndex);
+  if (m->valIndex)
+    freeValueIndex(m->valIndex);
+  if (m->strings)
+    freePool(m->strings);
+  free(m->table);
+  free(m);
+}
+
+/**
+  This function frees part of a map that's no longer in use. The dense array is
+  emptied from the end, then each pair block from its last pair down, so nothing
+  has to remember where the last call stopped. String keys come out of the radix
+  tree and pairs out of the reverse index as they go, which leaves no big index
+  to free at the end. Once the pairs
+  are gone, what's left is freed in one go.
+  @param m pointer to the map to free.
+  @param count about how many pairs to free in this call.
+  @return true once the whole map has been freed.
+*/
+bool freeMapStep(Map *m, int count)
+{
+  // The snapshot may still need the map's values.
+  if (m->snap)
+    return false;
+  endCompaction(m);
+
+  while (m->dense && count > 0)
+  {
+    long long slot = --m->dlen;
+    if (denseHas(m->present, slot + 1, slot) && !valueIsInline(&m->dense[slot]))
+    {
+      m->ownedPairs--;
+      m->dense[slot].empty(&m->dense[slot]);
+    }
+    count--;
+
+    if (m->dlen == 0)
+      freeDense(m);
+  }
+
+  while (m->blocks && count > 0)
+  {
+    PairBlock *block = m->blocks;
+    if (block->used == 0 || (m->ownedPairs == 0 && !m->valIndex))
+    {
+      m->blocks = block->next;
+      free(block);
+      continue;
+    }
+
+    MapPair *pair = &block->pairs[--block->used];
+    if (pair->key.empty)
+    {
+      char const *str = valueString(&pair->key);
+      if (m->keyIndex && str)
+        radixRemove(m->keyIndex, str);
+      if (m->valIndex)
+        vindexRemove(m->valIndex, &pair->val, &pair->key);
+      m->ownedPairs -= ownsMemory(pair);
+      pair->key.empty(&pair->key);
+      pair->val.empty(&pair->val);
+    }
+    count--;
+  }
+
+  if (m->dense || m->blocks)
+    return false;
+
+  // Only the table and the empty indexes are left.
+  freeMap(m);
+  return true;
+}
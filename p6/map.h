@@ -13,12 +13,88 @@
 /** Incomplete type for the Map representation. */
 typedef struct MapStruct Map;
 
+/** Incomplete type for a point-in-time snapshot of a map. */
+typedef struct MapSnapshotStruct MapSnapshot;
+
+/** Type for a function called on each key/value pair while walking over a map.
+    @param key Key of the pair, still owned by the map.
+    @param val Value of the pair, still owned by the map.
+    @param data Pointer given by the caller of the walk.
+*/
+typedef void (*MapVisitor)(Value const *key, Value const *val, void *data);
+
+/** Type for a function told about each change made to a map.
+    @param key Key that was set or removed, not owned by the function.
+    @param val Value the key was set to, or NULL if the key was removed.
+    @param data Pointer given to mapObserve.
+*/
+typedef void (*MapObserver)(Value const *key, Value const *val, void *data);
+
 /** Make an empty map.
     @param len Initial length of the hash table.
     @return pointer to a new map.
 */
 Map *makeMap(int len);
 
+/** Open a map stored in a memory-mapped file, creating the file if it
+    doesn't exist.  The map's contents stay in the file after it's freed.
+    Values returned by lookups on this map are only good until the next
+    lookup, and snapshots of it can't be taken.
+    @param path Name of the file holding the map.
+    @return pointer to the map, or NULL if the file couldn't be opened.
+*/
+Map *openMap(char const *path);
+
+/** Have a function called for every key the map sets or removes, such as
+    one that passes the changes along to a copy of the map.
+    @param m Map to watch.
+    @param fn Function to call for each change, or NULL to stop.
+    @param data Pointer passed to each call of fn.
+*/
+void mapObserve(Map *m, MapObserver fn, void *data);
+
+/** Write every change made to a map opened with openMap out to its file,
+    waiting until the writes are done.  Does nothing for other maps.
+    @param m Map to write out.
+*/
+void mapCheckpoint(Map *m);
+
+/** Turn on a Bloom filter for the given map, so lookups and removes
+    for keys that aren't in the map can usually skip the hash chain.
+    @param m Map that should use a filter.
+*/
+void mapUseFilter(Map *m);
+
+/** Turn on a radix tree index over the string keys of the given map,
+    so mapKeysWithPrefix can find matching keys without a full walk.
+    @param m Map that should index its keys.
+*/
+void mapIndexKeys(Map *m);
+
+/** Turn on a reverse index from values to the keys holding them for the
+    given map, so mapKeysOf doesn't need a full walk.  The index is off by
+    default; while it's on, the map never switches to a dense array.
+    @param m Map that should index its values.
+*/
+void mapIndexValues(Map *m);
+
+/** Give the given map its own string pool.  String keys and values added
+    from then on share one copy of each distinct string, and keys compare
+    by pointer, including the keys that are looked up.  If the map is empty
+    when this is called, a lookup for a string the pool doesn't have is a
+    miss right away.
+    @param m Map that should intern its strings.
+*/
+void mapInternStrings(Map *m);
+
+/** Have the given map compress string values that are at least a given
+    length.  They're decompressed when they're printed, a few at a time.
+    Maps kept in a file don't compress their values.
+    @param m Map that should compress its values.
+    @param threshold Shortest value worth compressing.
+*/
+void mapCompressValues(Map *m, int threshold);
+
 /** Get the size of the given map.
     @param m Pointer to the map.
     @return Number of key/value pairs in the map. */
@@ -42,6 +118,16 @@ void mapSet(Map *m, Value *key, Value *val);
 */
 Value *mapGet(Map *m, Value *key);
 
+/** Look up a batch of keys at once, overlapping the cache misses of the
+    different lookups.  The returned Values are still owned by the map.
+    @param m Map to query.
+    @param keys Array of keys to look for.
+    @param count Number of keys in the array.
+    @param vals Array filled in with the value for each key, or NULL for
+    keys that aren't in the map.
+*/
+void mapGetBatch(Map *m, Value *keys, int count, Value **vals);
+
 /** Remove a key / value pair from the given map.
     @param m Map to remove a key from
     @param k Key to look for and remove in the map.
@@ -50,10 +136,117 @@ Value *mapGet(Map *m, Value *key);
 */
 bool mapRemove(Map *m, Value *key);
 
+/** Call a function on every key/value pair in the map.  The function
+    must not change the map.
+    @param m Map to walk over.
+    @param fn Function to call for each pair.
+    @param data Pointer passed to each call of fn.
+*/
+void mapForEach(Map *m, MapVisitor fn, void *data);
+
+/** Visit the next part of an incremental scan over the map.  The map can
+    be changed between calls; every pair that is in the map for the whole
+    scan is visited at least once, but some may be visited more than once.
+    @param m Map to scan.
+    @param cursor 0 to start a scan, or the cursor returned by the last call.
+    @param count About how many pairs to visit in this call.
+    @param out Function to call for each pair visited.
+    @param data Pointer passed to each call of out.
+    @return cursor for the next call, or 0 if the scan is complete.
+*/
+unsigned int mapScan(Map *m, unsigned int cursor, int count, MapVisitor out, void *data);
+
+/** Get a map ready to hold at least the given number of pairs, so adding
+    that many won't need to resize the table or allocate more pair storage.
+    @param m Map to get ready.
+    @param count Number of pairs the map should be able to hold.
+*/
+void mapReserve(Map *m, int count);
+
+/** Fill an empty map from arrays of keys and values in one pass, without
+    comparing any keys.  The map takes ownership of all the keys and
+    values.  If the map isn't empty, they are just added with mapSet.
+    @param m Map to fill.
+    @param keys Keys to add, which must all be different.
+    @param vals Values to add, vals[i] goes with keys[i].
+    @param count Number of keys and values.
+*/
+void mapBuild(Map *m, Value *keys, Value *vals, int count);
+
+/** Call a function on every pair whose key is a string starting with the
+    given prefix.  If the map indexes its keys, they are visited in sorted
+    order.  The function must not change the map.
+    @param m Map to search.
+    @param prefix Prefix the keys have to start with.
+    @param fn Function to call for each matching pair.
+    @param data Pointer passed to each call of fn.
+*/
+void mapKeysWithPrefix(Map *m, char const *prefix, MapVisitor fn, void *data);
+
+/** Call a function on every pair holding the given value.  The function
+    must not change the map.
+    @param m Map to search.
+    @param val Value the pairs have to hold.
+    @param fn Function to call for each matching pair.
+    @param data Pointer passed to each call of fn.
+*/
+void mapKeysOf(Map *m, Value const *val, MapVisitor fn, void *data);
+
+/** Open a read-only snapshot of the map as it is right now.  The map can
+    still be changed while the snapshot is open.
+    @param m Map to take a snapshot of.
+    @return the snapshot, or NULL if the map already has one open or is
+    stored in a file.
+*/
+MapSnapshot *mapSnapshot(Map *m);
+
+/** Tell whether the map has a snapshot open, in which case another one
+    can't be taken until it's released.
+    @param m Map to check.
+    @return true if a snapshot is open.
+*/
+bool mapHasSnapshot(Map const *m);
+
+/** Visit the next few buckets of a snapshot, seeing the pairs as they were
+    when the snapshot was taken.
+    @param snap Snapshot to walk.
+    @param count Number of buckets to visit.
+    @param fn Function to call for each pair.
+    @param data Pointer passed to each call of fn.
+    @return true once the whole snapshot has been visited.
+*/
+bool snapshotStep(MapSnapshot *snap, int count, MapVisitor fn, void *data);
+
+/** Close a snapshot and free the memory it was holding on to.
+    @param snap The snapshot to release.
+*/
+void releaseSnapshot(MapSnapshot *snap);
+
+/** Do the next part of compacting a map, moving its pairs into one new
+    block and their strings into an arena, so memory freed by removes goes
+    back to the system and the pairs that are left sit close together.
+    The map can still be used between calls.  Nothing is moved while a
+    snapshot of the map is open.
+    @param m Map to compact.
+    @param count About how many pairs to look at in this call.
+    @return true once the compaction is finished.
+*/
+bool mapCompact(Map *m, int count);
+
 /** Free all the memory used to store a map, including all the
     memory in its key/value pairs.
     @param m The map to free.
 */
 void freeMap(Map *m);
 
+/** Free part of a map that's no longer being used, so a large map can be
+    freed a little at a time.  The map can't be used for anything else once
+    this has been called.  Nothing is freed while a snapshot of the map is
+    still open.
+    @param m The map to free.
+    @param count About how many pairs to free in this call.
+    @return true once the whole map has been freed.
+*/
+bool freeMapStep(Map *m, int count);
+
 #endif
\ No newline at end of file
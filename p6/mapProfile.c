@@ -0,0 +1,354 @@
+/**
+    @file mapProfile.c
+    @author Shlok Dave (ssdave)
+    Profiling harness for the map component.  It runs a workload of sets,
+    gets and removes and reports hardware counters for each kind of
+    operation, read through perf_event_open.  Counters the kernel won't give
+    us are left out, so it still reports times in a restricted container.
+
+    usage: mapProfile [-s] [-n pairs] [-l lookups] [-h hit-percent]
+                      [-t table-length] [-f]
+*/
+
+#define _GNU_SOURCE
+
+#include "map.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/** Number of counters the harness tries to open. */
+#define COUNTERS 5
+
+/** Number of keys looked up at a time for the batched gets. */
+#define BATCH 64
+
+/** Length of the string keys' buffers. */
+#define KEY_LEN 24
+
+/** One hardware counter. */
+typedef struct
+{
+  /** Name printed in the report. */
+  char const *name;
+
+  /** perf_event type of the counter. */
+  uint32_t type;
+
+  /** perf_event config of the counter. */
+  uint64_t config;
+
+  /** Descriptor for the counter, or -1 if it couldn't be opened. */
+  int fd;
+} Counter;
+
+/** The counters, in the order they're reported. */
+static Counter counters[COUNTERS] = {
+  {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1},
+  {"instrs", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1},
+  {"L1d-miss", PERF_TYPE_HW_CACHE,
+   PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), -1},
+  {"LLC-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, -1},
+  {"br-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, -1},
+};
+
+/** What one measured phase cost. */
+typedef struct
+{
+  /** Nanoseconds the phase took. */
+  double ns;
+
+  /** Value of each counter over the phase, if it's open. */
+  uint64_t counts[COUNTERS];
+} Sample;
+
+/** Settings for a run. */
+typedef struct
+{
+  /** True for string keys, false for integer keys. */
+  bool strings;
+
+  /** Number of pairs put in the map. */
+  int pairs;
+
+  /** Number of lookups done. */
+  int lookups;
+
+  /** Percent of the lookups that are for keys in the map. */
+  int hits;
+
+  /** Length the map's table starts with. */
+  int tlen;
+
+  /** True if the map uses a Bloom filter. */
+  bool filter;
+} Workload;
+
+/**
+  Helper function that opens one counter for this thread, counting only user-space
+  work. It starts out disabled.
+  @param c the counter to open.
+*/
+static void openCounter(Counter *c)
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = c->type;
+  attr.config = c->config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  c->fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/**
+  Helper function that gives the current time in nanoseconds.
+  @return nanoseconds on the monotonic clock.
+*/
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+  Helper function that zeroes and starts every open counter, then the clock.
+  @param s the sample that's starting.
+*/
+static void startSample(Sample *s)
+{
+  for (int i = 0; i < COUNTERS; i++)
+  {
+    if (counters[i].fd >= 0)
+    {
+      ioctl(counters[i].fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(counters[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+  s->ns = now();
+}
+
+/**
+  Helper function that stops the clock and every open counter, and keeps their values.
+  @param s the sample that's ending.
+*/
+static void endSample(Sample *s)
+{
+  s->ns = now() - s->ns;
+  for (int i = 0; i < COUNTERS; i++)
+  {
+    s->counts[i] = 0;
+    if (counters[i].fd >= 0)
+    {
+      ioctl(counters[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+      if (read(counters[i].fd, &s->counts[i], sizeof(uint64_t)) != sizeof(uint64_t))
+        s->counts[i] = 0;
+    }
+  }
+}
+
+/**
+  Helper function that prints a sample as costs per operation.
+  @param name name of the operation.
+  @param s the sample.
+  @param ops number of operations in the sample.
+*/
+static void report(char const *name, Sample const *s, int ops)
+{
+  printf("%-10s %10.1f", name, s->ns / ops);
+  for (int i = 0; i < COUNTERS; i++)
+  {
+    if (counters[i].fd >= 0)
+      printf(" %10.2f", (double)s->counts[i] / ops);
+    else
+      printf(" %10s", "-");
+  }
+  printf("\n");
+}
+
+/**
+  Helper function that makes the key with the given number.
+  @param v the value to fill in.
+  @param n number of the key.
+  @param strings true for a string key, false for an integer one.
+*/
+static void makeKey(Value *v, int n, bool strings)
+{
+  char buffer[KEY_LEN];
+  if (strings)
+    snprintf(buffer, sizeof(buffer), "\"key:%d\"", n);
+  else
+    snprintf(buffer, sizeof(buffer), "%d", n);
+  if (strings)
+    parseString(v, buffer);
+  else
+    parseInteger(v, buffer);
+}
+
+/**
+  Helper function that picks the next number from a simple random sequence, so
+  every run with the same settings does the same lookups.
+  @param state the sequence's state.
+  @return the next number.
+*/
+static uint32_t nextRandom(uint32_t *state)
+{
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+/**
+  Helper function that reads the command line into a workload.
+  @param argc number of arguments.
+  @param argv the arguments.
+  @param w the workload to fill in.
+  @return true if the arguments made sense.
+*/
+static bool parseArgs(int argc, char *argv[], Workload *w)
+{
+  int opt;
+  while ((opt = getopt(argc, argv, "sn:l:h:t:f")) != -1)
+  {
+    if (opt == 's')
+      w->strings = true;
+    else if (opt == 'n')
+      w->pairs = atoi(optarg);
+    else if (opt == 'l')
+      w->lookups = atoi(optarg);
+    else if (opt == 'h')
+      w->hits = atoi(optarg);
+    else if (opt == 't')
+      w->tlen = atoi(optarg);
+    else if (opt == 'f')
+      w->filter = true;
+    else
+      return false;
+  }
+  return optind == argc && w->pairs > 0 && w->lookups > 0 && w->hits >= 0 &&
+         w->hits <= 100 && w->tlen > 0;
+}
+
+/**
+  Starting point for the harness. It builds the map with one set per pair, looks
+  keys up one at a time and then in batches, and finally removes every pair, with
+  a sample taken around each phase.
+  @param argc number of arguments.
+  @param argv the arguments.
+  @return exit status.
+*/
+int main(int argc, char *argv[])
+{
+  Workload w = {false, 100000, 1000000, 90, 16, false};
+  if (!parseArgs(argc, argv, &w))
+  {
+    fprintf(stderr, "usage: mapProfile [-s] [-n pairs] [-l lookups] [-h hit-percent] "
+                    "[-t table-length] [-f]\n");
+    return EXIT_FAILURE;
+  }
+
+  int opened = 0;
+  for (int i = 0; i < COUNTERS; i++)
+  {
+    openCounter(&counters[i]);
+    opened += counters[i].fd >= 0;
+  }
+  if (opened == 0)
+    fprintf(stderr, "mapProfile: hardware counters aren't available, reporting times only\n");
+
+  // Make every key ahead of time, so only the map's own work is measured.
+  Value *keys = malloc(w.pairs * sizeof(Value));
+  Value *vals = malloc(w.pairs * sizeof(Value));
+  for (int i = 0; i < w.pairs; i++)
+  {
+    makeKey(&keys[i], i, w.strings);
+    makeKey(&vals[i], i, false);
+  }
+
+  // Hits are keys that were added, and misses come from a range that never is.
+  uint32_t state = 2463534242u;
+  Value *probes = malloc(w.lookups * sizeof(Value));
+  for (int i = 0; i < w.lookups; i++)
+  {
+    int n = nextRandom(&state) % w.pairs;
+    bool hit = (int)(nextRandom(&state) % 100) < w.hits;
+    makeKey(&probes[i], hit ? n : w.pairs + n, w.strings);
+  }
+  Value *removes = malloc(w.pairs * sizeof(Value));
+  for (int i = 0; i < w.pairs; i++)
+    makeKey(&removes[i], i, w.strings);
+
+  Map *m = makeMap(w.tlen);
+  if (w.filter)
+    mapUseFilter(m);
+
+  printf("%s keys, %d pairs, %d lookups, %d%% hits, table %d%s\n",
+         w.strings ? "string" : "integer", w.pairs, w.lookups, w.hits, w.tlen,
+         w.filter ? ", filter" : "");
+  printf("%-10s %10s", "op", "ns");
+  for (int i = 0; i < COUNTERS; i++)
+    printf(" %10s", counters[i].name);
+  printf("\n");
+
+  Sample s;
+  startSample(&s);
+  for (int i = 0; i < w.pairs; i++)
+    mapSet(m, &keys[i], &vals[i]);
+  endSample(&s);
+  report("set", &s, w.pairs);
+
+  // Count the hits, so the lookups can't be optimized away.
+  int found = 0;
+  startSample(&s);
+  for (int i = 0; i < w.lookups; i++)
+    found += mapGet(m, &probes[i]) != NULL;
+  endSample(&s);
+  report("get", &s, w.lookups);
+
+  Value *results[BATCH];
+  startSample(&s);
+  for (int i = 0; i < w.lookups; i += BATCH)
+  {
+    int count = w.lookups - i < BATCH ? w.lookups - i : BATCH;
+    mapGetBatch(m, &probes[i], count, results);
+    for (int j = 0; j < count; j++)
+      found += results[j] != NULL;
+  }
+  endSample(&s);
+  report("getBatch", &s, w.lookups);
+
+  startSample(&s);
+  for (int i = 0; i < w.pairs; i++)
+    found += mapRemove(m, &removes[i]);
+  endSample(&s);
+  report("remove", &s, w.pairs);
+  printf("%d keys found\n", found);
+
+  for (int i = 0; i < w.lookups; i++)
+    probes[i].empty(&probes[i]);
+  for (int i = 0; i < w.pairs; i++)
+    removes[i].empty(&removes[i]);
+  free(keys);
+  free(vals);
+  free(probes);
+  free(removes);
+  freeMap(m);
+
+  for (int i = 0; i < COUNTERS; i++)
+  {
+    if (counters[i].fd >= 0)
+      close(counters[i].fd);
+  }
+  return EXIT_SUCCESS;
+}
@@ -8,6 +8,29 @@
 #include "value.h"
 #include "map.h"
 
+// Scan visitor that records which of the small integer keys it saw.
+static void markSeen( Value const *key, Value const *val, void *data )
+{
+  int *seen = data;
+  if ( key->ival >= 0 && key->ival < 20 )
+    seen[ key->ival ] = 1;
+}
+
+// Visitor that counts the pairs it's called for.
+static void countPair( Value const *key, Value const *val, void *data )
+{
+  ( *(int *) data )++;
+}
+
+// Snapshot visitor that adds up the keys and values it sees.
+static void sumPair( Value const *key, Value const *val, void *data )
+{
+  int *sums = data;
+  sums[ 0 ] += key->ival;
+  sums[ 1 ] += val->ival;
+  sums[ 2 ]++;
+}
+
 int main()
 {
   // Make a few values we use below.
@@ -68,6 +91,452 @@ int main()
   // Free our maps.
   freeMap( map );
 
+  // Same kind of checks on a small map that uses a Bloom filter, with
+  // enough keys to make the filter grow and enough removes to rebuild it.
+  map = makeMap( 3 );
+  mapUseFilter( map );
+  for ( int i = 0; i < 50; i++ ) {
+    char buffer[ 20 ];
+    sprintf( buffer, "%d", i * 7 );
+    parseInteger( &key, buffer );
+    parseInteger( &val, buffer );
+    mapSet( map, &key, &val );
+  }
+  assert( mapSize( map ) == 50 );
+
+  for ( int i = 0; i < 50; i += 2 ) {
+    char buffer[ 20 ];
+    sprintf( buffer, "%d", i * 7 );
+    parseInteger( &key, buffer );
+    assert( mapRemove( map, &key ) );
+  }
+  assert( mapSize( map ) == 25 );
+
+  for ( int i = 0; i < 50; i++ ) {
+    char buffer[ 20 ];
+    sprintf( buffer, "%d", i * 7 );
+    parseInteger( &key, buffer );
+    v = mapGet( map, &key );
+    assert( i % 2 == 0 ? v == NULL : key.equals( &key, v ) );
+  }
+
+  // Keys that were never added still aren't found.
+  assert( mapGet( map, &v5 ) == NULL );
+  assert( mapRemove( map, &v5 ) == false );
+  freeMap( map );
+
+  // Scan part of a map, grow it a lot, then finish the scan.  Every
+  // key that was there the whole time must show up.
+  map = makeMap( 4 );
+  for ( int i = 0; i < 20; i++ ) {
+    char buffer[ 20 ];
+    sprintf( buffer, "%d", i );
+    parseInteger( &key, buffer );
+    parseInteger( &val, buffer );
+    mapSet( map, &key, &val );
+  }
+
+  int seen[ 20 ] = { 0 };
+  unsigned int cursor = mapScan( map, 0, 5, markSeen, seen );
+  for ( int i = 100; i < 300; i++ ) {
+    char buffer[ 20 ];
+    sprintf( buffer, "%d", i );
+    parseInteger( &key, buffer );
+    parseInteger( &val, buffer );
+    mapSet( map, &key, &val );
+  }
+  while ( cursor != 0 )
+    cursor = mapScan( map, cursor, 5, markSeen, seen );
+  for ( int i = 0; i < 20; i++ )
+    assert( seen[ i ] );
+
+  // Scanning a packed map with negative keys still visits all of them.
+  Map *neg = makeMap( 4 );
+  int negSeen = 0;
+  for ( int i = -5; i < 5; i++ ) {
+    char buffer[ 20 ];
+    sprintf( buffer, "%d", i );
+    parseInteger( &key, buffer );
+    parseInteger( &val, buffer );
+    mapSet( neg, &key, &val );
+  }
+  cursor = 0;
+  do
+    cursor = mapScan( neg, cursor, 100, countPair, &negSeen );
+  while ( cursor != 0 );
+  assert( negSeen == 10 );
+  freeMap( neg );
+
+  // Walking the whole map visits every pair exactly once.
+  int total = 0;
+  mapForEach( map, countPair, &total );
+  assert( total == 220 );
+  freeMap( map );
+
+  // Build a map in one pass from arrays of string keys and integer values.
+  Value keys[ 100 ], vals[ 100 ];
+  for ( int i = 0; i < 100; i++ ) {
+    char buffer[ 20 ];
+    sprintf( buffer, "\"k%d\"", i );
+    parseString( &keys[ i ], buffer );
+    sprintf( buffer, "%d", i );
+    parseInteger( &vals[ i ], buffer );
+  }
+  map = makeMap( 4 );
+  mapUseFilter( map );
+  mapIndexKeys( map );
+  mapReserve( map, 100 );
+  mapBuild( map, keys, vals, 100 );
+  assert( mapSize( map ) == 100 );
+
+  for ( int i = 0; i < 100; i++ ) {
+    char buffer[ 20 ];
+    sprintf( buffer, "\"k%d\"", i );
+    parseString( &key, buffer );
+    v = mapGet( map, &key );
+    assert( v && v->ival == i );
+    if ( i % 3 == 0 )
+      assert( mapRemove( map, &key ) );
+    key.empty( &key );
+  }
+  assert( mapSize( map ) == 66 );
+
+  // Look up a batch of keys, some of them removed, all at once.
+  Value *found[ 100 ];
+  for ( int i = 0; i < 100; i++ ) {
+    char buffer[ 20 ];
+    sprintf( buffer, "\"k%d\"", i );
+    parseString( &keys[ i ], buffer );
+  }
+  mapGetBatch( map, keys, 100, found );
+  for ( int i = 0; i < 100; i++ ) {
+    assert( i % 3 == 0 ? found[ i ] == NULL : found[ i ]->ival == i );
+    keys[ i ].empty( &keys[ i ] );
+  }
+
+  // Removed pairs get reused by later sets.
+  parseString( &key, "\"k0\"" );
+  mapSet( map, &key, &v15 );
+  assert( mapSize( map ) == 67 );
+  freeMap( map );
+
+  // Take a snapshot, then change the map a lot while walking it.
+  map = makeMap( 4 );
+  for ( int i = 0; i < 10; i++ ) {
+    char buffer[ 20 ];
+    sprintf( buffer, "%d", i );
+    parseInteger( &key, buffer );
+    parseInteger( &val, buffer );
+    mapSet( map, &key, &val );
+  }
+  MapSnapshot *snap = mapSnapshot( map );
+  assert( snap );
+  assert( mapSnapshot( map ) == NULL );
+
+  int sums[ 3 ] = { 0, 0, 0 };
+  assert( ! snapshotStep( snap, 1, sumPair, sums ) );
+  for ( int i = 0; i < 10; i++ ) {
+    char buffer[ 20 ];
+    sprintf( buffer, "%d", i );
+    parseInteger( &key, buffer );
+    if ( i % 2 ) {
+      assert( mapRemove( map, &key ) );
+    } else {
+      parseInteger( &val, "100" );
+      mapSet( map, &key, &val );
+    }
+  }
+  for ( int i = 50; i < 100; i++ ) {
+    char buffer[ 20 ];
+    sprintf( buffer, "%d", i );
+    parseInteger( &key, buffer );
+    parseInteger( &val, buffer );
+    mapSet( map, &key, &val );
+  }
+  assert( mapHasSnapshot( map ) && mapSnapshot( map ) == NULL );
+  while ( ! snapshotStep( snap, 1, sumPair, sums ) )
+    ;
+
+  // The snapshot only saw the map from before the changes.
+  assert( sums[ 0 ] == 45 && sums[ 1 ] == 45 && sums[ 2 ] == 10 );
+  releaseSnapshot( snap );
+  assert( ! mapHasSnapshot( map ) );
+  assert( mapSize( map ) == 55 );
+  v = mapGet( map, &v10 );
+  assert( v == NULL );
+  parseInteger( &key, "4" );
+  v = mapGet( map, &key );
+  assert( v && v->ival == 100 );
+  freeMap( map );
+
+  // Small packed integer keys, then keys that spread out and a string key,
+  // all have to look the same from the outside.
+  map = makeMap( 4 );
+  mapUseFilter( map );
+  for ( int i = -30; i < 170; i++ ) {
+    char buffer[ 20 ];
+    sprintf( buffer, "%d", i );
+    parseInteger( &key, buffer );
+    parseInteger( &val, buffer );
+    mapSet( map, &key, &val );
+  }
+  assert( mapSize( map ) == 200 );
+  total = 0;
+  mapForEach( map, countPair, &total );
+  assert( total == 200 );
+
+  memset( seen, 0, sizeof( seen ) );
+  cursor = mapScan( map, 0, 7, markSeen, seen );
+  parseInteger( &key, "1000000" );
+  parseInteger( &val, "1" );
+  mapSet( map, &key, &val );
+  while ( cursor != 0 )
+    cursor = mapScan( map, cursor, 7, markSeen, seen );
+  for ( int i = 0; i < 20; i++ )
+    assert( seen[ i ] );
+  assert( mapRemove( map, &v5 ) );
+  assert( mapGet( map, &v5 ) == NULL );
+
+  parseString( &key, "\"k\"" );
+  parseInteger( &val, "2" );
+  mapSet( map, &key, &val );
+  assert( mapSize( map ) == 201 );
+  parseInteger( &key, "-30" );
+  v = mapGet( map, &key );
+  assert( v && v->ival == -30 );
+  for ( int i = 0; i < 100; i++ ) {
+    char buffer[ 20 ];
+    sprintf( buffer, "%d", i );
+    parseInteger( &key, buffer );
+    mapRemove( map, &key );
+  }
+  parseString( &key, "\"k\"" );
+  v = mapGet( map, &key );
+  assert( v && v->ival == 2 );
+  key.empty( &key );
+  freeMap( map );
+
+  // Lookups in a map that interns its strings go through the pool, and a string
+  // the pool has never seen is missing even from a map with a pool added late.
+  for ( int late = 0; late < 2; late++ ) {
+    map = makeMap( 4 );
+    if ( late ) {
+      parseString( &key, "\"early\"" );
+      parseInteger( &val, "1" );
+      mapSet( map, &key, &val );
+    }
+    mapInternStrings( map );
+    parseString( &key, "\"name\"" );
+    parseString( &val, "\"value\"" );
+    mapSet( map, &key, &val );
+
+    Value probes[ 4 ];
+    Value *hits[ 4 ];
+    parseString( &probes[ 0 ], "\"name\"" );
+    parseString( &probes[ 1 ], "\"value\"" );
+    parseString( &probes[ 2 ], "\"nope\"" );
+    parseString( &probes[ 3 ], "\"early\"" );
+    mapGetBatch( map, probes, 4, hits );
+    assert( hits[ 0 ] && mapGet( map, &probes[ 0 ] ) == hits[ 0 ] );
+    assert( hits[ 1 ] == NULL && hits[ 2 ] == NULL && mapGet( map, &probes[ 2 ] ) == NULL );
+    assert( ( hits[ 3 ] != NULL ) == late && ( mapGet( map, &probes[ 3 ] ) != NULL ) == late );
+    assert( ! mapRemove( map, &probes[ 2 ] ) && mapRemove( map, &probes[ 0 ] ) );
+    assert( mapGet( map, &probes[ 0 ] ) == NULL );
+    for ( int i = 0; i < 4; i++ )
+      probes[ i ].empty( &probes[ i ] );
+    freeMap( map );
+  }
+
+  // Free a map with string and integer pairs a little at a time.
+  map = makeMap( 4 );
+  mapIndexKeys( map );
+  mapInternStrings( map );
+  for ( int i = 0; i < 300; i++ ) {
+    char buffer[ 20 ];
+    sprintf( buffer, "\"k%d\"", i );
+    parseString( &key, buffer );
+    sprintf( buffer, "\"v%d\"", i % 7 );
+    parseString( &val, buffer );
+    mapSet( map, &key, &val );
+  }
+  int steps = 1;
+  while ( ! freeMapStep( map, 16 ) )
+    steps++;
+  assert( steps > 10 );
+
+  // Same for a map in dense mode.
+  map = makeMap( 4 );
+  for ( int i = 0; i < 100; i++ ) {
+    char buffer[ 20 ];
+    sprintf( buffer, "%d", i );
+    parseInteger( &key, buffer );
+    sprintf( buffer, "\"%d\"", i );
+    parseString( &val, buffer );
+    mapSet( map, &key, &val );
+  }
+  while ( ! freeMapStep( map, 16 ) )
+    ;
+
+  // A map kept in a file still has its pairs after it's closed and opened again.
+  remove( "mapTest.db" );
+  map = openMap( "mapTest.db" );
+  assert( map );
+  for ( int i = 0; i < 500; i++ ) {
+    char buffer[ 20 ];
+    sprintf( buffer, "\"k%d\"", i );
+    parseString( &key, buffer );
+    parseInteger( &val, buffer + 2 );
+    mapSet( map, &key, &val );
+  }
+  parseString( &key, "\"k7\"" );
+  parseString( &val, "\"a longer value than before\"" );
+  mapSet( map, &key, &val );
+  assert( mapRemove( map, &v5 ) == false );
+  mapCheckpoint( map );
+  freeMap( map );
+
+  map = openMap( "mapTest.db" );
+  assert( mapSize( map ) == 500 );
+  parseString( &key, "\"k7\"" );
+  v = mapGet( map, &key );
+  assert( v && strcmp( valueString( v ), "a longer value than before" ) == 0 );
+  assert( mapRemove( map, &key ) );
+  assert( mapGet( map, &key ) == NULL );
+  key.empty( &key );
+  total = 0;
+  mapForEach( map, countPair, &total );
+  assert( total == 499 );
+  freeMap( map );
+  remove( "mapTest.db" );
+
+  // The reverse index finds the keys holding a value, and follows replaces and removes.
+  map = makeMap( 4 );
+  for ( int i = 0; i < 200; i++ ) {
+    char buffer[ 20 ];
+    sprintf( buffer, "%d", i );
+    parseInteger( &key, buffer );
+    sprintf( buffer, "%d", i % 10 );
+    parseInteger( &val, buffer );
+    mapSet( map, &key, &val );
+  }
+  mapIndexValues( map );
+  memset( sums, 0, sizeof( sums ) );
+  mapKeysOf( map, &v5, sumPair, sums );
+  assert( sums[ 2 ] == 20 && sums[ 1 ] == 100 );
+  parseInteger( &key, "15" );
+  parseInteger( &val, "10" );
+  mapSet( map, &key, &val );
+  parseInteger( &key, "25" );
+  assert( mapRemove( map, &key ) );
+  memset( sums, 0, sizeof( sums ) );
+  mapKeysOf( map, &v5, sumPair, sums );
+  assert( sums[ 2 ] == 18 );
+  memset( sums, 0, sizeof( sums ) );
+  mapKeysOf( map, &v10, sumPair, sums );
+  assert( sums[ 2 ] == 1 && sums[ 0 ] == 15 );
+
+  // Without the index, every pair is checked and the answer is the same.
+  parseString( &key, "\"s\"" );
+  parseInteger( &val, "5" );
+  mapSet( map, &key, &val );
+  Map *plain = makeMap( 4 );
+  parseString( &key, "\"s\"" );
+  parseInteger( &val, "5" );
+  mapSet( plain, &key, &val );
+  total = 0;
+  mapKeysOf( map, &v5, countPair, &total );
+  assert( total == 19 );
+  total = 0;
+  mapKeysOf( plain, &v5, countPair, &total );
+  assert( total == 1 );
+  freeMap( plain );
+  while ( ! freeMapStep( map, 16 ) )
+    ;
+
+  // After most pairs are removed, compaction moves the rest and their strings, and
+  // every lookup still finds them.
+  map = makeMap( 4 );
+  mapIndexKeys( map );
+  mapIndexValues( map );
+  for ( int i = 0; i < 1000; i++ ) {
+    char buffer[ 20 ];
+    sprintf( buffer, "\"k%d\"", i );
+    parseString( &key, buffer );
+    sprintf( buffer, "\"v%d\"", i % 10 );
+    parseString( &val, buffer );
+    mapSet( map, &key, &val );
+  }
+  for ( int i = 0; i < 1000; i++ ) {
+    if ( i % 50 == 0 )
+      continue;
+    char buffer[ 20 ];
+    sprintf( buffer, "\"k%d\"", i );
+    parseString( &key, buffer );
+    assert( mapRemove( map, &key ) );
+    key.empty( &key );
+  }
+  assert( mapSize( map ) == 20 );
+  while ( ! mapCompact( map, 8 ) )
+    ;
+  for ( int i = 0; i < 1000; i += 50 ) {
+    char buffer[ 20 ];
+    sprintf( buffer, "\"k%d\"", i );
+    parseString( &key, buffer );
+    sprintf( buffer, "\"v%d\"", i % 10 );
+    parseString( &val, buffer );
+    v = mapGet( map, &key );
+    assert( v && val.equals( &val, v ) );
+    key.empty( &key );
+    val.empty( &val );
+  }
+  total = 0;
+  mapKeysWithPrefix( map, "k1", countPair, &total );
+  assert( total == 2 );
+  parseString( &val, "\"v0\"" );
+  total = 0;
+  mapKeysOf( map, &val, countPair, &total );
+  assert( total == 20 );
+  val.empty( &val );
+
+  // The map keeps working after compaction, and a second one finishes right away.
+  parseString( &key, "\"k1\"" );
+  parseString( &val, "\"v1\"" );
+  mapSet( map, &key, &val );
+  assert( mapSize( map ) == 21 );
+  assert( mapCompact( map, 1000 ) );
+  total = 0;
+  mapForEach( map, countPair, &total );
+  assert( total == 21 );
+  while ( ! freeMapStep( map, 16 ) )
+    ;
+
+  // Large values are stored compressed, and come back the same.
+  map = makeMap( 4 );
+  mapCompressValues( map, 64 );
+  mapInternStrings( map );
+  mapIndexValues( map );
+  char *blob = malloc( 2000 );
+  strcpy( blob, "\"" );
+  for ( int i = 0; i < 60; i++ )
+    strcat( blob, "{'name': 'x', 'n': 1} " );
+  strcat( blob, "\"" );
+  for ( int i = 0; i < 10; i++ ) {
+    setInteger( &key, i );
+    parseString( &val, blob );
+    mapSet( map, &key, &val );
+  }
+  parseString( &val, blob );
+  v = mapGet( map, &v5 );
+  assert( v && v->print != val.print && v->equals( v, &val ) && val.equals( &val, v ) );
+  assert( strcmp( valueString( v ), valueString( &val ) ) == 0 );
+  total = 0;
+  mapKeysOf( map, &val, countPair, &total );
+  assert( total == 10 );
+  val.empty( &val );
+  assert( mapRemove( map, &v5 ) );
+  freeMap( map );
+  free( blob );
+
   // Free our temporary values.
   v5.empty( &v5 );
   v10.empty( &v10 );
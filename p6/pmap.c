@@ -0,0 +1,548 @@
+/**
+    @file pmap.c
+    @author Shlok Dave (ssdave)
+    Implementation for the pmap component.  Everything the table needs, the
+    header, the buckets and each pair's record, is stored in the file and
+    linked together with file offsets instead of pointers, so the file can be
+    mapped in at any address the next time it's opened.  Keys and values are
+    kept in the form encodeValue gives them.
+  */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "pmap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** Number written at the start of every table file. */
+#define PMAP_MAGIC 0x50414d50U
+
+/** Version of the file layout. */
+#define PMAP_VERSION 1
+
+/** Number of buckets a new table starts with. */
+#define FIRST_BUCKETS 64
+
+/** Size of a new table file in bytes; the file doubles whenever it fills up. */
+#define FIRST_FILE 65536
+
+/** Records start on multiples of this many bytes. */
+#define ALIGN 8
+
+/** Encoded keys up to this size are built on the stack. */
+#define KEY_BUFFER 64
+
+/** Number of freed records looked at for one that can be reused. */
+#define FREE_SEARCH 8
+
+/** Header at the start of the file. */
+typedef struct
+{
+  /** PMAP_MAGIC, to recognize a table file. */
+  uint32_t magic;
+
+  /** PMAP_VERSION of the layout the file uses. */
+  uint32_t version;
+
+  /** Number of pairs in the table. */
+  uint64_t size;
+
+  /** Number of buckets, a power of two. */
+  uint64_t tlen;
+
+  /** Offset of the bucket array, which holds the offset of the first record in each bucket. */
+  uint64_t buckets;
+
+  /** Offset of the first byte that hasn't been handed out yet. */
+  uint64_t used;
+
+  /** Offset of the first freed record, or 0 if there aren't any. */
+  uint64_t freeList;
+} PMapHeader;
+
+/** A block of the file holding one pair, or the bucket array. */
+typedef struct
+{
+  /** Offset of the next record in the same bucket or in the free list, or 0. */
+  uint64_t next;
+
+  /** Hash of the key. */
+  uint32_t hash;
+
+  /** Number of bytes available in bytes. */
+  uint32_t cap;
+
+  /** Length of the encoded key at the start of bytes. */
+  uint32_t klen;
+
+  /** Length of the encoded value right after the key. */
+  uint32_t vlen;
+
+  /** Encoded key, then the encoded value. */
+  unsigned char bytes[];
+} PMapRecord;
+
+/** Representation of an open table file. */
+struct PMapStruct
+{
+  /** Descriptor for the file. */
+  int fd;
+
+  /** Where the file is mapped into memory. */
+  char *base;
+
+  /** Length of the file and of the mapping. */
+  size_t len;
+};
+
+/**
+  Helper function that gives the header of a table.
+  @param p the table.
+  @return pointer to the header in the mapping.
+*/
+static PMapHeader *header(PMap *p)
+{
+  return (PMapHeader *)p->base;
+}
+
+/**
+  Helper function that turns an offset into a pointer. The pointer is only good until
+  the file grows, since that can move the mapping.
+  @param p the table.
+  @param off offset into the file.
+  @return pointer to that spot in the mapping.
+*/
+static void *at(PMap *p, uint64_t off)
+{
+  return p->base + off;
+}
+
+/**
+  Helper function that gives the bucket array of a table.
+  @param p the table.
+  @return pointer to the first bucket.
+*/
+static uint64_t *bucketArray(PMap *p)
+{
+  return at(p, header(p)->buckets);
+}
+
+/**
+  Helper function that maps the table's file into memory, replacing any earlier mapping.
+  @param p the table.
+  @param len length of the file.
+  @return true if the file was mapped.
+*/
+static bool mapFile(PMap *p, size_t len)
+{
+  if (p->base)
+    munmap(p->base, p->len);
+
+  void *base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, p->fd, 0);
+  p->base = base == MAP_FAILED ? NULL : base;
+  p->len = len;
+  return p->base != NULL;
+}
+
+/**
+  Helper function that hands out bytes at the end of the used part of the file, making
+  the file bigger if they don't fit. Running out of disk space can't be recovered from.
+  @param p the table.
+  @param n number of bytes needed.
+  @return offset of the bytes.
+*/
+static uint64_t allocBytes(PMap *p, uint64_t n)
+{
+  n = (n + ALIGN - 1) & ~(uint64_t)(ALIGN - 1);
+  uint64_t off = header(p)->used;
+
+  if (off + n > p->len)
+  {
+    size_t len = p->len;
+    while (len < off + n)
+      len *= 2;
+    if (ftruncate(p->fd, len) != 0 || !mapFile(p, len))
+    {
+      perror("pmap");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  header(p)->used = off + n;
+  return off;
+}
+
+/**
+  Helper function that finds room for a record, reusing a freed one if one of the first
+  few on the free list is big enough.
+  @param p the table.
+  @param need number of bytes the record has to hold.
+  @return offset of the record.
+*/
+static uint64_t allocRecord(PMap *p, uint32_t need)
+{
+  uint64_t *link = &header(p)->freeList;
+  for (int i = 0; *link && i < FREE_SEARCH; i++)
+  {
+    PMapRecord *r = at(p, *link);
+    if (r->cap >= need)
+    {
+      uint64_t off = *link;
+      *link = r->next;
+      return off;
+    }
+    link = &r->next;
+  }
+
+  uint64_t size = (sizeof(PMapRecord) + need + ALIGN - 1) & ~(uint64_t)(ALIGN - 1);
+  uint64_t off = allocBytes(p, size);
+  PMapRecord *r = at(p, off);
+  r->cap = size - sizeof(PMapRecord);
+  return off;
+}
+
+/**
+  Helper function that puts a record on the free list.
+  @param p the table.
+  @param off offset of the record.
+*/
+static void freeRecord(PMap *p, uint64_t off)
+{
+  PMapRecord *r = at(p, off);
+  r->next = header(p)->freeList;
+  header(p)->freeList = off;
+}
+
+/**
+  Helper function that makes an empty bucket array, stored in a record of its own so
+  it can go on the free list once the table outgrows it.
+  @param p the table.
+  @param len number of buckets.
+  @return offset of the first bucket.
+*/
+static uint64_t allocBuckets(PMap *p, uint64_t len)
+{
+  uint64_t off = allocRecord(p, len * sizeof(uint64_t));
+  PMapRecord *r = at(p, off);
+  memset(r->bytes, 0, len * sizeof(uint64_t));
+  return off + offsetof(PMapRecord, bytes);
+}
+
+/**
+  Helper function that moves every record into a new bucket array of the given length.
+  @param p the table.
+  @param len new number of buckets, a power of two.
+*/
+static void resizeBuckets(PMap *p, uint64_t len)
+{
+  uint64_t fresh = allocBuckets(p, len);
+  uint64_t *table = at(p, fresh);
+  uint64_t *old = bucketArray(p);
+
+  for (uint64_t idx = 0; idx < header(p)->tlen; idx++)
+  {
+    uint64_t off = old[idx];
+    while (off)
+    {
+      PMapRecord *r = at(p, off);
+      uint64_t next = r->next;
+      r->next = table[r->hash & (len - 1)];
+      table[r->hash & (len - 1)] = off;
+      off = next;
+    }
+  }
+
+  freeRecord(p, header(p)->buckets - offsetof(PMapRecord, bytes));
+  header(p)->buckets = fresh;
+  header(p)->tlen = len;
+}
+
+/**
+  Helper function that encodes a key, on the stack if it's small enough.
+  @param key the key to encode.
+  @param local buffer of KEY_BUFFER bytes to use if the key fits.
+  @param klen filled in with the length of the encoding.
+  @return the encoding, which the caller has to free if it isn't local.
+*/
+static unsigned char *encodeKey(Value const *key, unsigned char *local, uint32_t *klen)
+{
+  int len = encodeValue(key, local, KEY_BUFFER);
+  *klen = len;
+  if (len <= KEY_BUFFER)
+    return local;
+
+  unsigned char *buf = malloc(len);
+  encodeValue(key, buf, len);
+  return buf;
+}
+
+/**
+  Helper function that finds the link pointing at the record for a key. The pointer is
+  only good until the file grows.
+  @param p the table.
+  @param kbuf the encoded key.
+  @param klen length of the encoded key.
+  @param hash hash of the key.
+  @return the link to the key's record, or the empty link at the end of its bucket.
+*/
+static uint64_t *findLink(PMap *p, unsigned char const *kbuf, uint32_t klen, uint32_t hash)
+{
+  uint64_t *link = &bucketArray(p)[hash & (header(p)->tlen - 1)];
+  while (*link)
+  {
+    PMapRecord *r = at(p, *link);
+    if (r->hash == hash && r->klen == klen && memcmp(r->bytes, kbuf, klen) == 0)
+      return link;
+    link = &r->next;
+  }
+  return link;
+}
+
+/**
+  This function opens the table kept in a file and maps the file into memory. A new or
+  empty file gets an empty table; an existing one has to have the right magic number and
+  version, and a header that fits in the file.
+  @param path name of the file.
+  @return pointer to the table, or NULL if the file couldn't be opened or isn't a table.
+*/
+PMap *openPMap(char const *path)
+{
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+    return NULL;
+
+  PMap *p = calloc(1, sizeof(PMap));
+  p->fd = fd;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    goto fail;
+
+  if (st.st_size == 0)
+  {
+    // A new file gets an empty table.
+    if (ftruncate(fd, FIRST_FILE) != 0 || !mapFile(p, FIRST_FILE))
+      goto fail;
+    header(p)->magic = PMAP_MAGIC;
+    header(p)->version = PMAP_VERSION;
+    header(p)->used = (sizeof(PMapHeader) + ALIGN - 1) & ~(uint64_t)(ALIGN - 1);
+    header(p)->buckets = allocBuckets(p, FIRST_BUCKETS);
+    header(p)->tlen = FIRST_BUCKETS;
+  }
+  else
+  {
+    // Make sure an existing file really holds a table.
+    if (st.st_size < (off_t)sizeof(PMapHeader) || !mapFile(p, st.st_size) ||
+        header(p)->magic != PMAP_MAGIC || header(p)->version != PMAP_VERSION ||
+        header(p)->used > p->len)
+      goto fail;
+  }
+  return p;
+
+fail:
+  if (p->base)
+    munmap(p->base, p->len);
+  close(fd);
+  free(p);
+  return NULL;
+}
+
+/**
+  This function gives the number of pairs in the table, from the file's header.
+  @param p pointer to the table.
+  @return number of pairs.
+*/
+int pmapSize(PMap *p)
+{
+  return header(p)->size;
+}
+
+/**
+  This function adds a pair to the table, or replaces the value of a key that's already
+  there. A new value that fits in the old record is written over it; otherwise the record
+  is freed and a new one is made.
+  @param p pointer to the table.
+  @param key the key, which is encoded into the file.
+  @param val the value, which is encoded into the file.
+*/
+void pmapSet(PMap *p, Value const *key, Value const *val)
+{
+  unsigned char local[KEY_BUFFER];
+  uint32_t klen;
+  unsigned char *kbuf = encodeKey(key, local, &klen);
+  uint32_t vlen = encodeValue(val, NULL, 0);
+  uint32_t hash = key->hash(key);
+
+  uint64_t *link = findLink(p, kbuf, klen, hash);
+  if (*link)
+  {
+    // Write over the old value if the new one fits in the record.
+    PMapRecord *r = at(p, *link);
+    if (klen + vlen <= r->cap)
+    {
+      encodeValue(val, r->bytes + klen, vlen);
+      r->vlen = vlen;
+      if (kbuf != local)
+        free(kbuf);
+      return;
+    }
+
+    // Otherwise the old record goes away and a bigger one is added.
+    uint64_t off = *link;
+    *link = r->next;
+    freeRecord(p, off);
+    header(p)->size--;
+  }
+
+  uint64_t off = allocRecord(p, klen + vlen);
+  PMapRecord *r = at(p, off);
+  r->hash = hash;
+  r->klen = klen;
+  r->vlen = vlen;
+  memcpy(r->bytes, kbuf, klen);
+  encodeValue(val, r->bytes + klen, vlen);
+
+  uint64_t *bucket = &bucketArray(p)[hash & (header(p)->tlen - 1)];
+  r->next = *bucket;
+  *bucket = off;
+
+  // Double the buckets once the chains get too long on average.
+  if (++header(p)->size > header(p)->tlen)
+    resizeBuckets(p, header(p)->tlen * 2);
+
+  if (kbuf != local)
+    free(kbuf);
+}
+
+/**
+  This function looks up the value for a key.
+  @param p pointer to the table.
+  @param key the key to look for.
+  @param val filled in with a decoded copy of the value if the key is found. The caller
+  has to empty it.
+  @return true if the key is in the table.
+*/
+bool pmapGet(PMap *p, Value const *key, Value *val)
+{
+  unsigned char local[KEY_BUFFER];
+  uint32_t klen;
+  unsigned char *kbuf = encodeKey(key, local, &klen);
+
+  uint64_t *link = findLink(p, kbuf, klen, key->hash(key));
+  if (*link)
+  {
+    PMapRecord *r = at(p, *link);
+    decodeValue(val, r->bytes + klen, r->vlen);
+  }
+
+  if (kbuf != local)
+    free(kbuf);
+  return *link != 0;
+}
+
+/**
+  This function removes a key and its value from the table, freeing its record so the
+  space can be used again.
+  @param p pointer to the table.
+  @param key the key to remove.
+  @return true if the key was in the table.
+*/
+bool pmapRemove(PMap *p, Value const *key)
+{
+  unsigned char local[KEY_BUFFER];
+  uint32_t klen;
+  unsigned char *kbuf = encodeKey(key, local, &klen);
+
+  uint64_t *link = findLink(p, kbuf, klen, key->hash(key));
+  uint64_t off = *link;
+  if (off)
+  {
+    *link = ((PMapRecord *)at(p, off))->next;
+    freeRecord(p, off);
+    header(p)->size--;
+  }
+
+  if (kbuf != local)
+    free(kbuf);
+  return off != 0;
+}
+
+/**
+  This function grows the buckets so the table can hold the given number of pairs without
+  growing again.
+  @param p pointer to the table.
+  @param count number of pairs the table should hold.
+*/
+void pmapReserve(PMap *p, int count)
+{
+  uint64_t len = header(p)->tlen;
+  while ((uint64_t)count > len)
+    len *= 2;
+  if (len > header(p)->tlen)
+    resizeBuckets(p, len);
+}
+
+/**
+  This function gives the number of buckets in the table.
+  @param p pointer to the table.
+  @return number of buckets, a power of two.
+*/
+unsigned int pmapBuckets(PMap *p)
+{
+  return header(p)->tlen;
+}
+
+/**
+  This function calls a function on every pair in one bucket. Each key and value is
+  decoded into a copy just for the call.
+  @param p pointer to the table.
+  @param idx index of the bucket.
+  @param fn function called with each key, value and the data pointer.
+  @param data pointer passed along to every call of fn.
+  @return number of pairs visited.
+*/
+int pmapVisitBucket(PMap *p, unsigned int idx, PMapVisitor fn, void *data)
+{
+  int visited = 0;
+  for (uint64_t off = bucketArray(p)[idx]; off; off = ((PMapRecord *)at(p, off))->next)
+  {
+    // Decode copies of the key and value just for the call.
+    PMapRecord *r = at(p, off);
+    Value key, val;
+    decodeValue(&key, r->bytes, r->klen);
+    decodeValue(&val, r->bytes + r->klen, r->vlen);
+    fn(&key, &val, data);
+    key.empty(&key);
+    val.empty(&val);
+    visited++;
+  }
+  return visited;
+}
+
+/**
+  This function writes every change to the table out to its file and waits until that's
+  done.
+  @param p pointer to the table.
+*/
+void pmapSync(PMap *p)
+{
+  msync(p->base, p->len, MS_SYNC);
+}
+
+/**
+  This function closes the table, leaving its contents in the file.
+  @param p pointer to the table to close.
+*/
+void closePMap(PMap *p)
+{
+  munmap(p->base, p->len);
+  close(p->fd);
+  free(p);
+}
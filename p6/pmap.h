@@ -0,0 +1,96 @@
+/**
+    @file pmap.h
+    @author Shlok Dave (ssdave)
+    Header for the pmap component, a hash table that lives entirely in a
+    memory-mapped file, so it survives restarts and can be bigger than RAM.
+*/
+
+#ifndef PMAP_H
+#define PMAP_H
+
+#include "value.h"
+#include <stdbool.h>
+
+/** Incomplete type for the persistent hash table representation. */
+typedef struct PMapStruct PMap;
+
+/** Type for a function called on each key/value pair of a persistent table.
+    @param key Key of the pair, decoded just for this call.
+    @param val Value of the pair, decoded just for this call.
+    @param data Pointer given by the caller of the walk.
+*/
+typedef void (*PMapVisitor)(Value const *key, Value const *val, void *data);
+
+/** Open the persistent table stored in the given file, creating an empty
+    one if the file doesn't exist yet.
+    @param path Name of the file.
+    @return pointer to the table, or NULL if the file couldn't be opened or
+    doesn't hold a table.
+*/
+PMap *openPMap(char const *path);
+
+/** Get the number of pairs in a persistent table.
+    @param p Pointer to the table.
+    @return Number of key/value pairs in the table.
+*/
+int pmapSize(PMap *p);
+
+/** Add a key / value pair to the table, or replace the value for a key
+    that's already there.  The key and value are copied into the file.
+    @param p Table to add the pair to.
+    @param key Key to add.
+    @param val Value to associate with the key.
+*/
+void pmapSet(PMap *p, Value const *key, Value const *val);
+
+/** Look up the value for a key.
+    @param p Table to query.
+    @param key Key to look for.
+    @param val Filled in with a decoded copy of the value, which the caller
+    has to empty, if the key is found.
+    @return true if the key is in the table.
+*/
+bool pmapGet(PMap *p, Value const *key, Value *val);
+
+/** Remove a key / value pair from the table.
+    @param p Table to remove the key from.
+    @param key Key to look for and remove.
+    @return true if the key was in the table.
+*/
+bool pmapRemove(PMap *p, Value const *key);
+
+/** Make sure the table's buckets will hold the given number of pairs
+    without growing.
+    @param p Table to get ready.
+    @param count Number of pairs the table should hold.
+*/
+void pmapReserve(PMap *p, int count);
+
+/** Get the number of buckets in the table, a power of two.
+    @param p Pointer to the table.
+    @return Number of buckets.
+*/
+unsigned int pmapBuckets(PMap *p);
+
+/** Call a function on every pair in one bucket of the table.  The function
+    must not change the table.
+    @param p Table to look in.
+    @param idx Index of the bucket.
+    @param fn Function to call for each pair.
+    @param data Pointer passed to each call of fn.
+    @return Number of pairs visited.
+*/
+int pmapVisitBucket(PMap *p, unsigned int idx, PMapVisitor fn, void *data);
+
+/** Write every change made to the table out to its file, waiting until
+    the writes are done.
+    @param p Table to write out.
+*/
+void pmapSync(PMap *p);
+
+/** Close a persistent table, leaving its contents in the file.
+    @param p The table to close.
+*/
+void closePMap(PMap *p);
+
+#endif
@@ -0,0 +1,866 @@
+/**
+    @file radix.c
+    @author Shlok Dave (ssdave)
+    Implementation for the radix component.  Inner nodes come in four
+    sizes, holding up to 4, 16, 48 or 256 children, and are grown or
+    shrunk as children come and go.  Runs of bytes shared by everything
+    under a node are stored once in the node's prefix.  Every key is
+    stored with its null terminator, so no key is a prefix of another.
+  */
+
+#include "radix.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/** Node type holding up to 4 children. */
+#define NODE4 1
+
+/** Node type holding up to 16 children. */
+#define NODE16 2
+
+/** Node type holding up to 48 children. */
+#define NODE48 3
+
+/** Node type holding a child for every byte value. */
+#define NODE256 4
+
+/** Number of prefix bytes stored in a node.  Longer prefixes are only
+    counted, and the rest of the bytes are checked against a leaf. */
+#define MAX_PREFIX 10
+
+/** Smaller of two integers. */
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/** Fields at the start of every inner node. */
+typedef struct
+{
+  /** Which kind of node this is, NODE4 through NODE256. */
+  uint8_t type;
+
+  /** Number of children in the node. */
+  uint16_t count;
+
+  /** Length of the prefix shared by every key under this node. */
+  int plen;
+
+  /** First bytes of the shared prefix. */
+  unsigned char prefix[MAX_PREFIX];
+} RadixNode;
+
+/** Inner node with up to 4 children, kept sorted by key byte. */
+typedef struct
+{
+  RadixNode n;
+  unsigned char keys[4];
+  RadixNode *children[4];
+} Node4;
+
+/** Inner node with up to 16 children, kept sorted by key byte. */
+typedef struct
+{
+  RadixNode n;
+  unsigned char keys[16];
+  RadixNode *children[16];
+} Node16;
+
+/** Inner node with up to 48 children, found through a byte index. */
+typedef struct
+{
+  RadixNode n;
+
+  /** One more than the slot holding the child for each byte, or 0 if there's none. */
+  unsigned char index[256];
+  RadixNode *children[48];
+} Node48;
+
+/** Inner node with a child slot for every byte value. */
+typedef struct
+{
+  RadixNode n;
+  RadixNode *children[256];
+} Node256;
+
+/** Leaf of the tree, holding one key. */
+typedef struct
+{
+  /** Item stored with the key. */
+  void *item;
+
+  /** The key, owned by whoever inserted it. */
+  char const *key;
+
+  /** Length of the key, including its null terminator. */
+  int len;
+} RadixLeaf;
+
+/** Representation of the radix tree. */
+struct RadixStruct
+{
+  /** Root of the tree, or NULL if the tree is empty. */
+  RadixNode *root;
+};
+
+/** Leaves are stored in child pointers with their low bit set. */
+#define IS_LEAF(x) (((uintptr_t)(x)) & 1)
+
+/** Turn a leaf pointer into a child pointer. */
+#define SET_LEAF(x) ((RadixNode *)((uintptr_t)(x) | 1))
+
+/** Turn a child pointer back into a leaf pointer. */
+#define LEAF_RAW(x) ((RadixLeaf *)((uintptr_t)(x) & ~(uintptr_t)1))
+
+/**
+  Helper function that allocates an empty inner node of the given type.
+  @param type which kind of node to make.
+  @return pointer to the new node.
+*/
+static RadixNode *makeNode(uint8_t type)
+{
+  static const size_t sizes[] = {0, sizeof(Node4), sizeof(Node16), sizeof(Node48), sizeof(Node256)};
+  RadixNode *n = calloc(1, sizes[type]);
+  n->type = type;
+  return n;
+}
+
+/**
+  Helper function that makes a leaf for a key.
+  @param key the key to store.
+  @param len length of the key, including its null terminator.
+  @param item item to store with the key.
+  @return the leaf, already tagged as a child pointer.
+*/
+static RadixNode *makeLeaf(char const *key, int len, void *item)
+{
+  RadixLeaf *l = malloc(sizeof(RadixLeaf));
+  l->item = item;
+  l->key = key;
+  l->len = len;
+  return SET_LEAF(l);
+}
+
+/**
+  Helper function that checks whether a leaf holds exactly the given key.
+  @param l the leaf to check.
+  @param key the key to compare with.
+  @param len length of the key, including its null terminator.
+  @return true if the leaf holds the key.
+*/
+static bool leafMatches(RadixLeaf const *l, char const *key, int len)
+{
+  return l->len == len && memcmp(l->key, key, len) == 0;
+}
+
+/**
+  Helper function that finds the child slot for a byte.
+  @param n the node to look in.
+  @param c the byte of the key at this depth.
+  @return pointer to the child slot, or NULL if there's no such child.
+*/
+static RadixNode **findChild(RadixNode *n, unsigned char c)
+{
+  switch (n->type)
+  {
+  case NODE4:
+  {
+    Node4 *p = (Node4 *)n;
+    for (int i = 0; i < n->count; i++)
+      if (p->keys[i] == c)
+        return &p->children[i];
+    break;
+  }
+  case NODE16:
+  {
+    Node16 *p = (Node16 *)n;
+    for (int i = 0; i < n->count; i++)
+      if (p->keys[i] == c)
+        return &p->children[i];
+    break;
+  }
+  case NODE48:
+  {
+    Node48 *p = (Node48 *)n;
+    if (p->index[c])
+      return &p->children[p->index[c] - 1];
+    break;
+  }
+  case NODE256:
+  {
+    Node256 *p = (Node256 *)n;
+    if (p->children[c])
+      return &p->children[c];
+    break;
+  }
+  }
+  return NULL;
+}
+
+/**
+  Helper function that finds the leaf with the smallest key under a node.
+  @param n the node to start from, which may itself be a leaf.
+  @return the leftmost leaf.
+*/
+static RadixLeaf *minimumLeaf(RadixNode const *n)
+{
+  while (!IS_LEAF(n))
+  {
+    switch (n->type)
+    {
+    case NODE4:
+      n = ((Node4 const *)n)->children[0];
+      break;
+    case NODE16:
+      n = ((Node16 const *)n)->children[0];
+      break;
+    case NODE48:
+    {
+      Node48 const *p = (Node48 const *)n;
+      int c = 0;
+      while (!p->index[c])
+        c++;
+      n = p->children[p->index[c] - 1];
+      break;
+    }
+    case NODE256:
+    {
+      Node256 const *p = (Node256 const *)n;
+      int c = 0;
+      while (!p->children[c])
+        c++;
+      n = p->children[c];
+      break;
+    }
+    }
+  }
+  return LEAF_RAW(n);
+}
+
+/**
+  Helper function that counts how many bytes of a node's prefix match the key
+  starting at the given depth. Prefix bytes that aren't stored in the node are
+  checked against the smallest leaf under it.
+  @param n the node whose prefix is compared.
+  @param key the key being looked up.
+  @param len number of bytes of the key to consider.
+  @param depth position in the key where the node's prefix starts.
+  @return number of matching prefix bytes.
+*/
+static int prefixMismatch(RadixNode const *n, char const *key, int len, int depth)
+{
+  int max = MIN(MIN(MAX_PREFIX, n->plen), len - depth);
+  int idx;
+  for (idx = 0; idx < max; idx++)
+  {
+    if (n->prefix[idx] != (unsigned char)key[depth + idx])
+      return idx;
+  }
+
+  // The rest of a long prefix has to come from a leaf.
+  if (n->plen > MAX_PREFIX)
+  {
+    RadixLeaf const *l = minimumLeaf(n);
+    max = MIN(MIN(l->len, len) - depth, n->plen);
+    for (; idx < max; idx++)
+    {
+      if (l->key[depth + idx] != key[depth + idx])
+        return idx;
+    }
+  }
+  return idx;
+}
+
+/**
+  Helper function that copies the count and prefix from one node to another,
+  used when a node is replaced by one of a different size.
+  @param dest the new node.
+  @param src the node being replaced.
+*/
+static void copyHeader(RadixNode *dest, RadixNode const *src)
+{
+  dest->count = src->count;
+  dest->plen = src->plen;
+  memcpy(dest->prefix, src->prefix, MIN(MAX_PREFIX, src->plen));
+}
+
+/**
+  Helper function that adds a child to a node with a slot for every byte.
+  @param n the node to add to.
+  @param c the byte the child is for.
+  @param child the child to add.
+*/
+static void addChild256(Node256 *n, unsigned char c, RadixNode *child)
+{
+  n->n.count++;
+  n->children[c] = child;
+}
+
+/**
+  Helper function that adds a child to a node with up to 48 children, replacing
+  it with a bigger node if it's full.
+  @param n the node to add to.
+  @param ref the slot pointing at n, updated if n is replaced.
+  @param c the byte the child is for.
+  @param child the child to add.
+*/
+static void addChild48(Node48 *n, RadixNode **ref, unsigned char c, RadixNode *child)
+{
+  if (n->n.count < 48)
+  {
+    int pos = 0;
+    while (n->children[pos])
+      pos++;
+    n->children[pos] = child;
+    n->index[c] = pos + 1;
+    n->n.count++;
+    return;
+  }
+
+  // Move everything into a node with a slot for every byte.
+  Node256 *bigger = (Node256 *)makeNode(NODE256);
+  for (int i = 0; i < 256; i++)
+  {
+    if (n->index[i])
+      bigger->children[i] = n->children[n->index[i] - 1];
+  }
+  copyHeader(&bigger->n, &n->n);
+  *ref = &bigger->n;
+  free(n);
+  addChild256(bigger, c, child);
+}
+
+/**
+  Helper function that adds a child to a node with up to 16 children, replacing
+  it with a bigger node if it's full.
+  @param n the node to add to.
+  @param ref the slot pointing at n, updated if n is replaced.
+  @param c the byte the child is for.
+  @param child the child to add.
+*/
+static void addChild16(Node16 *n, RadixNode **ref, unsigned char c, RadixNode *child)
+{
+  if (n->n.count < 16)
+  {
+    // Keep the keys sorted so the tree can be walked in order.
+    int idx = 0;
+    while (idx < n->n.count && n->keys[idx] < c)
+      idx++;
+    memmove(n->keys + idx + 1, n->keys + idx, n->n.count - idx);
+    memmove(n->children + idx + 1, n->children + idx, (n->n.count - idx) * sizeof(RadixNode *));
+    n->keys[idx] = c;
+    n->children[idx] = child;
+    n->n.count++;
+    return;
+  }
+
+  // Move everything into a node with room for 48 children.
+  Node48 *bigger = (Node48 *)makeNode(NODE48);
+  for (int i = 0; i < n->n.count; i++)
+  {
+    bigger->children[i] = n->children[i];
+    bigger->index[n->keys[i]] = i + 1;
+  }
+  copyHeader(&bigger->n, &n->n);
+  *ref = &bigger->n;
+  free(n);
+  addChild48(bigger, ref, c, child);
+}
+
+/**
+  Helper function that adds a child to a node with up to 4 children, replacing
+  it with a bigger node if it's full.
+  @param n the node to add to.
+  @param ref the slot pointing at n, updated if n is replaced.
+  @param c the byte the child is for.
+  @param child the child to add.
+*/
+static void addChild4(Node4 *n, RadixNode **ref, unsigned char c, RadixNode *child)
+{
+  if (n->n.count < 4)
+  {
+    // Keep the keys sorted so the tree can be walked in order.
+    int idx = 0;
+    while (idx < n->n.count && n->keys[idx] < c)
+      idx++;
+    memmove(n->keys + idx + 1, n->keys + idx, n->n.count - idx);
+    memmove(n->children + idx + 1, n->children + idx, (n->n.count - idx) * sizeof(RadixNode *));
+    n->keys[idx] = c;
+    n->children[idx] = child;
+    n->n.count++;
+    return;
+  }
+
+  // Move everything into a node with room for 16 children.
+  Node16 *bigger = (Node16 *)makeNode(NODE16);
+  memcpy(bigger->keys, n->keys, 4);
+  memcpy(bigger->children, n->children, 4 * sizeof(RadixNode *));
+  copyHeader(&bigger->n, &n->n);
+  *ref = &bigger->n;
+  free(n);
+  addChild16(bigger, ref, c, child);
+}
+
+/**
+  Helper function that adds a child to any kind of inner node.
+  @param n the node to add to.
+  @param ref the slot pointing at n, updated if n is replaced.
+  @param c the byte the child is for.
+  @param child the child to add.
+*/
+static void addChild(RadixNode *n, RadixNode **ref, unsigned char c, RadixNode *child)
+{
+  switch (n->type)
+  {
+  case NODE4:
+    addChild4((Node4 *)n, ref, c, child);
+    break;
+  case NODE16:
+    addChild16((Node16 *)n, ref, c, child);
+    break;
+  case NODE48:
+    addChild48((Node48 *)n, ref, c, child);
+    break;
+  case NODE256:
+    addChild256((Node256 *)n, c, child);
+    break;
+  }
+}
+
+/**
+  Helper function that inserts a key below the given slot of the tree.
+  @param ref the slot for the subtree the key goes in.
+  @param key the key to insert.
+  @param len length of the key, including its null terminator.
+  @param item item to store with the key.
+  @param depth number of key bytes already matched above this slot.
+*/
+static void insertAt(RadixNode **ref, char const *key, int len, void *item, int depth)
+{
+  RadixNode *n = *ref;
+
+  // An empty slot just gets the leaf.
+  if (!n)
+  {
+    *ref = makeLeaf(key, len, item);
+    return;
+  }
+
+  if (IS_LEAF(n))
+  {
+    RadixLeaf *l = LEAF_RAW(n);
+
+    // The key is already here, so just update it.
+    if (leafMatches(l, key, len))
+    {
+      l->item = item;
+      l->key = key;
+      return;
+    }
+
+    // Split the leaf into a node holding both keys under their shared prefix.
+    int longest = 0;
+    while (l->key[depth + longest] == key[depth + longest])
+      longest++;
+
+    Node4 *split = (Node4 *)makeNode(NODE4);
+    split->n.plen = longest;
+    memcpy(split->n.prefix, key + depth, MIN(MAX_PREFIX, longest));
+    *ref = &split->n;
+    addChild4(split, ref, l->key[depth + longest], n);
+    addChild4(split, ref, key[depth + longest], makeLeaf(key, len, item));
+    return;
+  }
+
+  if (n->plen)
+  {
+    int match = prefixMismatch(n, key, len, depth);
+
+    // The key differs from this node's prefix, so the prefix has to be split.
+    if (match < n->plen)
+    {
+      Node4 *split = (Node4 *)makeNode(NODE4);
+      split->n.plen = match;
+      memcpy(split->n.prefix, n->prefix, MIN(MAX_PREFIX, match));
+      *ref = &split->n;
+
+      // The old node keeps whatever follows the byte where the keys differ.
+      if (n->plen <= MAX_PREFIX)
+      {
+        addChild4(split, ref, n->prefix[match], n);
+        n->plen -= match + 1;
+        memmove(n->prefix, n->prefix + match + 1, MIN(MAX_PREFIX, n->plen));
+      }
+      else
+      {
+        n->plen -= match + 1;
+        RadixLeaf const *l = minimumLeaf(n);
+        addChild4(split, ref, l->key[depth + match], n);
+        memcpy(n->prefix, l->key + depth + match + 1, MIN(MAX_PREFIX, n->plen));
+      }
+
+      addChild4(split, ref, key[depth + match], makeLeaf(key, len, item));
+      return;
+    }
+    depth += n->plen;
+  }
+
+  // Go down to the child for the next byte, or add a new child for it.
+  RadixNode **child = findChild(n, key[depth]);
+  if (child)
+    insertAt(child, key, len, item, depth + 1);
+  else
+    addChild(n, ref, key[depth], makeLeaf(key, len, item));
+}
+
+/**
+  Helper function that removes the child for a byte from a node, replacing the
+  node with a smaller kind once it gets sparse enough.
+  @param n the node to remove from.
+  @param ref the slot pointing at n, updated if n is replaced.
+  @param c the byte of the child being removed.
+  @param slot the slot holding the child.
+*/
+static void removeChild(RadixNode *n, RadixNode **ref, unsigned char c, RadixNode **slot)
+{
+  switch (n->type)
+  {
+  case NODE256:
+  {
+    Node256 *p = (Node256 *)n;
+    p->children[c] = NULL;
+    n->count--;
+
+    // Shrink a little below 48 children, so a node on the border doesn't flip back and forth.
+    if (n->count == 37)
+    {
+      Node48 *smaller = (Node48 *)makeNode(NODE48);
+      copyHeader(&smaller->n, n);
+      int pos = 0;
+      for (int i = 0; i < 256; i++)
+      {
+        if (p->children[i])
+        {
+          smaller->children[pos] = p->children[i];
+          smaller->index[i] = ++pos;
+        }
+      }
+      *ref = &smaller->n;
+      free(n);
+    }
+    break;
+  }
+  case NODE48:
+  {
+    Node48 *p = (Node48 *)n;
+    p->children[p->index[c] - 1] = NULL;
+    p->index[c] = 0;
+    n->count--;
+
+    if (n->count == 12)
+    {
+      Node16 *smaller = (Node16 *)makeNode(NODE16);
+      copyHeader(&smaller->n, n);
+      int pos = 0;
+      for (int i = 0; i < 256; i++)
+      {
+        if (p->index[i])
+        {
+          smaller->keys[pos] = i;
+          smaller->children[pos] = p->children[p->index[i] - 1];
+          pos++;
+        }
+      }
+      *ref = &smaller->n;
+      free(n);
+    }
+    break;
+  }
+  case NODE16:
+  {
+    Node16 *p = (Node16 *)n;
+    int pos = slot - p->children;
+    memmove(p->keys + pos, p->keys + pos + 1, n->count - pos - 1);
+    memmove(p->children + pos, p->children + pos + 1, (n->count - pos - 1) * sizeof(RadixNode *));
+    n->count--;
+
+    if (n->count == 3)
+    {
+      Node4 *smaller = (Node4 *)makeNode(NODE4);
+      copyHeader(&smaller->n, n);
+      memcpy(smaller->keys, p->keys, 3);
+      memcpy(smaller->children, p->children, 3 * sizeof(RadixNode *));
+      *ref = &smaller->n;
+      free(n);
+    }
+    break;
+  }
+  case NODE4:
+  {
+    Node4 *p = (Node4 *)n;
+    int pos = slot - p->children;
+    memmove(p->keys + pos, p->keys + pos + 1, n->count - pos - 1);
+    memmove(p->children + pos, p->children + pos + 1, (n->count - pos - 1) * sizeof(RadixNode *));
+    n->count--;
+
+    // A node with one child is merged into that child.
+    if (n->count == 1)
+    {
+      RadixNode *child = p->children[0];
+      if (!IS_LEAF(child))
+      {
+        // The child's prefix becomes this prefix, the byte between them, then its own prefix.
+        int plen = n->plen;
+        if (plen < MAX_PREFIX)
+          n->prefix[plen++] = p->keys[0];
+        if (plen < MAX_PREFIX)
+        {
+          int sub = MIN(child->plen, MAX_PREFIX - plen);
+          memcpy(n->prefix + plen, child->prefix, sub);
+          plen += sub;
+        }
+        memcpy(child->prefix, n->prefix, MIN(plen, MAX_PREFIX));
+        child->plen += n->plen + 1;
+      }
+      *ref = child;
+      free(n);
+    }
+    break;
+  }
+  }
+}
+
+/**
+  Helper function that removes a key from below the given slot of the tree.
+  @param ref the slot for the subtree the key would be in.
+  @param key the key to remove.
+  @param len length of the key, including its null terminator.
+  @param depth number of key bytes already matched above this slot.
+  @return the removed leaf, or NULL if the key wasn't found.
+*/
+static RadixLeaf *removeAt(RadixNode **ref, char const *key, int len, int depth)
+{
+  RadixNode *n = *ref;
+  if (!n)
+    return NULL;
+
+  if (IS_LEAF(n))
+  {
+    RadixLeaf *l = LEAF_RAW(n);
+    if (!leafMatches(l, key, len))
+      return NULL;
+    *ref = NULL;
+    return l;
+  }
+
+  if (n->plen)
+  {
+    if (prefixMismatch(n, key, len, depth) != n->plen)
+      return NULL;
+    depth += n->plen;
+  }
+  if (depth >= len)
+    return NULL;
+
+  RadixNode **child = findChild(n, key[depth]);
+  if (!child)
+    return NULL;
+
+  // A leaf right under this node is taken out here, since the node may need to shrink.
+  if (IS_LEAF(*child))
+  {
+    RadixLeaf *l = LEAF_RAW(*child);
+    if (!leafMatches(l, key, len))
+      return NULL;
+    removeChild(n, ref, key[depth], child);
+    return l;
+  }
+  return removeAt(child, key, len, depth + 1);
+}
+
+/**
+  Helper function that calls the visitor on every leaf under a node, in order.
+  @param n the node to walk, which may itself be a leaf.
+  @param fn function to call for each key.
+  @param data pointer passed to each call of fn.
+*/
+static void walk(RadixNode const *n, RadixVisitor fn, void *data)
+{
+  if (IS_LEAF(n))
+  {
+    RadixLeaf const *l = LEAF_RAW(n);
+    fn(l->key, l->item, data);
+    return;
+  }
+
+  switch (n->type)
+  {
+  case NODE4:
+    for (int i = 0; i < n->count; i++)
+      walk(((Node4 const *)n)->children[i], fn, data);
+    break;
+  case NODE16:
+    for (int i = 0; i < n->count; i++)
+      walk(((Node16 const *)n)->children[i], fn, data);
+    break;
+  case NODE48:
+  {
+    Node48 const *p = (Node48 const *)n;
+    for (int i = 0; i < 256; i++)
+      if (p->index[i])
+        walk(p->children[p->index[i] - 1], fn, data);
+    break;
+  }
+  case NODE256:
+  {
+    Node256 const *p = (Node256 const *)n;
+    for (int i = 0; i < 256; i++)
+      if (p->children[i])
+        walk(p->children[i], fn, data);
+    break;
+  }
+  }
+}
+
+/**
+  Helper function that frees a subtree, including its leaves.
+  @param n the subtree to free.
+*/
+static void freeNode(RadixNode *n)
+{
+  if (IS_LEAF(n))
+  {
+    free(LEAF_RAW(n));
+    return;
+  }
+
+  switch (n->type)
+  {
+  case NODE4:
+    for (int i = 0; i < n->count; i++)
+      freeNode(((Node4 *)n)->children[i]);
+    break;
+  case NODE16:
+    for (int i = 0; i < n->count; i++)
+      freeNode(((Node16 *)n)->children[i]);
+    break;
+  case NODE48:
+  {
+    Node48 *p = (Node48 *)n;
+    for (int i = 0; i < 256; i++)
+      if (p->index[i])
+        freeNode(p->children[p->index[i] - 1]);
+    break;
+  }
+  case NODE256:
+  {
+    Node256 *p = (Node256 *)n;
+    for (int i = 0; i < 256; i++)
+      if (p->children[i])
+        freeNode(p->children[i]);
+    break;
+  }
+  }
+  free(n);
+}
+
+/**
+  This function makes an empty tree.
+  @return pointer to the new tree.
+*/
+Radix *makeRadix(void)
+{
+  return calloc(1, sizeof(Radix));
+}
+
+/**
+  This function adds a key to the tree, or updates the item stored with it if it's already
+  there. The key's terminating null is part of what's stored, so no key is a prefix of
+  another inside the tree.
+  @param t pointer to the tree.
+  @param key the key to add, which has to stay in place while it's in the tree.
+  @param item the item to store with the key.
+*/
+void radixInsert(Radix *t, char const *key, void *item)
+{
+  insertAt(&t->root, key, strlen(key) + 1, item, 0);
+}
+
+/**
+  This function removes a key from the tree, shrinking the nodes it leaves behind.
+  @param t pointer to the tree.
+  @param key the key to remove.
+  @return true if the key was in the tree.
+*/
+bool radixRemove(Radix *t, char const *key)
+{
+  RadixLeaf *l = removeAt(&t->root, key, strlen(key) + 1, 0);
+  if (!l)
+    return false;
+  free(l);
+  return true;
+}
+
+/**
+  This function calls a function on every key that starts with the given prefix, in sorted
+  order. It follows the prefix down the tree, and then walks everything below where it ends.
+  @param t pointer to the tree.
+  @param prefix the prefix to look for; the empty string matches every key.
+  @param fn function called with each matching key, its item and the data pointer.
+  @param data pointer passed along to every call of fn.
+*/
+void radixPrefix(Radix const *t, char const *prefix, RadixVisitor fn, void *data)
+{
+  int len = strlen(prefix);
+  RadixNode const *n = t->root;
+  int depth = 0;
+
+  while (n)
+  {
+    // A leaf is a match only if its key really starts with the prefix.
+    if (IS_LEAF(n))
+    {
+      RadixLeaf const *l = LEAF_RAW(n);
+      if (l->len > len && memcmp(l->key, prefix, len) == 0)
+        fn(l->key, l->item, data);
+      return;
+    }
+
+    // Once the whole prefix is used up, everything below matches.
+    if (depth == len)
+    {
+      walk(n, fn, data);
+      return;
+    }
+
+    if (n->plen)
+    {
+      int match = prefixMismatch(n, prefix, len, depth);
+
+      // The prefix ends partway through this node's prefix.
+      if (depth + match == len)
+      {
+        walk(n, fn, data);
+        return;
+      }
+
+      // The prefix differs from this node's prefix, so nothing matches.
+      if (match < n->plen)
+        return;
+      depth += n->plen;
+    }
+
+    RadixNode **child = findChild((RadixNode *)n, prefix[depth]);
+    n = child ? *child : NULL;
+    depth++;
+  }
+}
+
+/**
+  This function frees the tree and all its nodes. The keys belong to the caller.
+  @param t pointer to the tree to free.
+*/
+void freeRadix(Radix *t)
+{
+  if (t->root)
+    freeNode(t->root);
+  free(t);
+}
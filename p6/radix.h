@@ -0,0 +1,60 @@
+/**
+    @file radix.h
+    @author Shlok Dave (ssdave)
+    Header for the radix component, an adaptive radix tree over string
+    keys that can find every key starting with a given prefix.
+*/
+
+#ifndef RADIX_H
+#define RADIX_H
+
+#include <stdbool.h>
+
+/** Incomplete type for the radix tree representation. */
+typedef struct RadixStruct Radix;
+
+/** Type for a function called on each key found in the tree.
+    @param key The key, as it was given when it was inserted.
+    @param item Item stored with the key.
+    @param data Pointer given by the caller of the search.
+*/
+typedef void (*RadixVisitor)(char const *key, void *item, void *data);
+
+/** Make an empty radix tree.
+    @return pointer to a new tree.
+*/
+Radix *makeRadix(void);
+
+/** Add a key to the tree, or update the item stored with it if it's
+    already there.  The tree doesn't copy the key, so the string must
+    stay in place until the key is removed or inserted again with a
+    new string.
+    @param t Tree to add the key to.
+    @param key Key to add.
+    @param item Item to store with the key.
+*/
+void radixInsert(Radix *t, char const *key, void *item);
+
+/** Remove a key from the tree.
+    @param t Tree to remove the key from.
+    @param key Key to remove.
+    @return true if the key was in the tree.
+*/
+bool radixRemove(Radix *t, char const *key);
+
+/** Call a function on every key in the tree that starts with the given
+    prefix, in sorted order.  The function must not change the tree.
+    @param t Tree to search.
+    @param prefix Prefix to look for, the empty string matches every key.
+    @param fn Function to call for each matching key.
+    @param data Pointer passed to each call of fn.
+*/
+void radixPrefix(Radix const *t, char const *prefix, RadixVisitor fn, void *data);
+
+/** Free all the memory used by a tree.  The keys themselves belong to
+    the caller and aren't freed.
+    @param t The tree to free.
+*/
+void freeRadix(Radix *t);
+
+#endif
@@ -0,0 +1,344 @@
+/**
+    @file repl.c
+    @author Shlok Dave (ssdave)
+    Implementation for the repl component.  Each record is an op byte, a
+    keyspace byte, then the length and encoding of the key and of the value,
+    using the encoding from encodeValue.  The sending end only ever does
+    non-blocking writes, so a slow follower makes records pile up in memory
+    instead of holding up the leader.
+  */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "repl.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/** Bytes of records to build up before a write is worth doing. */
+#define REPL_BATCH 16384
+
+/** Most bytes of records a feed holds for a follower before giving up on it. */
+#define REPL_LIMIT (64 * 1024 * 1024)
+
+/** Bytes read from a stream at a time. */
+#define READ_CHUNK 65536
+
+/** Bytes in a record before the encoded key. */
+#define RECORD_HEAD 6
+
+/** A growable run of bytes. */
+typedef struct
+{
+  /** The bytes. */
+  unsigned char *data;
+
+  /** Number of bytes in use. */
+  size_t len;
+
+  /** Number of bytes allocated. */
+  size_t cap;
+} Buffer;
+
+/** Representation of the sending end of a stream. */
+struct ReplFeedStruct
+{
+  /** Descriptor the records are written to. */
+  int fd;
+
+  /** Records waiting to be written. */
+  Buffer out;
+
+  /** Number of bytes at the start of out that have already been written. */
+  size_t sent;
+
+  /** Records held back while a snapshot is being sent. */
+  Buffer held;
+
+  /** True while a snapshot is being sent. */
+  bool bootstrapping;
+};
+
+/** Representation of the receiving end of a stream. */
+struct ReplReaderStruct
+{
+  /** Descriptor the records are read from. */
+  int fd;
+
+  /** Bytes read that don't make up a whole record yet. */
+  Buffer in;
+
+  /** True if the last read found the end of the stream instead of waiting for more. */
+  bool ended;
+};
+
+/**
+  Helper function that makes sure a buffer has room for more bytes.
+  @param b the buffer.
+  @param n number of bytes that are about to be added.
+*/
+static void reserveBuffer(Buffer *b, size_t n)
+{
+  if (b->len + n <= b->cap)
+    return;
+
+  size_t cap = b->cap ? b->cap : READ_CHUNK;
+  while (cap < b->len + n)
+    cap *= 2;
+  b->data = realloc(b->data, cap);
+  b->cap = cap;
+}
+
+/**
+  Helper function that encodes a record onto the end of a buffer.
+  @param b the buffer.
+  @param op type of the record.
+  @param space keyspace the record is for.
+  @param key key of the record, or NULL.
+  @param val value of the record, or NULL.
+*/
+static void appendRecord(Buffer *b, char op, int space, Value const *key, Value const *val)
+{
+  uint32_t klen = key ? encodeValue(key, NULL, 0) : 0;
+  uint32_t vlen = val ? encodeValue(val, NULL, 0) : 0;
+  reserveBuffer(b, RECORD_HEAD + klen + sizeof(uint32_t) + vlen);
+
+  unsigned char *p = b->data + b->len;
+  p[0] = op;
+  p[1] = space;
+  memcpy(p + 2, &klen, sizeof(uint32_t));
+  if (key)
+    encodeValue(key, p + RECORD_HEAD, klen);
+  memcpy(p + RECORD_HEAD + klen, &vlen, sizeof(uint32_t));
+  if (val)
+    encodeValue(val, p + RECORD_HEAD + klen + sizeof(uint32_t), vlen);
+
+  b->len += RECORD_HEAD + klen + sizeof(uint32_t) + vlen;
+}
+
+/**
+  This function opens the sending end of a stream without blocking. A regular file is
+  emptied so it holds the stream from the start; a FIFO can only be opened once a follower
+  has it open for reading.
+  @param path name of the FIFO or file.
+  @return pointer to the new feed, or NULL if it couldn't be opened.
+*/
+ReplFeed *openFeed(char const *path)
+{
+  // A FIFO can't be opened this way until a follower has it open for reading.
+  int fd = open(path, O_WRONLY | O_CREAT | O_NONBLOCK, 0644);
+  if (fd < 0)
+    return NULL;
+
+  // A regular file gets the stream from the start.
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && ftruncate(fd, 0) != 0)
+  {
+    close(fd);
+    return NULL;
+  }
+
+  ReplFeed *feed = calloc(1, sizeof(ReplFeed));
+  feed->fd = fd;
+  return feed;
+}
+
+/**
+  This function adds a record to the feed's buffer. While a snapshot is being sent, it
+  goes in the held buffer instead, so it comes after the snapshot.
+  @param feed pointer to the feed.
+  @param op REPL_SET, REPL_REMOVE or REPL_CLEAR.
+  @param space keyspace the record is for.
+  @param key key of the record, or NULL for REPL_CLEAR.
+  @param val value of a REPL_SET record, or NULL.
+*/
+void feedRecord(ReplFeed *feed, char op, int space, Value const *key, Value const *val)
+{
+  appendRecord(feed->bootstrapping ? &feed->held : &feed->out, op, space, key, val);
+}
+
+/**
+  This function adds a pair from the starting snapshot to the feed, ahead of any held
+  records.
+  @param feed pointer to the feed.
+  @param space keyspace the pair is in.
+  @param key key of the pair.
+  @param val value of the pair.
+*/
+void feedSnapshotPair(ReplFeed *feed, int space, Value const *key, Value const *val)
+{
+  appendRecord(&feed->out, REPL_SET, space, key, val);
+}
+
+/**
+  This function starts holding back records, for while the snapshot is sent.
+  @param feed pointer to the feed.
+*/
+void feedBeginBootstrap(ReplFeed *feed)
+{
+  feed->bootstrapping = true;
+}
+
+/**
+  This function stops holding back records, moving the held ones in after the snapshot.
+  @param feed pointer to the feed.
+*/
+void feedEndBootstrap(ReplFeed *feed)
+{
+  reserveBuffer(&feed->out, feed->held.len);
+  memcpy(feed->out.data + feed->out.len, feed->held.data, feed->held.len);
+  feed->out.len += feed->held.len;
+  feed->held.len = 0;
+  feed->bootstrapping = false;
+}
+
+/**
+  This function writes as much of the buffered records as the follower will take without
+  blocking. Unless it's forced, nothing is written until a batch has built up.
+  @param feed pointer to the feed.
+  @param force true to write whatever is buffered, however little.
+  @return false if the follower can't be written to or has fallen too far behind.
+*/
+bool feedSend(ReplFeed *feed, bool force)
+{
+  size_t waiting = feed->out.len - feed->sent;
+  if (waiting + feed->held.len > REPL_LIMIT)
+    return false;
+  if (!force && waiting < REPL_BATCH)
+    return true;
+
+  while (feed->sent < feed->out.len)
+  {
+    ssize_t n = write(feed->fd, feed->out.data + feed->sent, feed->out.len - feed->sent);
+    if (n < 0)
+      return errno == EAGAIN;
+    feed->sent += n;
+  }
+
+  feed->out.len = 0;
+  feed->sent = 0;
+  return true;
+}
+
+/**
+  This function closes the feed. Records that haven't been sent are written first,
+  waiting for the follower if it has to, unless a snapshot is still being sent.
+  @param feed pointer to the feed to close.
+*/
+void closeFeed(ReplFeed *feed)
+{
+  // Wait for the follower to take whatever is left.
+  if (!feed->bootstrapping)
+  {
+    fcntl(feed->fd, F_SETFL, fcntl(feed->fd, F_GETFL) & ~O_NONBLOCK);
+    feedSend(feed, true);
+  }
+
+  close(feed->fd);
+  free(feed->out.data);
+  free(feed->held.data);
+  free(feed);
+}
+
+/**
+  This function opens the receiving end of a stream without blocking.
+  @param path name of the FIFO or file the records come from.
+  @return pointer to the new reader, or NULL if it couldn't be opened.
+*/
+ReplReader *openReader(char const *path)
+{
+  int fd = open(path, O_RDONLY | O_NONBLOCK);
+  if (fd < 0)
+    return NULL;
+
+  ReplReader *r = calloc(1, sizeof(ReplReader));
+  r->fd = fd;
+  return r;
+}
+
+/**
+  This function reads everything that has arrived on the stream, then applies each whole
+  record in it. The start of a record that hasn't all arrived is kept for next time.
+  @param r pointer to the reader.
+  @param fn function called to apply each record.
+  @param data pointer passed along to every call of fn.
+  @return number of records applied.
+*/
+int readerPoll(ReplReader *r, ReplApply fn, void *data)
+{
+  // Take everything that's there right now.
+  while (true)
+  {
+    reserveBuffer(&r->in, READ_CHUNK);
+    ssize_t n = read(r->fd, r->in.data + r->in.len, r->in.cap - r->in.len);
+    if (n <= 0)
+    {
+      r->ended = n == 0;
+      break;
+    }
+    r->in.len += n;
+  }
+
+  int applied = 0;
+  size_t pos = 0;
+  while (r->in.len - pos >= RECORD_HEAD)
+  {
+    unsigned char *p = r->in.data + pos;
+    uint32_t klen, vlen;
+    memcpy(&klen, p + 2, sizeof(uint32_t));
+    if (r->in.len - pos < RECORD_HEAD + klen + sizeof(uint32_t))
+      break;
+    memcpy(&vlen, p + RECORD_HEAD + klen, sizeof(uint32_t));
+    size_t size = RECORD_HEAD + klen + sizeof(uint32_t) + vlen;
+    if (r->in.len - pos < size)
+      break;
+
+    // Decode the key and value that the record has.
+    Value key, val;
+    bool hasKey = klen > 0 && decodeValue(&key, p + RECORD_HEAD, klen);
+    bool hasVal = vlen > 0 && decodeValue(&val, p + RECORD_HEAD + klen + sizeof(uint32_t), vlen);
+    fn(p[0], p[1], hasKey ? &key : NULL, hasVal ? &val : NULL, data);
+    applied++;
+    pos += size;
+  }
+
+  // Keep the start of a record that hasn't all arrived yet.
+  memmove(r->in.data, r->in.data + pos, r->in.len - pos);
+  r->in.len -= pos;
+  return applied;
+}
+
+/**
+  This function gives the descriptor the reader reads from.
+  @param r pointer to the reader.
+  @return the descriptor.
+*/
+int readerFd(ReplReader const *r)
+{
+  return r->fd;
+}
+
+/**
+  This function tells whether the last poll found the end of the stream.
+  @param r pointer to the reader.
+  @return true if the last read got nothing back instead of having to wait.
+*/
+bool readerAtEnd(ReplReader const *r)
+{
+  return r->ended;
+}
+
+/**
+  This function closes the reader and frees any part of a record it was holding.
+  @param r pointer to the reader to close.
+*/
+void closeReader(ReplReader *r)
+{
+  close(r->fd);
+  free(r->in.data);
+  free(r);
+}
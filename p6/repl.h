@@ -0,0 +1,129 @@
+/**
+    @file repl.h
+    @author Shlok Dave (ssdave)
+    Header for the repl component, which sends the changes made to a set of
+    maps to a follower as a stream of binary records, and reads them back on
+    the follower's side.
+*/
+
+#ifndef REPL_H
+#define REPL_H
+
+#include "value.h"
+#include <stdbool.h>
+
+/** Record for a key being set. */
+#define REPL_SET 'S'
+
+/** Record for a key being removed. */
+#define REPL_REMOVE 'R'
+
+/** Record for a whole keyspace being emptied. */
+#define REPL_CLEAR 'C'
+
+/** Incomplete type for the sending end of a stream. */
+typedef struct ReplFeedStruct ReplFeed;
+
+/** Incomplete type for the receiving end of a stream. */
+typedef struct ReplReaderStruct ReplReader;
+
+/** Type for a function that applies a record read from a stream.
+    @param op REPL_SET, REPL_REMOVE or REPL_CLEAR.
+    @param space Keyspace the record is for.
+    @param key Key of the record, which the function takes ownership of,
+    or NULL for REPL_CLEAR.
+    @param val Value of a REPL_SET record, which the function takes
+    ownership of, or NULL.
+    @param data Pointer given to readerPoll.
+*/
+typedef void (*ReplApply)(char op, int space, Value *key, Value *val, void *data);
+
+/** Open the sending end of a stream.  Writes to it never block; records
+    are buffered until the follower can take them.
+    @param path Name of a FIFO a follower is reading, or of a regular
+    file to write the records to.
+    @return the new feed, or NULL if it couldn't be opened.
+*/
+ReplFeed *openFeed(char const *path);
+
+/** Add a record to a feed.  While the feed is bootstrapping, records are
+    held back until feedEndBootstrap, so they come after the snapshot.
+    @param feed Feed to add the record to.
+    @param op REPL_SET, REPL_REMOVE or REPL_CLEAR.
+    @param space Keyspace the record is for.
+    @param key Key of the record, or NULL for REPL_CLEAR.
+    @param val Value of a REPL_SET record, or NULL.
+*/
+void feedRecord(ReplFeed *feed, char op, int space, Value const *key, Value const *val);
+
+/** Add a pair from the snapshot that starts a feed.  These records go
+    ahead of any that are held back.
+    @param feed Feed being bootstrapped.
+    @param space Keyspace the pair is in.
+    @param key Key of the pair.
+    @param val Value of the pair.
+*/
+void feedSnapshotPair(ReplFeed *feed, int space, Value const *key, Value const *val);
+
+/** Start holding back records added with feedRecord.
+    @param feed Feed that's about to send a snapshot.
+*/
+void feedBeginBootstrap(ReplFeed *feed);
+
+/** Stop holding back records, sending the held ones after the snapshot.
+    @param feed Feed that's done sending a snapshot.
+*/
+void feedEndBootstrap(ReplFeed *feed);
+
+/** Write out as much of a feed's buffered records as the follower will
+    take without blocking.
+    @param feed Feed to write.
+    @param force If false, nothing is written until enough records have
+    built up to be worth a write.
+    @return false if the follower can't be written to anymore.
+*/
+bool feedSend(ReplFeed *feed, bool force);
+
+/** Close a feed, waiting for the follower to take any records that
+    haven't been sent yet.  If a snapshot is still being sent, the feed is
+    closed right away, since the follower couldn't use part of one.
+    @param feed Feed to close.
+*/
+void closeFeed(ReplFeed *feed);
+
+/** Open the receiving end of a stream.
+    @param path Name of the FIFO or file the records come from.
+    @return the new reader, or NULL if it couldn't be opened.
+*/
+ReplReader *openReader(char const *path);
+
+/** Apply every whole record that has arrived, without waiting for more.
+    @param r Reader to get the records from.
+    @param fn Function to apply each record.
+    @param data Pointer passed to each call of fn.
+    @return number of records applied.
+*/
+int readerPoll(ReplReader *r, ReplApply fn, void *data);
+
+/** Get the descriptor a reader reads from, so a caller can wait for
+    records to arrive.
+    @param r The reader.
+    @return the descriptor.
+*/
+int readerFd(ReplReader const *r);
+
+/** Tell whether the last poll reached the end of the stream: the leader
+    closed the FIFO or the file has no more records yet.  Waiting on the
+    descriptor then returns right away, so a caller should check back
+    later instead.
+    @param r The reader.
+    @return true at the end of the stream.
+*/
+bool readerAtEnd(ReplReader const *r);
+
+/** Close a reader.
+    @param r Reader to close.
+*/
+void closeReader(ReplReader *r);
+
+#endif
@@ -71,6 +71,151 @@ int main()
   s6.print( &s6 );
   printf( "\n" );
   
+  // Equal strings share one copy once they're interned, and keep their hashes.
+  StringPool *pool = makePool();
+  Value t1, t2;
+  parseString( &t1, "\"abc\"" );
+  parseString( &t2, "\"abc\"" );
+  internString( &t1, pool );
+  internString( &t2, pool );
+  assert( t1.vptr == t2.vptr );
+  assert( t1.equals( &t1, &t2 ) );
+  assert( t1.equals( &t1, &s1 ) && s1.equals( &s1, &t1 ) );
+  assert( ! t1.equals( &t1, &s3 ) );
+  assert( t1.hash( &t1 ) == 0xED131F5B );
+  t1.empty( &t1 );
+  assert( strcmp( valueString( &t2 ), "abc" ) == 0 );
+  t2.empty( &t2 );
+  freePool( pool );
+
+  // Numbers are parsed into the narrowest type that holds them.
+  Value n1, n2, n3;
+  n = parseNumber( &n1, " -42 " );
+  assert( n == 4 && valueIsInteger( &n1 ) && n1.ival == -42 );
+  n = parseNumber( &n2, "1700000000123" );
+  assert( n == 13 && ! valueIsInteger( &n2 ) && n2.lval == 1700000000123LL );
+  assert( valueIsInline( &n2 ) );
+  n = parseNumber( &n3, "-9223372036854775808" );
+  assert( n == 20 && n3.lval == INT64_MIN );
+  assert( ! n2.equals( &n2, &n3 ) && ! n2.equals( &n2, &n1 ) );
+  setLong( &n3, 1700000000123LL );
+  assert( n2.equals( &n2, &n3 ) && n2.hash( &n2 ) == n3.hash( &n3 ) );
+  setLong( &n3, 7 );
+  assert( valueIsInteger( &n3 ) );
+
+  // Fractions and exponents make doubles, read exactly.
+  n = parseNumber( &n1, "2.5x" );
+  assert( n == 3 && n1.dval == 2.5 && ! valueIsInteger( &n1 ) );
+  n = parseNumber( &n1, "0.001" );
+  assert( n == 5 && n1.dval == 0.001 );
+  n = parseNumber( &n1, "-1.25e3" );
+  assert( n == 7 && n1.dval == -1250 );
+  n = parseNumber( &n1, "6e" );
+  assert( n == 1 && valueIsInteger( &n1 ) );
+  n = parseNumber( &n1, "3.14159265358979323846264" );
+  assert( n == 25 && n1.dval == 3.14159265358979323846264 );
+  n = parseNumber( &n1, "123456789012345678901234567890" );
+  assert( n == 30 && n1.dval == 123456789012345678901234567890.0 );
+  parseNumber( &n1, "0.0" );
+  parseNumber( &n2, "-0.0" );
+  assert( n1.equals( &n1, &n2 ) && n1.hash( &n1 ) == n2.hash( &n2 ) );
+  assert( parseNumber( &n1, "abc" ) == 0 && parseNumber( &n1, "-.x" ) == 0 );
+  assert( parseNumber( &n1, "1e400" ) == 0 && parseNumber( &n1, "-1e400" ) == 0 );
+  n = parseNumber( &n1, "1.7976931348623157e308" );
+  assert( n == 22 && n1.dval == 1.7976931348623157e308 );
+  assert( parseInteger( &n1, "3000000000" ) == 0 );
+
+  // Doubles written out the way a save writes them parse back as the same number.
+  double samples[] = { 1.5e300, -2.5e-310, 0.1, 1.7976931348623157e308, 1e22 };
+  FILE *fp = tmpfile();
+  for ( int i = 0; i < 5; i++ ) {
+    setDouble( &n1, samples[ i ] );
+    writeValue( &n1, fp );
+    fprintf( fp, "\n" );
+  }
+  rewind( fp );
+  char word[ 64 ];
+  for ( int i = 0; i < 5; i++ ) {
+    assert( fscanf( fp, "%63s", word ) == 1 );
+    assert( parseNumber( &n1, word ) == strlen( word ) && n1.dval == samples[ i ] );
+  }
+  fclose( fp );
+
+  // Numbers survive being encoded and decoded.
+  unsigned char bytes[ 16 ];
+  parseNumber( &n1, "-5000000000" );
+  int len = encodeValue( &n1, bytes, sizeof( bytes ) );
+  assert( len < 1 + 8 );
+  assert( decodeValue( &n2, bytes, len ) == len && n1.equals( &n1, &n2 ) );
+  setDouble( &n1, 0.1 );
+  len = encodeValue( &n1, bytes, sizeof( bytes ) );
+  assert( decodeValue( &n2, bytes, len ) == len && n2.dval == 0.1 );
+  assert( decodeValue( &n2, bytes, len - 1 ) == 0 );
+
+  // Strings can be longer than a line buffer, and large ones compress.
+  int big = 5000;
+  char *text = malloc( big + 3 );
+  text[ 0 ] = '"';
+  char const *blob = "{'id': 1, 'tags': [a, b]} ";
+  for ( int i = 0; i < big; i++ )
+    text[ i + 1 ] = blob[ i % strlen( blob ) ];
+  text[ big + 1 ] = '"';
+  text[ big + 2 ] = '\0';
+  Value c1, c2, c3[ 6 ];
+  assert( parseString( &c1, text ) == big + 2 );
+  assert( parseString( &c2, text ) == big + 2 );
+  unsigned int plainHash = c2.hash( &c2 );
+  compressString( &c1, 256 );
+  assert( c1.print != c2.print && c1.hash( &c1 ) == plainHash );
+  assert( c1.equals( &c1, &c2 ) && c2.equals( &c2, &c1 ) );
+  assert( strlen( valueString( &c1 ) ) == big );
+  assert( memcmp( valueString( &c1 ), text + 1, big ) == 0 );
+  compressString( &c2, 256 );
+  assert( c1.equals( &c1, &c2 ) );
+
+  // More compressed strings than the cache holds still read back right.
+  for ( int i = 0; i < 6; i++ ) {
+    text[ 1 ] = 'A' + i;
+    parseString( &c3[ i ], text );
+    compressString( &c3[ i ], 256 );
+  }
+  for ( int round = 0; round < 2; round++ )
+    for ( int i = 0; i < 6; i++ )
+      assert( valueString( &c3[ i ] )[ 0 ] == 'A' + i );
+  assert( ! c3[ 0 ].equals( &c3[ 0 ], &c3[ 1 ] ) && ! c1.equals( &c1, &c3[ 0 ] ) );
+  for ( int i = 0; i < 6; i++ )
+    c3[ i ].empty( &c3[ i ] );
+
+  // Short strings, and ones that don't shrink, stay as they are.
+  Value c4;
+  parseString( &c4, "\"short\"" );
+  compressString( &c4, 256 );
+  assert( c4.print == s1.print );
+  c4.empty( &c4 );
+  unsigned int state = 2463534242u;
+  for ( int i = 0; i < big; i++ ) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    text[ i + 1 ] = 'a' + state % 26;
+  }
+  parseString( &c4, text );
+  compressString( &c4, 256 );
+  assert( c4.print == s1.print );
+  c4.empty( &c4 );
+  c1.empty( &c1 );
+  c2.empty( &c2 );
+
+  // Once the last compressed string is gone the cache is freed, and it comes back
+  // for the next one.
+  for ( int i = 0; i < big; i++ )
+    text[ i + 1 ] = 'a' + i % 3;
+  parseString( &c4, text );
+  compressString( &c4, 256 );
+  assert( c4.print != s1.print && valueString( &c4 )[ big - 1 ] == 'a' + ( big - 1 ) % 3 );
+  c4.empty( &c4 );
+  free( text );
+
   // Free memory in all he string values.
   s1.empty( &s1 );
   s2.empty( &s2 );
@@ -190,6 +190,15 @@ if [ -x driver ]; then
     runTest 07
     runTest 08
     runTest 09
+    runTest 10
+    runTest 11
+    runTest 12
+    runTest 13
+    runTest 14
+    runTest 15
+    runTest 16
+    runTest 17
+    runTest 18
 else
     fail "Your driver program didn't compile, so it couldn't be tested."
 fi
@@ -0,0 +1,229 @@
+/**
+    @file trace.c
+    @author Shlok Dave (ssdave)
+    Implementation for the trace component.  A trace starts with a short
+    header, and then has a record for each command: the time since the
+    command before it, the length of the command and the command itself,
+    then the length of its output and the output.  Times and lengths are
+    written as variable-length integers, seven bits to a byte, so a trace
+    of small commands arriving close together stays small.
+  */
+
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Bytes every trace starts with. */
+#define TRACE_MAGIC "P6TRACE1"
+
+/** Number of bytes in TRACE_MAGIC. */
+#define MAGIC_LEN 8
+
+/** Most bytes a variable-length 64-bit integer can take. */
+#define VARINT_MAX 10
+
+/** Representation of a trace being written. */
+struct TraceWriterStruct
+{
+  /** File the trace goes to. */
+  FILE *fp;
+
+  /** Time of the last command added. */
+  uint64_t last;
+};
+
+/** Representation of a trace being read. */
+struct TraceReaderStruct
+{
+  /** File the trace comes from. */
+  FILE *fp;
+
+  /** Time of the last command read. */
+  uint64_t last;
+
+  /** Memory for the command last read. */
+  char *comm;
+
+  /** Capacity of comm. */
+  size_t commCap;
+
+  /** Memory for the output of the command last read. */
+  char *out;
+
+  /** Capacity of out. */
+  size_t outCap;
+};
+
+/**
+  Helper function that writes a variable-length integer, low bits first, with the
+  top bit of each byte set if more bytes follow.
+  @param fp the file to write to.
+  @param v the integer.
+*/
+static void writeVarint(FILE *fp, uint64_t v)
+{
+  unsigned char buf[VARINT_MAX];
+  int len = 0;
+  do
+  {
+    buf[len] = v & 0x7F;
+    v >>= 7;
+    if (v)
+      buf[len] |= 0x80;
+    len++;
+  } while (v);
+  fwrite(buf, 1, len, fp);
+}
+
+/**
+  Helper function that reads a variable-length integer written by writeVarint.
+  @param fp the file to read from.
+  @param v filled in with the integer.
+  @return false if the file ended first.
+*/
+static bool readVarint(FILE *fp, uint64_t *v)
+{
+  *v = 0;
+  for (int shift = 0; shift < 7 * VARINT_MAX; shift += 7)
+  {
+    int ch = getc(fp);
+    if (ch == EOF)
+      return false;
+    *v |= (uint64_t)(ch & 0x7F) << shift;
+    if (!(ch & 0x80))
+      return true;
+  }
+  return false;
+}
+
+/**
+  Helper function that reads a length and then that many bytes into a buffer that
+  grows as needed. A null byte is put after them.
+  @param fp the file to read from.
+  @param buf the buffer, which may be moved.
+  @param cap capacity of the buffer.
+  @param len filled in with the number of bytes read.
+  @return false if the file ended first.
+*/
+static bool readBytes(FILE *fp, char **buf, size_t *cap, size_t *len)
+{
+  uint64_t n;
+  if (!readVarint(fp, &n))
+    return false;
+
+  if (n + 1 > *cap)
+  {
+    *cap = n + 1;
+    *buf = realloc(*buf, *cap);
+  }
+  *len = n;
+  (*buf)[n] = '\0';
+  return fread(*buf, 1, n, fp) == n;
+}
+
+/**
+  This function creates a trace file and writes its header.
+  @param path name of the file.
+  @return the trace, or NULL if the file couldn't be created.
+*/
+TraceWriter *openTrace(char const *path)
+{
+  FILE *fp = fopen(path, "wb");
+  if (!fp)
+    return NULL;
+  fwrite(TRACE_MAGIC, 1, MAGIC_LEN, fp);
+
+  TraceWriter *w = calloc(1, sizeof(TraceWriter));
+  w->fp = fp;
+  return w;
+}
+
+/**
+  This function adds a record for a command to the end of the trace. Only the time
+  since the last command is stored, which is usually a small number.
+  @param w the trace.
+  @param when nanoseconds since the trace started that the command arrived.
+  @param comm the command.
+  @param out output of the command.
+  @param outLen number of bytes of output.
+*/
+void traceCommand(TraceWriter *w, uint64_t when, char const *comm, char const *out,
+                  size_t outLen)
+{
+  writeVarint(w->fp, when - w->last);
+  w->last = when;
+
+  size_t len = strlen(comm);
+  writeVarint(w->fp, len);
+  fwrite(comm, 1, len, w->fp);
+  writeVarint(w->fp, outLen);
+  fwrite(out, 1, outLen, w->fp);
+}
+
+/**
+  This function closes a trace that was being written.
+  @param w the trace.
+*/
+void closeTrace(TraceWriter *w)
+{
+  fclose(w->fp);
+  free(w);
+}
+
+/**
+  This function opens a trace to read, checking its header.
+  @param path name of the file.
+  @return the trace, or NULL if it can't be read as one.
+*/
+TraceReader *openTraceReader(char const *path)
+{
+  FILE *fp = fopen(path, "rb");
+  if (!fp)
+    return NULL;
+
+  char magic[MAGIC_LEN];
+  if (fread(magic, 1, MAGIC_LEN, fp) != MAGIC_LEN || memcmp(magic, TRACE_MAGIC, MAGIC_LEN) != 0)
+  {
+    fclose(fp);
+    return NULL;
+  }
+
+  TraceReader *r = calloc(1, sizeof(TraceReader));
+  r->fp = fp;
+  return r;
+}
+
+/**
+  This function reads the next record of a trace. A record that's cut short counts
+  as the end of the trace.
+  @param r the trace.
+  @param e filled in with the record.
+  @return false if there are no more records.
+*/
+bool traceNext(TraceReader *r, TraceEntry *e)
+{
+  uint64_t delta;
+  size_t len;
+  if (!readVarint(r->fp, &delta) || !readBytes(r->fp, &r->comm, &r->commCap, &len) ||
+      !readBytes(r->fp, &r->out, &r->outCap, &e->outLen))
+    return false;
+
+  r->last += delta;
+  e->when = r->last;
+  e->comm = r->comm;
+  e->out = r->out;
+  return true;
+}
+
+/**
+  This function closes a trace that was being read.
+  @param r the trace.
+*/
+void closeTraceReader(TraceReader *r)
+{
+  fclose(r->fp);
+  free(r->comm);
+  free(r->out);
+  free(r);
+}
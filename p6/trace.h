@@ -0,0 +1,81 @@
+/**
+    @file trace.h
+    @author Shlok Dave (ssdave)
+    Header for the trace component, which records the commands given to
+    the driver with the time each one arrived and the output it produced,
+    and reads them back so the same load can be replayed later.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Incomplete type for a trace being written. */
+typedef struct TraceWriterStruct TraceWriter;
+
+/** Incomplete type for a trace being read. */
+typedef struct TraceReaderStruct TraceReader;
+
+/** One command read back from a trace. */
+typedef struct
+{
+  /** Nanoseconds after the start of the trace that the command arrived. */
+  uint64_t when;
+
+  /** The command, null-terminated. */
+  char *comm;
+
+  /** Output the command produced, which may contain null bytes. */
+  char *out;
+
+  /** Number of bytes of output. */
+  size_t outLen;
+} TraceEntry;
+
+/** Create a trace file, replacing any file that's already there.
+    @param path Name of the file.
+    @return the new trace, or NULL if the file couldn't be created.
+*/
+TraceWriter *openTrace(char const *path);
+
+/** Add a command to a trace.  Commands have to be added in the order
+    they arrived.
+    @param w Trace to add to.
+    @param when Nanoseconds after the start of the trace that the command
+    arrived.
+    @param comm The command.
+    @param out Output the command produced.
+    @param outLen Number of bytes of output.
+*/
+void traceCommand(TraceWriter *w, uint64_t when, char const *comm, char const *out,
+                  size_t outLen);
+
+/** Finish writing a trace and close it.
+    @param w Trace to close.
+*/
+void closeTrace(TraceWriter *w);
+
+/** Open a trace to read back.
+    @param path Name of the file.
+    @return the trace, or NULL if the file couldn't be opened or isn't a
+    trace.
+*/
+TraceReader *openTraceReader(char const *path);
+
+/** Read the next command of a trace.
+    @param r Trace to read.
+    @param e Filled in with the command, using memory the reader keeps
+    until the next call.
+    @return false once there are no more commands.
+*/
+bool traceNext(TraceReader *r, TraceEntry *e);
+
+/** Close a trace that was being read.
+    @param r Trace to close.
+*/
+void closeTraceReader(TraceReader *r);
+
+#endif
@@ -1,17 +1,58 @@
 /**
     @file value.c
     @author Shlok Dave (ssdave)
-    Implementation for the value component, with support for integer
-    and (eventually) string values.
+    Implementation for the value component, with support for integer,
+    64-bit integer, floating-point and string values.
   */
 
 #include "value.h"
+#include "lz.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <math.h>
 
-#define BUFFER_SIZE 1024
+/** First byte of an encoded integer. */
+#define INT_TAG 'i'
+
+/** First byte of an encoded 64-bit integer. */
+#define LONG_TAG 'l'
+
+/** First byte of an encoded double. */
+#define DOUBLE_TAG 'd'
+
+/** Most bytes a 64-bit integer takes once it's encoded seven bits to a byte. */
+#define VARINT_MAX 10
+
+/** Most digits kept in the mantissa of a parsed number; 19 always fit in 64 bits. */
+#define MANTISSA_DIGITS 19
+
+/** Largest power of ten a double holds exactly. */
+#define EXACT_POW10 22
+
+/** Largest mantissa a double holds exactly. */
+#define EXACT_MANTISSA (1ULL << 53)
+
+/** Digits printed for a double when fewer don't read back as the same number. */
+#define DOUBLE_DIGITS 17
+
+/** Digits tried first when printing a double. */
+#define SHORT_DIGITS 15
+
+/** Length of a buffer big enough for any number we print. */
+#define NUMBER_LEN 32
+
+/** Number of compressed strings kept decompressed at a time. */
+#define CACHE_SLOTS 4
+
+/** Exponents further than this from zero all give zero or infinity anyway. */
+#define EXPONENT_LIMIT 100000
+
+/** First byte of an encoded string. */
+#define STRING_TAG 's'
 
 //////////////////////////////////////////////////////////
 // Integer implementation.
@@ -60,13 +101,8 @@ static void emptyInteger(Value *v)
   // An int vaue doesn't need any additional memory.
 }
 
-int parseInteger(Value *v, char const *str)
+void setInteger(Value *v, int val)
 {
-  // Try to parse an integer from str.
-  int val, len;
-  if (sscanf(str, "%d%n", &val, &len) != 1)
-    return 0;
-
   // Fill in all the fields of v for an integer type of value.
   v->print = printInteger;
   v->move = moveInteger;
@@ -74,9 +110,300 @@ int parseInteger(Value *v, char const *str)
   v->hash = hashInteger;
   v->empty = emptyInteger;
   v->ival = val;
+}
+
+/** Digits of a number as they're parsed. */
+typedef struct
+{
+  /** The digits that were kept, as an integer. */
+  uint64_t digits;
+
+  /** Number of digits kept after the leading zeros. */
+  int kept;
+
+  /** Number of digits added to the mantissa, leading zeros included. */
+  int used;
+
+  /** Number of digits left out because there were too many. */
+  int dropped;
+} Mantissa;
+
+/**
+  Helper function that reads a run of decimal digits into a mantissa. Digits past the
+  first MANTISSA_DIGITS are only counted, since they can't change a double and would
+  overflow an integer.
+  @param p first character of the run.
+  @param m mantissa the digits are added to.
+  @return the first character after the run.
+*/
+static char const *readDigits(char const *p, Mantissa *m)
+{
+  for (; *p >= '0' && *p <= '9'; p++)
+  {
+    if (m->kept < MANTISSA_DIGITS)
+    {
+      m->digits = m->digits * 10 + (*p - '0');
+      m->used++;
+
+      // Leading zeros don't use up any of the mantissa.
+      if (m->digits)
+        m->kept++;
+    }
+    else
+      m->dropped++;
+  }
+  return p;
+}
+
+int parseInteger(Value *v, char const *str)
+{
+  // Skip leading space and an optional sign, then read the digits.
+  char const *p = str;
+  while (isspace((unsigned char)*p))
+    p++;
+  bool neg = *p == '-';
+  if (*p == '-' || *p == '+')
+    p++;
+
+  Mantissa m = {0, 0, 0, 0};
+  char const *end = readDigits(p, &m);
+  if (end == p || m.dropped || m.digits > (neg ? (uint64_t)INT_MAX + 1 : (uint64_t)INT_MAX))
+    return 0;
+
+  setInteger(v, neg ? (int)-(int64_t)m.digits : (int)m.digits);
 
   // Return how much of str we parsed.
-  return len;
+  return end - str;
+}
+
+//////////////////////////////////////////////////////////
+// 64-bit integer implementation.
+
+// Print method for 64-bit integers.
+static void printLong(Value const *v)
+{
+  printf("%" PRId64, v->lval);
+}
+
+// Move method for 64-bit integers.
+static void moveLong(Value const *src, Value *dest)
+{
+  dest->lval = src->lval;
+
+  dest->print = src->print;
+  dest->move = src->move;
+  dest->equals = src->equals;
+  dest->hash = src->hash;
+  dest->empty = src->empty;
+}
+
+// Equals method for 64-bit integers.
+static bool equalsLong(Value const *v, Value const *other)
+{
+  // Numbers that fit in an int are never stored this way, so only another
+  // 64-bit integer can be equal.
+  if (other->print != printLong)
+    return false;
+
+  return v->lval == other->lval;
+}
+
+// Hash method for 64-bit integers.
+static unsigned int hashLong(Value const *v)
+{
+  // Fold the high half into the low one, so every bit counts.
+  uint64_t x = v->lval;
+  return (unsigned int)(x ^ (x >> 32));
+}
+
+void setLong(Value *v, int64_t val)
+{
+  if (val >= INT_MIN && val <= INT_MAX)
+  {
+    setInteger(v, (int)val);
+    return;
+  }
+
+  v->print = printLong;
+  v->move = moveLong;
+  v->equals = equalsLong;
+  v->hash = hashLong;
+  v->empty = emptyInteger;
+  v->lval = val;
+}
+
+//////////////////////////////////////////////////////////
+// Double implementation.
+
+/**
+  Helper function that writes a double so it reads back as the same number, and
+  always as a double: it gets a decimal point if it wouldn't have one otherwise.
+  @param fp file to write to.
+  @param d the number.
+*/
+static void writeDouble(FILE *fp, double d)
+{
+  // Use the shorter form when it doesn't lose anything.
+  char buffer[NUMBER_LEN];
+  snprintf(buffer, sizeof(buffer), "%.*g", SHORT_DIGITS, d);
+  if (strtod(buffer, NULL) != d)
+    snprintf(buffer, sizeof(buffer), "%.*g", DOUBLE_DIGITS, d);
+
+  if (strpbrk(buffer, ".en"))
+    fprintf(fp, "%s", buffer);
+  else
+    fprintf(fp, "%s.0", buffer);
+}
+
+// Print method for doubles.
+static void printDouble(Value const *v)
+{
+  writeDouble(stdout, v->dval);
+}
+
+// Move method for doubles.
+static void moveDouble(Value const *src, Value *dest)
+{
+  dest->dval = src->dval;
+
+  dest->print = src->print;
+  dest->move = src->move;
+  dest->equals = src->equals;
+  dest->hash = src->hash;
+  dest->empty = src->empty;
+}
+
+// Equals method for doubles.
+static bool equalsDouble(Value const *v, Value const *other)
+{
+  if (other->print != printDouble)
+    return false;
+
+  return v->dval == other->dval;
+}
+
+// Hash method for doubles.
+static unsigned int hashDouble(Value const *v)
+{
+  // Zero and negative zero are equal, so they have to hash the same.
+  double d = v->dval == 0 ? 0 : v->dval;
+  uint64_t x;
+  memcpy(&x, &d, sizeof(x));
+  x *= 0x9E3779B97F4A7C15ULL;
+  return (unsigned int)(x >> 32);
+}
+
+void setDouble(Value *v, double val)
+{
+  v->print = printDouble;
+  v->move = moveDouble;
+  v->equals = equalsDouble;
+  v->hash = hashDouble;
+  v->empty = emptyInteger;
+  v->dval = val;
+}
+
+/**
+  Helper function that turns a parsed mantissa and power of ten into a double. When
+  both are small enough to be exact, one multiply or divide gives the correctly
+  rounded answer; anything else goes to strtod, which is slower but always right.
+  @param start first character of the number, including its sign.
+  @param end first character after the number.
+  @param mant the digits that were kept.
+  @param exp10 power of ten the mantissa is scaled by.
+  @param exact true if no digits were dropped from the mantissa.
+  @return the number.
+*/
+static double toDouble(char const *start, char const *end, uint64_t mant, int exp10, bool exact)
+{
+  static double const pow10[EXACT_POW10 + 1] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+  bool neg = *start == '-';
+  if (exact && mant <= EXACT_MANTISSA && exp10 >= -EXACT_POW10 && exp10 <= EXACT_POW10)
+  {
+    double d = exp10 < 0 ? (double)mant / pow10[-exp10] : (double)mant * pow10[exp10];
+    return neg ? -d : d;
+  }
+
+  // strtod would read more than we did from something like 0x1p3, so give it a copy.
+  char local[NUMBER_LEN * 2];
+  int len = end - start;
+  char *copy = len < (int)sizeof(local) ? local : malloc(len + 1);
+  memcpy(copy, start, len);
+  copy[len] = '\0';
+  double d = strtod(copy, NULL);
+  if (copy != local)
+    free(copy);
+  return d;
+}
+
+int parseNumber(Value *v, char const *str)
+{
+  char const *p = str;
+  while (isspace((unsigned char)*p))
+    p++;
+  char const *start = p;
+  bool neg = *p == '-';
+  if (*p == '-' || *p == '+')
+    p++;
+
+  // The whole part. Digits dropped from it still scale the number up.
+  Mantissa m = {0, 0, 0, 0};
+  char const *digits = p;
+  p = readDigits(p, &m);
+  bool any = p > digits;
+  int exp10 = m.dropped;
+  bool isDouble = false;
+
+  // A fraction, which needs at least one digit after the point. Each of its digits
+  // that made it into the mantissa scales the number down.
+  if (*p == '.' && p[1] >= '0' && p[1] <= '9')
+  {
+    int used = m.used;
+    p = readDigits(p + 1, &m);
+    exp10 -= m.used - used;
+    any = isDouble = true;
+  }
+  if (!any)
+    return 0;
+
+  // An exponent, only if it has digits; otherwise the e isn't part of the number.
+  if (*p == 'e' || *p == 'E')
+  {
+    char const *q = p + 1;
+    bool eneg = *q == '-';
+    if (*q == '-' || *q == '+')
+      q++;
+    if (*q >= '0' && *q <= '9')
+    {
+      int e = 0;
+      for (; *q >= '0' && *q <= '9'; q++)
+      {
+        if (e < EXPONENT_LIMIT)
+          e = e * 10 + (*q - '0');
+      }
+      exp10 += eneg ? -e : e;
+      p = q;
+      isDouble = true;
+    }
+  }
+
+  if (!isDouble && !m.dropped &&
+      m.digits <= (neg ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX))
+  {
+    setLong(v, neg ? -(int64_t)(m.digits - 1) - 1 : (int64_t)m.digits);
+    return p - str;
+  }
+
+  // A number too big for a double would be infinity, which isn't written back out as
+  // something that parses again, so it's turned away here.
+  double d = toDouble(start, p, m.digits, exp10, !m.dropped);
+  if (!isfinite(d))
+    return 0;
+  setDouble(v, d);
+  return p - str;
 }
 
 // Print method for String.
@@ -103,6 +430,10 @@ static void moveString(Value const *src, Value *dest)
 // Equals method for String.
 static bool equalsString(Value const *v, Value const *other)
 {
+  // Make sure the other object is also some kind of string.
+  if (!valueString(other))
+    return false;
+
   // Null pointer check.
   if (v->vptr == NULL || other->vptr == NULL)
   {
@@ -110,8 +441,8 @@ static bool equalsString(Value const *v, Value const *other)
     return v->vptr == other->vptr;
   }
 
-  // Strings are compared with each other.
-  return strcmp((char *)v->vptr, (char *)other->vptr) == 0;
+  // Strings are compared with each other, by their characters however they're stored.
+  return strcmp(valueString(v), valueString(other)) == 0;
 }
 
 // Hash method for String.
@@ -174,18 +505,19 @@ int parseString(Value *v, char const *str)
     posString++;
   }
 
-  // Parsing the String here.
-  char newBuff[BUFFER_SIZE];
-  int count = 0;
-  if (sscanf(posString, "\"%1023[^\"]\"%n", newBuff, &count) != 1)
+  // Parsing the String here, which can be any length but can't be empty.
+  char const *endString = *posString == '\"' ? strchr(posString + 1, '\"') : NULL;
+  if (endString == NULL || endString == posString + 1)
   {
     return 0;
   }
+  int len = endString - posString - 1;
+  int count = len + 2;
 
   // Copy the new string for memory allocation.
-  char *copyNewString = malloc(strlen(newBuff) + 1);
-  strcpy(copyNewString, newBuff);
-  v->vptr = copyNewString;
+  char *copyNewString = malloc(len + 1);
+  memcpy(copyNewString, posString + 1, len);
+  copyNewString[len] = '\0';
 
   // Value struct copying process.
   v->vptr = copyNewString;
@@ -197,4 +529,507 @@ int parseString(Value *v, char const *str)
 
   // Returns the characters processed.
   return posString - str + count;
-}
\ No newline at end of file
+}
+
+//////////////////////////////////////////////////////////
+// Interned string implementation.
+
+// Print method for interned strings.
+static void printInterned(Value const *v)
+{
+  printf("\"%s\"", (char *)v->vptr);
+}
+
+// Equals method for interned strings.
+static bool equalsInterned(Value const *v, Value const *other)
+{
+  // Strings from the same pool are equal only if they're the same copy.
+  if (other->print == printInterned && poolOf(v->vptr) == poolOf(other->vptr))
+    return v->vptr == other->vptr;
+
+  return equalsString(v, other);
+}
+
+// Hash method for interned strings.
+static unsigned int hashInterned(Value const *v)
+{
+  // The pool kept the hash from when the string was added.
+  return poolHash(v->vptr);
+}
+
+// Empty method for interned strings.
+static void emptyInterned(Value *v)
+{
+  if (v->vptr != NULL)
+  {
+    poolRelease(v->vptr);
+    v->vptr = NULL;
+  }
+}
+
+/**
+    Function that looks up a plain string value in a string pool without adding it.  The view
+    borrows the pool's copy, so it hashes and compares like an interned string, but it must
+    not be emptied.
+    @param v pointer to the value to look up.
+    @param pool pool to look in.
+    @param view filled in with the pooled copy if it was found, or with v itself otherwise.
+    @return false if v is a plain string the pool doesn't have, true otherwise.
+*/
+bool findInterned(Value const *v, StringPool const *pool, Value *view)
+{
+  *view = *v;
+  if (v->print != printString || v->vptr == NULL)
+    return true;
+
+  char const *str = v->vptr;
+  char const *shared = poolFind(pool, str, strlen(str), hashString(v));
+  if (!shared)
+    return false;
+
+  // The view only borrows the pool's copy, so it's never emptied.
+  view->vptr = (void *)shared;
+  view->print = printInterned;
+  view->equals = equalsInterned;
+  view->hash = hashInterned;
+  view->empty = emptyInterned;
+  return true;
+}
+
+/**
+    Function that moves a string value into a string pool, so it shares its characters with
+    every equal string in the pool.  Interned strings compare by pointer with each other and
+    keep their hash instead of computing it again.  Values that aren't plain strings are left
+    alone.
+    @param v pointer to the value to intern.
+    @param pool pool to share the string through.
+*/
+void internString(Value *v, StringPool *pool)
+{
+  // Only plain strings are moved into the pool.
+  if (v->print != printString || v->vptr == NULL)
+    return;
+
+  char const *str = v->vptr;
+  char const *shared = poolIntern(pool, str, strlen(str), hashString(v));
+  free(v->vptr);
+  v->vptr = (void *)shared;
+
+  // Moving an interned string is the same as moving a plain one.
+  v->print = printInterned;
+  v->equals = equalsInterned;
+  v->hash = hashInterned;
+  v->empty = emptyInterned;
+}
+
+//////////////////////////////////////////////////////////
+// Packed string implementation.
+
+// Print method for packed strings.
+static void printPacked(Value const *v)
+{
+  printf("\"%s\"", (char *)v->vptr);
+}
+
+// Empty method for packed strings.
+static void emptyPacked(Value *v)
+{
+  if (v->vptr != NULL)
+  {
+    arenaRelease(v->vptr);
+    v->vptr = NULL;
+  }
+}
+
+/**
+    Function that moves the characters of a string value into a string arena, next to the
+    other strings copied there, and frees the string's own allocation.  Values that aren't
+    plain or packed strings are left alone.
+    @param v pointer to the value to pack.
+    @param arena arena to copy the characters into.
+*/
+void packString(Value *v, StringArena *arena)
+{
+  if ((v->print != printString && v->print != printPacked) || v->vptr == NULL)
+    return;
+
+  char const *str = v->vptr;
+  char *packed = arenaCopy(arena, str, strlen(str));
+  v->empty(v);
+  v->vptr = packed;
+
+  // A packed string works just like a plain one, except for how it's freed.
+  v->print = printPacked;
+  v->move = moveString;
+  v->equals = equalsString;
+  v->hash = hashString;
+  v->empty = emptyPacked;
+}
+
+//////////////////////////////////////////////////////////
+// Compressed string implementation.
+
+/** Characters of a compressed string, stored where its vptr points. */
+typedef struct
+{
+  /** Hash of the original string, so it doesn't have to be decompressed for hashing. */
+  unsigned int hash;
+
+  /** Length of the original string. */
+  int rawLen;
+
+  /** Number of compressed bytes. */
+  int len;
+
+  /** The compressed bytes. */
+  unsigned char bytes[];
+} Compressed;
+
+/** A compressed string that's been decompressed recently. */
+typedef struct
+{
+  /** The compressed string, or NULL if the slot isn't in use. */
+  Compressed const *block;
+
+  /** Its characters, null-terminated. */
+  char *text;
+
+  /** Capacity of text, which is kept when the slot is reused. */
+  int cap;
+
+  /** When the slot was last used, to pick the one to reuse. */
+  unsigned int used;
+} CacheSlot;
+
+/** Recently decompressed strings, so printing or comparing one again is cheap. */
+static CacheSlot cache[CACHE_SLOTS];
+
+/** Counter for the used field of the cache slots. */
+static unsigned int cacheClock;
+
+/** Number of compressed strings that haven't been emptied, so the cache can be freed
+    once there are none left. */
+static int liveCompressed;
+
+/**
+  Helper function that gives the characters of a compressed string, decompressing it
+  into the least recently used cache slot if it isn't in the cache already.
+  @param block the compressed string.
+  @return its characters, which stay valid until CACHE_SLOTS other compressed strings
+  have been decompressed. The program stops if the bytes don't decompress to the whole
+  string, since there's no way to give back the right characters.
+*/
+static char const *decompressed(Compressed const *block)
+{
+  CacheSlot *slot = &cache[0];
+  for (int i = 0; i < CACHE_SLOTS; i++)
+  {
+    if (cache[i].block == block)
+    {
+      cache[i].used = ++cacheClock;
+      return cache[i].text;
+    }
+    if (cache[i].used < slot->used)
+      slot = &cache[i];
+  }
+
+  if (slot->cap < block->rawLen + 1)
+  {
+    slot->cap = block->rawLen + 1;
+    slot->text = realloc(slot->text, slot->cap);
+  }
+  if (lzDecompress(block->bytes, block->len, (unsigned char *)slot->text, block->rawLen) !=
+      block->rawLen)
+  {
+    fprintf(stderr, "value: compressed string is corrupt\n");
+    exit(EXIT_FAILURE);
+  }
+  slot->text[block->rawLen] = '\0';
+  slot->block = block;
+  slot->used = ++cacheClock;
+  return slot->text;
+}
+
+// Print method for compressed strings.
+static void printCompressed(Value const *v)
+{
+  printf("\"%s\"", decompressed(v->vptr));
+}
+
+// Equals method for compressed strings.
+static bool equalsCompressed(Value const *v, Value const *other)
+{
+  // The same string always compresses to the same bytes, so two compressed strings
+  // don't need decompressing.
+  if (other->print == printCompressed)
+  {
+    Compressed const *a = v->vptr, *b = other->vptr;
+    return a->hash == b->hash && a->rawLen == b->rawLen && a->len == b->len &&
+           memcmp(a->bytes, b->bytes, a->len) == 0;
+  }
+
+  return equalsString(v, other);
+}
+
+// Hash method for compressed strings.
+static unsigned int hashCompressed(Value const *v)
+{
+  Compressed const *block = v->vptr;
+  return block->hash;
+}
+
+// Empty method for compressed strings.
+static void emptyCompressed(Value *v)
+{
+  if (v->vptr == NULL)
+    return;
+
+  // Another string could be given the same address, so it can't stay in the cache.
+  for (int i = 0; i < CACHE_SLOTS; i++)
+  {
+    if (cache[i].block == v->vptr)
+    {
+      cache[i].block = NULL;
+      cache[i].used = 0;
+    }
+  }
+  free(v->vptr);
+  v->vptr = NULL;
+
+  // With the last compressed string gone, the cache's buffers aren't needed anymore.
+  if (--liveCompressed == 0)
+  {
+    for (int i = 0; i < CACHE_SLOTS; i++)
+    {
+      free(cache[i].text);
+      cache[i].text = NULL;
+      cache[i].cap = 0;
+    }
+  }
+}
+
+/**
+    Function that compresses a plain string value if it's at least the given length and
+    compressing it saves at least an eighth of its size.  Its characters are decompressed
+    again only when they're needed.  Values that aren't plain strings are left alone.
+    @param v pointer to the value to compress.
+    @param threshold shortest string worth compressing.
+*/
+void compressString(Value *v, int threshold)
+{
+  if (v->print != printString || v->vptr == NULL)
+    return;
+
+  char const *str = v->vptr;
+  int rawLen = strlen(str);
+  if (rawLen < threshold)
+    return;
+
+  // Anything bigger than this isn't worth it.
+  int cap = rawLen - rawLen / 8;
+  Compressed *block = malloc(sizeof(Compressed) + cap);
+  int len = lzCompress((unsigned char const *)str, rawLen, block->bytes, cap);
+  if (len == 0)
+  {
+    free(block);
+    return;
+  }
+
+  block = realloc(block, sizeof(Compressed) + len);
+  block->hash = hashString(v);
+  block->rawLen = rawLen;
+  block->len = len;
+  free(v->vptr);
+  v->vptr = block;
+  liveCompressed++;
+
+  // A compressed string moves just like a plain one.
+  v->print = printCompressed;
+  v->equals = equalsCompressed;
+  v->hash = hashCompressed;
+  v->empty = emptyCompressed;
+}
+
+/**
+    Function that gives the characters of a string value, so other components can index
+    or compare string keys without knowing how strings are stored.
+    @param v pointer to the value to look at.
+    @return the null-terminated contents of v if it is a string, or NULL for any other type.
+    The contents of a compressed string are only kept until a few other compressed strings
+    have been looked at.
+*/
+char const *valueString(Value const *v)
+{
+  // The print function tells us what type of value this is.
+  if (v->print == printCompressed)
+    return decompressed(v->vptr);
+  if (v->print != printString && v->print != printInterned && v->print != printPacked)
+    return NULL;
+
+  return v->vptr;
+}
+
+/**
+    Function that tells whether a value is stored entirely inside its Value struct, so
+    emptying it wouldn't free anything.
+    @param v pointer to the value to look at.
+    @return true if v has no memory of its own.
+*/
+bool valueIsInline(Value const *v)
+{
+  // Only numbers are stored right in the struct.
+  return v->print == printInteger || v->print == printLong || v->print == printDouble;
+}
+
+/**
+    Function that tells whether a value is an integer, so its ival field can be used directly.
+    @param v pointer to the value to look at.
+    @return true if v is an integer.
+*/
+bool valueIsInteger(Value const *v)
+{
+  return v->print == printInteger;
+}
+
+/**
+    Function that writes a value to a file in the same form the print function uses for the
+    terminal, which is also the form the driver reads it back in.
+    @param v pointer to the value to write.
+    @param fp file to write the value to.
+*/
+void writeValue(Value const *v, FILE *fp)
+{
+  // The print function tells us what type of value this is.
+  if (v->print == printInteger)
+    fprintf(fp, "%d", v->ival);
+  else if (v->print == printLong)
+    fprintf(fp, "%" PRId64, v->lval);
+  else if (v->print == printDouble)
+    writeDouble(fp, v->dval);
+  else
+    fprintf(fp, "\"%s\"", valueString(v));
+}
+
+/**
+    Function that encodes a value as a self-contained run of bytes that doesn't depend on any
+    pointers, so it can be stored in a file or sent to another process and decoded there.
+    @param v pointer to the value to encode.
+    @param buf buffer the bytes are written to, if they fit.
+    @param cap number of bytes available in buf.
+    @return number of bytes the encoding takes, which may be more than cap. Nothing is written
+    in that case.
+*/
+int encodeValue(Value const *v, unsigned char *buf, int cap)
+{
+  // A tag byte, then the int or the string with its terminator.
+  if (v->print == printInteger)
+  {
+    int need = 1 + sizeof(int);
+    if (need <= cap)
+    {
+      buf[0] = INT_TAG;
+      memcpy(buf + 1, &v->ival, sizeof(int));
+    }
+    return need;
+  }
+
+  // A 64-bit integer is zigzagged so small negative numbers stay short too, then
+  // written seven bits to a byte, low bits first, with the top bit set if more follow.
+  if (v->print == printLong)
+  {
+    unsigned char bytes[VARINT_MAX];
+    uint64_t z = ((uint64_t)v->lval << 1) ^ (uint64_t)(v->lval >> 63);
+    int len = 0;
+    do
+    {
+      bytes[len] = (z & 0x7F) | (z > 0x7F ? 0x80 : 0);
+      z >>= 7;
+      len++;
+    } while (z);
+
+    if (1 + len <= cap)
+    {
+      buf[0] = LONG_TAG;
+      memcpy(buf + 1, bytes, len);
+    }
+    return 1 + len;
+  }
+
+  if (v->print == printDouble)
+  {
+    int need = 1 + sizeof(double);
+    if (need <= cap)
+    {
+      buf[0] = DOUBLE_TAG;
+      memcpy(buf + 1, &v->dval, sizeof(double));
+    }
+    return need;
+  }
+
+  char const *str = valueString(v);
+  int len = strlen(str) + 1;
+  if (1 + len <= cap)
+  {
+    buf[0] = STRING_TAG;
+    memcpy(buf + 1, str, len);
+  }
+  return 1 + len;
+}
+
+/**
+    Function that decodes a value written by encodeValue into a new Value, which the caller has
+    to empty.
+    @param v pointer to the value that will hold the decoded value.
+    @param buf bytes to decode.
+    @param len number of bytes available in buf.
+    @return number of bytes the encoding took, or zero if buf doesn't start with a whole value.
+*/
+int decodeValue(Value *v, unsigned char const *buf, int len)
+{
+  if (len >= 1 + (int)sizeof(int) && buf[0] == INT_TAG)
+  {
+    int val;
+    memcpy(&val, buf + 1, sizeof(int));
+    setInteger(v, val);
+    return 1 + sizeof(int);
+  }
+
+  if (len >= 1 && buf[0] == LONG_TAG)
+  {
+    uint64_t z = 0;
+    for (int i = 1; i < len && i <= VARINT_MAX; i++)
+    {
+      z |= (uint64_t)(buf[i] & 0x7F) << (7 * (i - 1));
+      if (!(buf[i] & 0x80))
+      {
+        setLong(v, (int64_t)(z >> 1) ^ -(int64_t)(z & 1));
+        return i + 1;
+      }
+    }
+    return 0;
+  }
+
+  if (len >= 1 + (int)sizeof(double) && buf[0] == DOUBLE_TAG)
+  {
+    double val;
+    memcpy(&val, buf + 1, sizeof(double));
+    setDouble(v, val);
+    return 1 + sizeof(double);
+  }
+
+  // A string has to have its terminator inside the buffer.
+  unsigned char const *end = len > 1 && buf[0] == STRING_TAG ? memchr(buf + 1, '\0', len - 1) : NULL;
+  if (!end)
+    return 0;
+
+  int slen = end - (buf + 1);
+  char *copy = malloc(slen + 1);
+  memcpy(copy, buf + 1, slen + 1);
+  v->vptr = copy;
+  v->print = printString;
+  v->move = moveString;
+  v->equals = equalsString;
+  v->hash = hashString;
+  v->empty = emptyString;
+  return slen + 2;
+}
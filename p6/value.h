@@ -1,14 +1,18 @@
 /**
     @file value.h
     @author
-    Header for the value component, representing either an integer or
-    string value.
+    Header for the value component, representing an integer, a 64-bit
+    integer, a floating-point number or a string value.
  */
 
 #ifndef VALUE_H
 #define VALUE_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "intern.h"
+#include "arena.h"
 
 /** Map struct ValueStruct to the shorter name, Value. */
 typedef struct ValueStruct Value;
@@ -55,6 +59,12 @@ struct ValueStruct
     /** If this value is an int, we can store it right in the struct. */
     int ival;
 
+    /** A 64-bit integer fits in the struct too. */
+    int64_t lval;
+
+    /** So does a floating-point number. */
+    double dval;
+
     /** If this value is larger, we store it elsewhere in memory and just
         store a generic pointer to it here. */
     void *vptr;
@@ -69,6 +79,35 @@ struct ValueStruct
 */
 int parseInteger(Value *v, char const *str);
 
+/** Initialize the given Value to contain an integer, without parsing it from a string.
+    @param v Pointer to a value instance that will hold the integer.
+    @param val The integer to store.
+*/
+void setInteger(Value *v, int val);
+
+/** Parse a number from the given string.  Whole numbers are stored as integers, or as
+    64-bit integers if they don't fit in an int.  Numbers with a fraction or an exponent,
+    and whole numbers too large for 64 bits, are stored as doubles.  Numbers too large
+    even for a double aren't accepted.
+    @param v Pointer to a value instance that will hold the parsed number.
+    @param str String from which to parse the number.
+    @return Number of characters consumed while parsing the number, or zero if unsuccessful.
+*/
+int parseNumber(Value *v, char const *str);
+
+/** Initialize the given Value to contain a 64-bit integer.  A number that fits in an int
+    is stored as an ordinary integer instead, so equal numbers always have the same type.
+    @param v Pointer to a value instance that will hold the number.
+    @param val The number to store.
+*/
+void setLong(Value *v, int64_t val);
+
+/** Initialize the given Value to contain a floating-point number.
+    @param v Pointer to a value instance that will hold the number.
+    @param val The number to store.
+*/
+void setDouble(Value *v, double val);
+
 /**
     Function that parses a quoted string from the input string. It initializes a Value structure
     to hold the parsed string. The function scans the input for a string that is in double
@@ -79,4 +118,98 @@ int parseInteger(Value *v, char const *str);
     @return number of characters processed from the input string, or zero if unsuccessful.
 */
 int parseString(Value *v, char const *str);
+
+/**
+    Function that moves a string value into a string pool, so it shares its characters with
+    every equal string in the pool.  Interned strings compare by pointer with each other and
+    keep their hash instead of computing it again.  Values that aren't plain strings are left
+    alone.
+    @param v pointer to the value to intern.
+    @param pool pool to share the string through.
+*/
+void internString(Value *v, StringPool *pool);
+
+/**
+    Function that looks up a plain string value in a string pool without adding it, so it can
+    be used to search for interned strings by pointer.  The view it fills in borrows the
+    pool's copy: it must not be emptied, and is only good while the pool has the string.
+    @param v pointer to the value to look up.
+    @param pool pool to look in.
+    @param view filled in with the pooled copy if it was found, or with v itself otherwise,
+    including when v isn't a plain string.
+    @return false if v is a plain string the pool doesn't have, true otherwise.
+*/
+bool findInterned(Value const *v, StringPool const *pool, Value *view);
+
+/**
+    Function that moves the characters of a string value into a string arena, next to the
+    other strings copied there, and frees the string's own allocation.  Values that aren't
+    plain or packed strings are left alone.
+    @param v pointer to the value to pack.
+    @param arena arena to copy the characters into.
+*/
+void packString(Value *v, StringArena *arena);
+
+/**
+    Function that compresses a plain string value if it's at least the given length and
+    compressing it saves at least an eighth of its size.  Its characters are decompressed
+    again only when they're needed.  Values that aren't plain strings are left alone.
+    @param v pointer to the value to compress.
+    @param threshold shortest string worth compressing.
+*/
+void compressString(Value *v, int threshold);
+
+/**
+    Function that gives the characters of a string value, so other components can index
+    or compare string keys without knowing how strings are stored.
+    @param v pointer to the value to look at.
+    @return the null-terminated contents of v if it is a string, or NULL for any other type.
+    The contents of a compressed string are only kept until a few other compressed strings
+    have been looked at.
+*/
+char const *valueString(Value const *v);
+
+/**
+    Function that tells whether a value is stored entirely inside its Value struct, so
+    emptying it wouldn't free anything.
+    @param v pointer to the value to look at.
+    @return true if v has no memory of its own.
+*/
+bool valueIsInline(Value const *v);
+
+/**
+    Function that tells whether a value is an integer, so its ival field can be used directly.
+    @param v pointer to the value to look at.
+    @return true if v is an integer.
+*/
+bool valueIsInteger(Value const *v);
+
+/**
+    Function that writes a value to a file in the same form the print function uses for the
+    terminal, which is also the form the driver reads it back in.
+    @param v pointer to the value to write.
+    @param fp file to write the value to.
+*/
+void writeValue(Value const *v, FILE *fp);
+
+/**
+    Function that encodes a value as a self-contained run of bytes that doesn't depend on any
+    pointers, so it can be stored in a file or sent to another process and decoded there.
+    @param v pointer to the value to encode.
+    @param buf buffer the bytes are written to, if they fit.
+    @param cap number of bytes available in buf.
+    @return number of bytes the encoding takes, which may be more than cap. Nothing is written
+    in that case.
+*/
+int encodeValue(Value const *v, unsigned char *buf, int cap);
+
+/**
+    Function that decodes a value written by encodeValue into a new Value, which the caller has
+    to empty.
+    @param v pointer to the value that will hold the decoded value.
+    @param buf bytes to decode.
+    @param len number of bytes available in buf.
+    @return number of bytes the encoding took, or zero if buf doesn't start with a whole value.
+*/
+int decodeValue(Value *v, unsigned char const *buf, int len);
 #endif
\ No newline at end of file
@@ -0,0 +1,289 @@
+/**
+    @file vindex.c
+    @author Shlok Dave (ssdave)
+    Implementation for the vindex component.  Keys are grouped by the value
+    they hold, in a chained hash table of groups.  Each group keeps its keys
+    in a small open-addressing set by address, so adding or removing a key
+    costs about the same however many other keys share its value.
+  */
+
+#include "vindex.h"
+#include <stdlib.h>
+#include <stdint.h>
+
+/** Number of buckets a new index starts with. */
+#define FIRST_BUCKETS 64
+
+/** Number of slots in the key set of a new group. */
+#define FIRST_SLOTS 4
+
+/** Marks a slot whose key was removed, so probes keep going past it. */
+static Value const removedKey;
+
+/** Every key in the index holding one value. */
+typedef struct GroupStruct Group;
+
+struct GroupStruct
+{
+  /** Copy of the value, owned by the group. */
+  Value val;
+
+  /** Hash of the value. */
+  unsigned int hash;
+
+  /** Next group in the same bucket. */
+  Group *next;
+
+  /** Set of the keys, with NULL for slots never used and &removedKey for
+      slots whose key was removed. */
+  Value const **slots;
+
+  /** Number of slots, a power of two. */
+  int cap;
+
+  /** Number of keys in the set. */
+  int count;
+
+  /** Number of slots that aren't NULL, counting removed ones. */
+  int used;
+};
+
+/** Representation of a reverse index, a chained hash table of groups. */
+struct ValueIndexStruct
+{
+  /** Buckets of the table. */
+  Group **table;
+
+  /** Number of buckets, a power of two. */
+  int tlen;
+
+  /** Number of groups in the table. */
+  int size;
+};
+
+/**
+  Helper function that hashes the address of a key, to pick its slot in a group.
+  @param key address of the key.
+  @return hash of the address.
+*/
+static unsigned int hashKey(Value const *key)
+{
+  // The low bits of an address are always the same, so mix the rest down into them.
+  uint64_t a = (uintptr_t)key >> 4;
+  unsigned int h = (unsigned int)(a ^ (a >> 32)) * 2654435761u;
+  return h ^ (h >> 16);
+}
+
+/**
+  Helper function that finds the group for a value.
+  @param vi the index to look in.
+  @param val the value to look for.
+  @param hash hash of the value.
+  @return pointer to the link that points at the group, or at the NULL at the end
+  of its bucket if the value has no group.
+*/
+static Group **findGroup(ValueIndex const *vi, Value const *val, unsigned int hash)
+{
+  Group **g = &vi->table[hash & (vi->tlen - 1)];
+  while (*g && !((*g)->hash == hash && (*g)->val.equals(&(*g)->val, val)))
+    g = &(*g)->next;
+  return g;
+}
+
+/**
+  Helper function that makes a group for a value, with its own copy of the value.
+  The copy goes through the value's byte encoding, which works for every type.
+  @param val the value the group is for.
+  @param hash hash of the value.
+  @return pointer to the new, empty group.
+*/
+static Group *makeGroup(Value const *val, unsigned int hash)
+{
+  Group *g = calloc(1, sizeof(Group));
+  int len = encodeValue(val, NULL, 0);
+  unsigned char *buf = malloc(len);
+  encodeValue(val, buf, len);
+  decodeValue(&g->val, buf, len);
+  free(buf);
+
+  g->hash = hash;
+  g->cap = FIRST_SLOTS;
+  g->slots = calloc(g->cap, sizeof(Value const *));
+  return g;
+}
+
+/**
+  Helper function that moves the keys of a group into a new set of slots, leaving
+  out the removed ones.
+  @param g the group to rehash.
+  @param cap number of slots in the new set, a power of two.
+*/
+static void rehashGroup(Group *g, int cap)
+{
+  Value const **slots = calloc(cap, sizeof(Value const *));
+  for (int i = 0; i < g->cap; i++)
+  {
+    Value const *key = g->slots[i];
+    if (!key || key == &removedKey)
+      continue;
+
+    int idx = hashKey(key) & (cap - 1);
+    while (slots[idx])
+      idx = (idx + 1) & (cap - 1);
+    slots[idx] = key;
+  }
+
+  free(g->slots);
+  g->slots = slots;
+  g->cap = cap;
+  g->used = g->count;
+}
+
+/**
+  Helper function that doubles the number of buckets in the index.
+  @param vi the index to grow.
+*/
+static void growIndex(ValueIndex *vi)
+{
+  int len = vi->tlen * 2;
+  Group **table = calloc(len, sizeof(Group *));
+  for (int idx = 0; idx < vi->tlen; idx++)
+  {
+    Group *g = vi->table[idx];
+    while (g)
+    {
+      Group *next = g->next;
+      g->next = table[g->hash & (len - 1)];
+      table[g->hash & (len - 1)] = g;
+      g = next;
+    }
+  }
+
+  free(vi->table);
+  vi->table = table;
+  vi->tlen = len;
+}
+
+/**
+  This function makes a new reverse index with no keys in it.
+  @return pointer to the new index.
+*/
+ValueIndex *makeValueIndex(void)
+{
+  ValueIndex *vi = calloc(1, sizeof(ValueIndex));
+  vi->tlen = FIRST_BUCKETS;
+  vi->table = calloc(vi->tlen, sizeof(Group *));
+  return vi;
+}
+
+/**
+  This function records that a key holds a value, making a group for the value if
+  no other key holds it yet.
+  @param vi pointer to the index.
+  @param val the value the key holds.
+  @param key the key, which has to stay at the same address while it's in the index.
+*/
+void vindexAdd(ValueIndex *vi, Value const *val, Value const *key)
+{
+  unsigned int hash = val->hash(val);
+  Group **link = findGroup(vi, val, hash);
+  if (!*link)
+  {
+    *link = makeGroup(val, hash);
+    if (++vi->size > vi->tlen)
+      growIndex(vi);
+    link = findGroup(vi, val, hash);
+  }
+  Group *g = *link;
+
+  // Keep at least half the slots never used, so probes stay short.
+  if ((g->used + 1) * 2 > g->cap)
+    rehashGroup(g, (g->count + 1) * 4 > g->cap ? g->cap * 2 : g->cap);
+
+  int idx = hashKey(key) & (g->cap - 1);
+  while (g->slots[idx])
+    idx = (idx + 1) & (g->cap - 1);
+  g->slots[idx] = key;
+  g->count++;
+  g->used++;
+}
+
+/**
+  This function records that a key no longer holds a value. Once no key holds the
+  value, its group is freed.
+  @param vi pointer to the index.
+  @param val the value the key held.
+  @param key the key, at the address it was added with.
+  @return true if the key was found and removed.
+*/
+bool vindexRemove(ValueIndex *vi, Value const *val, Value const *key)
+{
+  Group **link = findGroup(vi, val, val->hash(val));
+  Group *g = *link;
+  if (!g)
+    return false;
+
+  int idx = hashKey(key) & (g->cap - 1);
+  while (g->slots[idx] && g->slots[idx] != key)
+    idx = (idx + 1) & (g->cap - 1);
+  if (!g->slots[idx])
+    return false;
+
+  g->slots[idx] = &removedKey;
+  if (--g->count > 0)
+    return true;
+
+  // Nobody holds the value anymore.
+  *link = g->next;
+  g->val.empty(&g->val);
+  free(g->slots);
+  free(g);
+  vi->size--;
+  return true;
+}
+
+/**
+  This function calls a function on every key that holds the given value. Only the
+  value's own group is looked at.
+  @param vi pointer to the index.
+  @param val the value to look for.
+  @param fn function to call for each key.
+  @param data pointer passed along to fn.
+  @return number of keys that hold the value.
+*/
+int vindexFind(ValueIndex const *vi, Value const *val, ValueIndexVisitor fn, void *data)
+{
+  Group *g = *findGroup(vi, val, val->hash(val));
+  if (!g)
+    return 0;
+
+  for (int i = 0; i < g->cap; i++)
+  {
+    if (g->slots[i] && g->slots[i] != &removedKey)
+      fn(g->slots[i], &g->val, data);
+  }
+  return g->count;
+}
+
+/**
+  This function frees every group in the index and the index itself.
+  @param vi pointer to the index to free.
+*/
+void freeValueIndex(ValueIndex *vi)
+{
+  for (int idx = 0; idx < vi->tlen; idx++)
+  {
+    Group *g = vi->table[idx];
+    while (g)
+    {
+      Group *next = g->next;
+      g->val.empty(&g->val);
+      free(g->slots);
+      free(g);
+      g = next;
+    }
+  }
+
+  free(vi->table);
+  free(vi);
+}
@@ -0,0 +1,61 @@
+/**
+    @file vindex.h
+    @author Shlok Dave (ssdave)
+    Header for the vindex component, a reverse index that finds every key
+    holding a given value without looking at the rest of a map.
+*/
+
+#ifndef VINDEX_H
+#define VINDEX_H
+
+#include "value.h"
+#include <stdbool.h>
+
+/** Incomplete type for the reverse index representation. */
+typedef struct ValueIndexStruct ValueIndex;
+
+/** Type for a function called on each key found for a value.
+    @param key The key, as it was given when it was added.
+    @param val Copy of the value the key holds, owned by the index.
+    @param data Pointer given by the caller of the search.
+*/
+typedef void (*ValueIndexVisitor)(Value const *key, Value const *val, void *data);
+
+/** Make an empty reverse index.
+    @return pointer to a new index.
+*/
+ValueIndex *makeValueIndex(void);
+
+/** Record that a key holds a value.  The index doesn't copy the key, so
+    it must stay at the same address until it's removed.
+    @param vi Index to add to.
+    @param val Value the key holds.
+    @param key Key to add.
+*/
+void vindexAdd(ValueIndex *vi, Value const *val, Value const *key);
+
+/** Record that a key no longer holds a value.
+    @param vi Index to remove from.
+    @param val Value the key held when it was added.
+    @param key Key to remove, the same address it was added with.
+    @return true if the key was in the index for that value.
+*/
+bool vindexRemove(ValueIndex *vi, Value const *val, Value const *key);
+
+/** Call a function on every key that holds a value.  The function must
+    not change the index.
+    @param vi Index to search.
+    @param val Value to look for.
+    @param fn Function to call for each key.
+    @param data Pointer passed to each call of fn.
+    @return number of keys visited.
+*/
+int vindexFind(ValueIndex const *vi, Value const *val, ValueIndexVisitor fn, void *data);
+
+/** Free all the memory used by an index.  The keys belong to the caller
+    and aren't freed.
+    @param vi The index to free.
+*/
+void freeValueIndex(ValueIndex *vi);
+
+#endif